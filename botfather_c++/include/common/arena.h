@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include <new>
+using namespace std;
+
+// Bộ cấp phát kiểu bump cho dữ liệu tạm của 1 lần đóng nến (series indicator, cột dẫn xuất, prefix sum,
+// bảng min/max). Cấp phát chỉ là tăng offset, giải phóng từng phần là no-op, Worker::run reset 1 lần cuối lần đóng nến.
+// Mỗi thread 1 arena (exprArena), chunk được giữ lại cho lần sau nhưng tối đa MAX_RETAINED byte.
+class Arena
+{
+private:
+    struct Chunk
+    {
+        char *data;
+        size_t size;
+    };
+
+    struct Destructor
+    {
+        void (*destroy)(void *);
+        void *object;
+    };
+
+    vector<Chunk> chunks;
+    size_t current = 0; // chunk đang cấp phát
+    size_t offset = 0;  // byte đã dùng trong chunk hiện tại
+    vector<Destructor> destructors;
+    size_t used = 0;      // byte đã cấp phát từ lần reset trước
+    size_t highWater = 0; // used lớn nhất của 1 lần đóng nến
+    int id;
+
+    static atomic<int> nextId;
+    static atomic<size_t> totalReserved; // tổng chunk của mọi arena
+
+    void addChunk(size_t size);
+    void releaseChunks(size_t from);
+
+public:
+    static constexpr size_t CHUNK_SIZE = 256 * 1024;
+    static constexpr size_t MAX_RETAINED = 16 * 1024 * 1024;
+
+    Arena() : id(nextId++) {}
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t bytes, size_t align);
+
+    // object có destructor thì được hủy lúc reset
+    template <typename T, typename... Args>
+    T *create(Args &&...args)
+    {
+        T *object = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+        if (!is_trivially_destructible_v<T>)
+            destructors.push_back({[](void *p)
+                                   { static_cast<T *>(p)->~T(); },
+                                   object});
+        return object;
+    }
+
+    // hủy các object đã create, trả toàn bộ bộ nhớ về đầu chunk. Trả về true nếu high-water tăng
+    bool reset();
+
+    int getId() const { return id; }
+    size_t bytesUsed() const { return used; }
+    size_t highWaterMark() const { return highWater; }
+    size_t bytesReserved() const;
+    static size_t totalBytesReserved() { return totalReserved.load(memory_order_relaxed); }
+};
+
+// allocator cho vector: có arena thì lấy từ arena, không có (mặc định) thì new/delete như std::allocator.
+// Vector lấy từ arena không được dùng sau khi arena reset.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = true_type;
+    using propagate_on_container_move_assignment = true_type;
+    using propagate_on_container_swap = true_type;
+    using is_always_equal = false_type;
+
+    Arena *arena = nullptr;
+
+    ArenaAllocator() = default;
+    ArenaAllocator(Arena *arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n)
+    {
+        if (arena)
+            return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        if (!arena)
+            ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+using ArenaVector = vector<double, ArenaAllocator<double>>;
+
+extern thread_local Arena exprArena;
+
+inline Arena *&arenaOverride()
+{
+    static thread_local Arena *arena = nullptr;
+    return arena;
+}
+
+// arena của dữ liệu tạm lần đóng nến trên thread này: exprArena, hoặc arena đang đặt bởi ArenaScope
+inline Arena &currentArena()
+{
+    Arena *arena = arenaOverride();
+    return arena ? *arena : exprArena;
+}
+
+// cấp phát trên arena của thread khác trong phạm vi scope (lane song song ghi vào cache của thread series).
+// Người gọi phải đảm bảo không thread nào khác cấp phát trên arena đó cùng lúc
+class ArenaScope
+{
+private:
+    Arena *previous;
+
+public:
+    explicit ArenaScope(Arena &arena) : previous(arenaOverride()) { arenaOverride() = &arena; }
+    ~ArenaScope() { arenaOverride() = previous; }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+};
+
+// vector rỗng lấy bộ nhớ từ currentArena(), reserve trước để không phải cấp phát lại khi push_back
+inline ArenaVector arenaVector(size_t reserve = 0)
+{
+    ArenaVector result{ArenaAllocator<double>(&currentArena())};
+    result.reserve(reserve);
+    return result;
+}
@@ -27,8 +27,13 @@
 #include <filesystem>
 #include <random>
 #include <algorithm>
+#include <numeric>
+#include <atomic>
 
 #include "sparse_table.h"
+#include "range_query.h"
+#include "series_index.h"
+#include "expr_program.h"
 
 #include <websocketpp/config/asio_client.hpp>
 #include <websocketpp/client.hpp>
@@ -107,6 +112,56 @@ struct NODE_TYPE
     inline static const string CLOSE_ALL_POSITION = "closeAllPosition";
 };
 
+// NODE_TYPE dạng enum, resolve 1 lần lúc đọc route để worker không phải so sánh chuỗi
+enum class NodeKind : uint8_t
+{
+    START,
+    EXPR,
+    TELEGRAM,
+    BUY_MARKET,
+    BUY_LIMIT,
+    BUY_STOP_MARKET,
+    BUY_STOP_LIMIT,
+    SELL_MARKET,
+    SELL_LIMIT,
+    SELL_STOP_MARKET,
+    SELL_STOP_LIMIT,
+    CLOSE_ALL_ORDER,
+    CLOSE_ALL_POSITION,
+    UNKNOWN,
+};
+
+inline NodeKind nodeKind(const string &type)
+{
+    static const unordered_map<string, NodeKind> kinds = {
+        {NODE_TYPE::START, NodeKind::START},
+        {NODE_TYPE::EXPR, NodeKind::EXPR},
+        {NODE_TYPE::TELEGRAM, NodeKind::TELEGRAM},
+        {NODE_TYPE::BUY_MARKET, NodeKind::BUY_MARKET},
+        {NODE_TYPE::BUY_LIMIT, NodeKind::BUY_LIMIT},
+        {NODE_TYPE::BUY_STOP_MARKET, NodeKind::BUY_STOP_MARKET},
+        {NODE_TYPE::BUY_STOP_LIMIT, NodeKind::BUY_STOP_LIMIT},
+        {NODE_TYPE::SELL_MARKET, NodeKind::SELL_MARKET},
+        {NODE_TYPE::SELL_LIMIT, NodeKind::SELL_LIMIT},
+        {NODE_TYPE::SELL_STOP_MARKET, NodeKind::SELL_STOP_MARKET},
+        {NODE_TYPE::SELL_STOP_LIMIT, NodeKind::SELL_STOP_LIMIT},
+        {NODE_TYPE::CLOSE_ALL_ORDER, NodeKind::CLOSE_ALL_ORDER},
+        {NODE_TYPE::CLOSE_ALL_POSITION, NodeKind::CLOSE_ALL_POSITION}};
+    auto it = kinds.find(type);
+    return it == kinds.end() ? NodeKind::UNKNOWN : it->second;
+}
+
+// 8 loại mở lệnh
+inline bool isOrderKind(NodeKind kind)
+{
+    return kind >= NodeKind::BUY_MARKET && kind <= NodeKind::SELL_STOP_LIMIT;
+}
+
+inline bool isBuyKind(NodeKind kind)
+{
+    return kind >= NodeKind::BUY_MARKET && kind <= NodeKind::BUY_STOP_LIMIT;
+}
+
 struct ORDER_STATUS
 {
     inline static const string OPENED = "Mở lệnh";
@@ -117,6 +172,24 @@ struct ORDER_STATUS
     inline static const string CANCELED = "Đã hủy";
 };
 
+// các trường của lệnh đã compile, {x} được thay bằng (x). nullptr => tính lại từ text
+struct OrderTemplate
+{
+    shared_ptr<const Program> stop;
+    shared_ptr<const Program> entry;
+    shared_ptr<const Program> sl;
+    shared_ptr<const Program> tp;
+    shared_ptr<const Program> volume;
+    shared_ptr<const Program> expiredTime;
+};
+
+// nội dung telegram đã tách sẵn: fragments[0] slot[0] fragments[1] ... fragments[n]
+struct MessageTemplate
+{
+    vector<string> fragments;
+    vector<shared_ptr<const Program>> slots;
+};
+
 struct NodeData
 {
     string id;
@@ -134,13 +207,63 @@ struct NodeData
     string sl;
     string volume;
     string expiredTime;
+    NodeKind kind = NodeKind::UNKNOWN; // từ type
+    shared_ptr<const Program> program; // value đã compile, lấy từ ExprRegistry
+    int dagNode = -1;                  // node gốc của value trong BotList::dag
+    shared_ptr<const OrderTemplate> order;
+    shared_ptr<const MessageTemplate> message; // nullptr => dùng calculateSubExpr
 };
 
+struct ExprChain;
+
 struct Route
 {
     string id;
     NodeData data;
     vector<Route> next;
+    shared_ptr<ExprChain> chain; // != nullptr => route là đầu 1 chuỗi expr
+};
+
+// thống kê của 1 node trong chuỗi, cập nhật từ nhiều worker
+struct ExprNodeStats
+{
+    atomic<uint64_t> evals{0};
+    atomic<uint64_t> passes{0};
+    atomic<uint64_t> samples{0};
+    atomic<uint64_t> sampledNs{0};
+};
+
+// các node expr nối tiếp, mỗi node chỉ có 1 next và id không xuất hiện ở nhánh khác => chuỗi là AND
+// của các điều kiện, bit visited chỉ chuỗi dùng nên worker sắp lại theo cost / (1 - pass rate) mà kết quả không đổi
+struct ExprChain
+{
+    vector<NodeData *> nodes; // thứ tự user vẽ
+    vector<int> ids;          // bit visited của từng node, đánh số bởi RouteProgram
+    Route *tail = nullptr;    // node cuối, đi tiếp vào tail->next
+    unique_ptr<ExprNodeStats[]> stats;
+    atomic<uint64_t> runs{0};
+    shared_ptr<const vector<int>> order; // đọc/ghi bằng atomic_load/atomic_store
+};
+
+// 1 node của RouteProgram. Node đầu chuỗi expr chạy cả chuỗi, con là next của node cuối chuỗi
+struct RouteStep
+{
+    NodeKind kind;
+    int visitId;            // bit trong bitset visited, các node cùng id route dùng chung 1 bit
+    int firstChild;         // con nằm ở children[firstChild, firstChild + childCount)
+    int childCount;
+    NodeData *data;         // trỏ vào Bot::route
+    ExprChain *chain;       // != nullptr => đầu chuỗi expr
+};
+
+// Route đã compile thành mảng phẳng: steps[0] là gốc, con của mọi node nằm liền nhau trong children.
+// Worker duyệt bằng stack index và đánh dấu visited bằng bitset visitCount bit thay vì đệ quy + map theo stoll(id)
+struct RouteProgram
+{
+    vector<RouteStep> steps;
+    vector<int> children;
+    int visitCount = 0;
+    vector<int> leaves; // leaf DAG (không tính hằng) của các node expr, warm-up trước khi chạy song song
 };
 
 struct Symbol
@@ -156,6 +279,7 @@ struct Bot
     string botName;
     vector<string> idTelegram;
     Route route;
+    RouteProgram program; // compile từ route sau khi đã gom chuỗi expr
     vector<Symbol> symbolList;
     vector<string> timeframes;
     string treeData;
@@ -166,6 +290,17 @@ struct Bot
     bool enableRealOrder;
 };
 
+class ExprDag;
+
+// danh sách bot đang chạy, publish nguyên khối cho các worker
+struct BotList
+{
+    vector<shared_ptr<Bot>> bots;
+    shared_ptr<const ExprDag> dag; // expr của tất cả bot đã gộp
+    unordered_map<string, int> lookbacks; // key = broker:symbol_timeframe, số nến gần nhất các bot trên series cần
+    SeriesIndex seriesIndex;              // series -> vị trí các bot theo dõi trong bots
+};
+
 struct Digit
 {
     int volume;
@@ -1,4 +1,4 @@
-#pragma one
+#pragma once
 #include "common_type.h"
 
 struct MACD_Output
@@ -15,24 +15,153 @@ struct BB_Output
     double upper;
 };
 
-vector<double> iRSI(int period, const double close[], int n);
+ArenaVector iRSI(int period, const double close[], int n);
 double iRSI_slope(int period, const double close[], int n);
 double iMA(int period, const double close[], int n);
 double iEMA(int period, const double close[], int n);
-vector<double> iMACD(int fastPeriod, int slowPeriod, int signalPeriod, const double close[], int n);
+ArenaVector iEMASeries(int period, const double close[], int n);
+ArenaVector iMACD(int fastPeriod, int slowPeriod, int signalPeriod, const double close[], int n);
 BB_Output iBB(int period, double stdDev, const double close[], int n);
-int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth, int depth, int enableDivergence, double diffCandle0, vector<double> &diffPercents, const double close[], const double open[], const double high[], int n);
-int macd_n_day(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth, int depth, int enableDivergence, double diffCandle0, vector<double> &diffPercents, const double close[], const double open[], const double high[], int n);
+// macd: buffer MACD đã cache (macd, signal, histogram xen kẽ) bắt đầu từ nến cần tính, count = số nến trong buffer
+int macd_n_dinh(const double macd[], int count, int redDepth, int depth, int enableDivergence, double diffCandle0, const double diffPercents[], int diffCount, const double close[], const double open[], const double high[]);
+int macd_n_day(const double macd[], int count, int redDepth, int depth, int enableDivergence, double diffCandle0, const double diffPercents[], int diffCount, const double close[], const double open[], const double high[]);
 double macd_slope(int fastPeriod, int slowPeriod, int signalPeriod, const double close[], int n);
 double iAvg(int period, const double close[], int n);
 double iMin(int period, const double close[], int n);
 double iMax(int period, const double close[], int n);
-double iAvg(int period, int n, function<double(int)> f);
-double iMin(int period, int n, function<double(int)> f);
-double iMax(int period, int n, function<double(int)> f);
 double iMinRSI(int period, int k, const double close[], int n);
 double iMaxRSI(int period, int k, const double close[], int n);
 double iAvgRSI(int period, int k, const double close[], int n);
-double iMinMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, function<double(MACD_Output)> f);
-double iMaxMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, function<double(MACD_Output)> f);
-double iAvgMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, function<double(MACD_Output)> f);
\ No newline at end of file
+
+// Các hàm gộp theo hàm f là template để f được inline (function<> tốn 1 lần gọi gián tiếp mỗi phần tử).
+// f(i) trả về giá trị của nến i, f(MACD_Output) chọn macd/signal/histogram.
+
+template <typename F>
+using EnableIfIndexFunction = enable_if_t<is_invocable_r_v<double, F, int>, int>;
+
+template <typename F>
+using EnableIfMACDFunction = enable_if_t<is_invocable_r_v<double, F, MACD_Output>, int>;
+
+const double INF = 1e18;
+
+template <typename F, EnableIfIndexFunction<F> = 0>
+double iAvg(int period, int n, F f)
+{
+    if (period <= 0 || n < period)
+        return 0.0;
+
+    double sum = 0.0;
+    for (int i = 0; i < period; ++i)
+    {
+        sum += f(i);
+    }
+    return sum / period;
+}
+
+template <typename F, EnableIfIndexFunction<F> = 0>
+double iMin(int period, int n, F f)
+{
+    if (period <= 0 || n < period)
+        return 0.0;
+
+    double minVal = f(0);
+
+    for (int i = 1; i < period; ++i)
+    {
+        minVal = min(minVal, f(i));
+    }
+
+    return minVal;
+}
+
+template <typename F, EnableIfIndexFunction<F> = 0>
+double iMax(int period, int n, F f)
+{
+    if (period <= 0 || n < period)
+        return 0.0;
+
+    double maxVal = f(0);
+
+    for (int i = 1; i < period; ++i)
+    {
+        maxVal = max(maxVal, f(i));
+    }
+
+    return maxVal;
+}
+
+// chạy MACD từ nến n - 1 về nến 0, gọi visit(MACD_Output) cho k nến mới nhất.
+// trả về false nếu tham số không hợp lệ
+template <typename Visit>
+bool visitMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, Visit visit)
+{
+    n = min(n, MAX_N + slowPeriod + k);
+
+    if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
+        return false;
+
+    double kFast = 2.0 / (fastPeriod + 1);
+    double kSlow = 2.0 / (slowPeriod + 1);
+    double kSignal = 2.0 / (signalPeriod + 1);
+
+    double emaFast = close[n - 1];
+    double emaSlow = close[n - 1];
+    double macd = 0.0;
+    double signalEMA = 0.0;
+
+    bool signalInitialized = false;
+
+    for (int i = n - 2; i >= 0; --i)
+    {
+        emaFast = (close[i] - emaFast) * kFast + emaFast;
+        emaSlow = (close[i] - emaSlow) * kSlow + emaSlow;
+
+        macd = emaFast - emaSlow;
+
+        if (signalInitialized)
+        {
+            signalEMA = (macd - signalEMA) * kSignal + signalEMA;
+        }
+        else
+        {
+            signalEMA = macd;
+            signalInitialized = true;
+        }
+
+        if (i < k)
+        {
+            visit(MACD_Output{macd, signalEMA, macd - signalEMA});
+        }
+    }
+
+    return true;
+}
+
+template <typename F, EnableIfMACDFunction<F> = 0>
+double iMinMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, F f)
+{
+    double result = INF;
+    visitMACD(fastPeriod, slowPeriod, signalPeriod, k, close, n, [&](const MACD_Output &output)
+              { result = min(result, f(output)); });
+    return result;
+}
+
+template <typename F, EnableIfMACDFunction<F> = 0>
+double iMaxMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, F f)
+{
+    double result = -INF;
+    if (!visitMACD(fastPeriod, slowPeriod, signalPeriod, k, close, n, [&](const MACD_Output &output)
+                   { result = max(result, f(output)); }))
+        return INF;
+    return result;
+}
+
+template <typename F, EnableIfMACDFunction<F> = 0>
+double iAvgMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, F f)
+{
+    double sum = 0;
+    if (!visitMACD(fastPeriod, slowPeriod, signalPeriod, k, close, n, [&](const MACD_Output &output)
+                   { sum += f(output); }))
+        return 0.0;
+    return sum / k;
+}
\ No newline at end of file
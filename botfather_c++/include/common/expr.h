@@ -1,24 +1,14 @@
-#pragma one
+#pragma once
 
 #include "common_type.h"
-#include "antlr4-runtime.h"
-#include "ExprBaseVisitor.h"
-#include "ExprLexer.h"
-#include "ExprParser.h"
-#include "ExprVisitor.h"
-#include <ANTLRFileStream.h>
-#include <CommonTokenStream.h>
-using namespace antlr4;
+#include "expr_program.h"
+#include "expr_dag.h"
 
-struct cachedIndicatorParseTree
-{
-    unique_ptr<ANTLRInputStream> input;
-    unique_ptr<ExprLexer> lexer;
-    unique_ptr<CommonTokenStream> tokens;
-    unique_ptr<ExprParser> parser;
-    antlr4::tree::ParseTree *tree = nullptr;
-};
-class Expr : public ExprBaseVisitor
+class SeriesMemo;
+struct IndicatorStream;
+class PrefixSum;
+
+class Expr
 {
 private:
     string broker;
@@ -32,124 +22,68 @@ private:
     const double *volume;
     long long *startTime;
     double fundingRate;
-    unordered_map<long long, vector<double>> *cachedIndicator;
-    unordered_map<long long, unique_ptr<SparseTable>>* cachedMinMax;
+    unordered_map<long long, ArenaVector> *cachedIndicator;
+    unordered_map<long long, RangeQuery *> *cachedMinMax;
+    SeriesMemo *seriesMemo = nullptr; // kết quả leaf của các lần đóng nến trước
+
+    // RSI/EMA/MACD tiến dần theo nến của seriesMemo, nullptr nếu không có seriesMemo
+    const IndicatorStream *getRSIStream(int period);
+    const IndicatorStream *getEMAStream(int period);
+    const IndicatorStream *getMACDStream(int fastPeriod, int slowPeriod, int signalPeriod);
+    // cột theo nến: open..volume trỏ thẳng vào dữ liệu, change/ampl/shadow và bản % tính 1 lần vào cachedIndicator
+    const double *getColumn(OpCode column);
+    // tổng/trung bình/phương sai đoạn O(1) cho avg_*, ma, bb_*, marsi, avg_macd_*
+    PrefixSum getPrefixSum(long long key, const double *a, int n);
+    PrefixSum getPrefixSum(OpCode column);
+    PrefixSum getPrefixSumMACD(long long key, const ArenaVector &cachedMACD, int offset);
+    RangeQuery &getMinMax(OpCode column); // có seriesMemo thì giữ SparseTable qua các lần đóng nến
+    RangeQuery &getMinMax(long long key, const double *a, int n);
+    RangeQuery &getMinMaxMACD(long long key, const ArenaVector &cachedMACD, int offset);
+    bool evalLeaf(const Instruction &ins, const double *pool, double &result);
+    bool evalLeafMemo(const Instruction &ins, const double *pool, double &result);
 
 public:
     Expr(const string &broker, const string &symbol, const string &timeframe, int length,
          const double *open, const double *high, const double *low, const double *close, const double *volume,
-         long long *startTime, double fundingRate, unordered_map<long long, vector<double>> *cachedIndicator, unordered_map<long long, unique_ptr<SparseTable>>* cachedMinMax)
+         long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax)
         : broker(broker), symbol(symbol), timeframe(timeframe), length(length), open(open), high(high), low(low), close(close), volume(volume), startTime(startTime), fundingRate(fundingRate), cachedIndicator(cachedIndicator), cachedMinMax(cachedMinMax)
     {
     }
 
-    // any visit(antlr4::tree::ParseTree *tree) override;
-
-    vector<double>& getRSI(int period);
-    vector<double>& getMACD(int fastPeriod, int slowPeriod, int signalPeriod);
-
-    any visitNumber(ExprParser::NumberContext *ctx) override;
-    any visitFloat(ExprParser::FloatContext *ctx) override;
-    any visitInt(ExprParser::IntContext *ctx) override;
-    any visitString(ExprParser::StringContext *ctx) override;
-    any visitNegative(ExprParser::NegativeContext *ctx) override;
-    any visitPositive(ExprParser::PositiveContext *ctx) override;
-    any visitMulDiv(ExprParser::MulDivContext *ctx) override;
-    any visitAddSub(ExprParser::AddSubContext *ctx) override;
-    any visitComparison(ExprParser::ComparisonContext *ctx) override;
-    any visitParens(ExprParser::ParensContext *ctx) override;
-    any visitABS(ExprParser::ABSContext *ctx) override;
-    any visitMIN(ExprParser::MINContext *ctx) override;
-    any visitMAX(ExprParser::MAXContext *ctx) override;
-
-    any visitOpen(ExprParser::OpenContext *ctx) override;
-    any visitHigh(ExprParser::HighContext *ctx) override;
-    any visitLow(ExprParser::LowContext *ctx) override;
-    any visitClose(ExprParser::CloseContext *ctx) override;
-    any visitVolume(ExprParser::VolumeContext *ctx) override;
-
-    any visitChange(ExprParser::ChangeContext *context) override;
-    any visitChangeP(ExprParser::ChangePContext *context) override;
-    any visitAmpl(ExprParser::AmplContext *ctx) override;
-    any visitAmplP(ExprParser::AmplPContext *ctx) override;
-    any visitUpper_shadow(ExprParser::Upper_shadowContext *ctx) override;
-    any visitUpper_shadowP(ExprParser::Upper_shadowPContext *ctx) override;
-    any visitLower_shadow(ExprParser::Lower_shadowContext *ctx) override;
-    any visitLower_shadowP(ExprParser::Lower_shadowPContext *ctx) override;
-
-    // indicator
-    any visitRsi(ExprParser::RsiContext *ctx) override;
-    any visitRsi_slope(ExprParser::Rsi_slopeContext *ctx) override;
-    any visitMa(ExprParser::MaContext *ctx) override;
-    any visitEma(ExprParser::EmaContext *ctx) override;
-    any visitMacd_value(ExprParser::Macd_valueContext *ctx) override;
-    any visitMacd_signal(ExprParser::Macd_signalContext *ctx) override;
-    any visitMacd_histogram(ExprParser::Macd_histogramContext *ctx) override;
-    any visitBb_upper(ExprParser::Bb_upperContext *ctx) override;
-    any visitBb_middle(ExprParser::Bb_middleContext *ctx) override;
-    any visitBb_lower(ExprParser::Bb_lowerContext *ctx) override;
-    any visitMacd_n_dinh(ExprParser::Macd_n_dinhContext *ctx) override;
-    any visitMacd_slope(ExprParser::Macd_slopeContext *ctx) override;
-
-    // avg min max
-    any visitAvg_open(ExprParser::Avg_openContext *ctx) override;
-    any visitAvg_high(ExprParser::Avg_highContext *ctx) override;
-    any visitAvg_low(ExprParser::Avg_lowContext *ctx) override;
-    any visitAvg_close(ExprParser::Avg_closeContext *ctx) override;
-    any visitAvg_ampl(ExprParser::Avg_amplContext *ctx) override;
-    any visitAvg_amplP(ExprParser::Avg_amplPContext *ctx) override;
+    void setSeriesMemo(SeriesMemo *memo) { seriesMemo = memo; }
 
-    any visitMin_open(ExprParser::Min_openContext *ctx) override;
-    any visitMin_high(ExprParser::Min_highContext *ctx) override;
-    any visitMin_low(ExprParser::Min_lowContext *ctx) override;
-    any visitMin_close(ExprParser::Min_closeContext *ctx) override;
-    any visitMin_change(ExprParser::Min_changeContext *ctx) override;
-    any visitMin_changeP(ExprParser::Min_changePContext *ctx) override;
-    any visitMin_ampl(ExprParser::Min_amplContext *ctx) override;
-    any visitMin_amplP(ExprParser::Min_amplPContext *ctx) override;
+    ArenaVector &getRSI(int period);
+    ArenaVector &getMACD(int fastPeriod, int slowPeriod, int signalPeriod);
+    ArenaVector &getEMA(int period);
+    ArenaVector &getRSISlope(int period);
+    ArenaVector &getMACDSlope(int fastPeriod, int slowPeriod, int signalPeriod);
 
-    any visitMax_open(ExprParser::Max_openContext *ctx) override;
-    any visitMax_high(ExprParser::Max_highContext *ctx) override;
-    any visitMax_low(ExprParser::Max_lowContext *ctx) override;
-    any visitMax_close(ExprParser::Max_closeContext *ctx) override;
-    any visitMax_change(ExprParser::Max_changeContext *ctx) override;
-    any visitMax_changeP(ExprParser::Max_changePContext *ctx) override;
-    any visitMax_ampl(ExprParser::Max_amplContext *ctx) override;
-    any visitMax_amplP(ExprParser::Max_amplPContext *ctx) override;
+    // chạy bytecode, trả về false nếu không có giá trị
+    bool run(const Program &program, double &result);
 
-    any visitMin_rsi(ExprParser::Min_rsiContext *ctx) override;
-    any visitMax_rsi(ExprParser::Max_rsiContext *ctx) override;
-    any visitMarsi(ExprParser::MarsiContext *ctx) override;
+    // tính node id của DAG, mỗi node chỉ tính 1 lần cho mỗi epoch của memo.
+    // shared != nullptr: node đã có trong shared thì đọc từ đó, leaf chưa có coi như không có giá trị
+    // (lane song song không được chạm vào cache indicator chung)
+    bool run(const ExprDag &dag, int id, DagMemo &memo, double &result, const DagMemo *shared = nullptr);
+};
 
-    any visitMin_macd_value(ExprParser::Min_macd_valueContext *ctx) override;
-    any visitMax_macd_value(ExprParser::Max_macd_valueContext *ctx) override;
-    any visitAvg_macd_value(ExprParser::Avg_macd_valueContext *ctx) override;
-    any visitMax_macd_signal(ExprParser::Max_macd_signalContext *ctx) override;
-    any visitMin_macd_signal(ExprParser::Min_macd_signalContext *ctx) override;
-    any visitAvg_macd_signal(ExprParser::Avg_macd_signalContext *ctx) override;
-    any visitMin_macd_histogram(ExprParser::Min_macd_histogramContext *ctx) override;
-    any visitMax_macd_histogram(ExprParser::Max_macd_histogramContext *ctx) override;
-    any visitAvg_macd_histogram(ExprParser::Avg_macd_histogramContext *ctx) override;
+any calculateExpr(const Program &program, const string &broker, const string &symbol, const string &timeframe, int length,
+                  const double *open, const double *high, const double *low, const double *close,
+                  const double *volume, long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax);
 
+any calculateExpr(const string &inputText, const string &broker, const string &symbol, const string &timeframe, int length,
+                  const double *open, const double *high, const double *low, const double *close,
+                  const double *volume, long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax);
 
-    any visitHour(ExprParser::HourContext *ctx) override;
-    any visitMinute(ExprParser::MinuteContext *ctx) override;
-    any visitFunding_rate(ExprParser::Funding_rateContext *ctx) override;
+// {x} => (x) để compile cả template 1 lần, trả về false nếu {} lồng nhau hoặc không cân
+bool inlineSubExpr(const string &expr, string &result);
 
-    // candlestick
-    any visitBullish_engulfing(ExprParser::Bullish_engulfingContext *ctx) override;
-    any visitBearish_engulfing(ExprParser::Bearish_engulfingContext *ctx) override;
-    any visitBullish_hammer(ExprParser::Bullish_hammerContext *ctx) override;
-    any visitBearish_hammer(ExprParser::Bearish_hammerContext *ctx) override;
-    any visitDoji(ExprParser::DojiContext *ctx) override;
-};
+// tách template {..} thành fragment + slot đã compile, nullptr nếu {} lồng nhau hoặc slot lỗi
+shared_ptr<const MessageTemplate> compileMessageTemplate(const string &text);
 
-any calculateExpr(const string &inputText, const string &broker, const string &symbol, const string &timeframe, int length,
-                  const double *open, const double *high, const double *low, const double *close,
-                  const double *volume, long long *startTime, double fundingRate, unordered_map<long long, vector<double>> *cachedIndicator, unordered_map<long long, unique_ptr<SparseTable>>* cachedMinMax);
+// render vào buffer (dùng lại giữa các lần gọi), số theo định dạng %f như calculateSubExpr
+bool renderMessageTemplate(const MessageTemplate &message, Expr &expr, fmt::memory_buffer &buffer);
 
 string calculateSubExpr(string &expr, const string &broker, const string &symbol, const string &timeframe, int length,
                         const double *open, const double *high, const double *low, const double *close,
-                        const double *volume, long long *startTime, double fundingRate, unordered_map<long long, vector<double>> *cachedIndicator, unordered_map<long long, unique_ptr<SparseTable>>* cachedMinMax);
-
-void cacheParseTree(const string &key);
+                        const double *volume, long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax);
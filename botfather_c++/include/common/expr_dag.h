@@ -0,0 +1,55 @@
+#pragma once
+#include "common_type.h"
+#include "expr_program.h"
+
+// Node trong DAG: leaf giữ lệnh lấy dữ liệu, node toán tử trỏ tới con
+struct DagNode
+{
+    Instruction ins;
+    int left = -1;
+    int right = -1;
+};
+
+// Gộp expr của tất cả bot thành 1 DAG lúc load config, các biểu thức con giống nhau dùng chung 1 node.
+// Node luôn được thêm sau các con nên thứ tự trong nodes là thứ tự topo.
+class ExprDag
+{
+private:
+    vector<DagNode> nodes;
+    vector<double> pool;
+    unordered_map<string, int> index; // khóa cấu trúc của node -> id
+
+    int intern(DagNode &node, const vector<double> &programPool);
+
+public:
+    // thêm program vào DAG, trả về id node gốc, -1 nếu program chỉ là string
+    int add(const Program &program);
+
+    const DagNode &node(int id) const { return nodes[id]; }
+    const double *poolData() const { return pool.data(); }
+    int size() const { return nodes.size(); }
+};
+
+// Kết quả các node trong 1 lần đóng nến, stamp != epoch nghĩa là chưa tính
+struct DagMemo
+{
+    vector<double> values;
+    vector<uint8_t> valid;
+    vector<uint32_t> stamp;
+    uint32_t epoch = 0;
+
+    void reset(int size)
+    {
+        if (values.size() < (size_t)size)
+        {
+            values.resize(size);
+            valid.resize(size);
+            stamp.resize(size, 0);
+        }
+        if (++epoch == 0)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            epoch = 1;
+        }
+    }
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include "expr_program.h"
+
+// Parser Pratt viết tay cho Expr.g4, sinh thẳng Program giống ExprCompiler mà không qua ANTLR.
+// Chỉ nhận input đúng grammar và đọc hết chuỗi; trả về false để caller fallback sang ANTLR
+// (input lỗi thì ANTLR có cơ chế recover riêng, để ANTLR xử lý cho kết quả giống cũ).
+bool prattCompile(const string &text, Program &program);
@@ -0,0 +1,120 @@
+#pragma once
+#include "common_type.h"
+
+// Profiler cho expr, bật bằng option EXPR_PROFILE của CMake (tắt thì các macro PROFILE_* rỗng).
+// Số lần gọi luôn được đếm, thời gian chỉ đo 1/SAMPLE_RATE lần gọi rồi ngoại suy ra tổng.
+// Số liệu gom vào thread_local, Worker::run flush sang bản chung 1 lần sau mỗi lần đóng nến.
+
+const int PROFILE_OP_COUNT = static_cast<int>(OpCode::DOJI) + 1;
+
+enum class ProfileCache : uint8_t
+{
+    INDICATOR,  // cachedIndicator
+    MIN_MAX,    // cachedMinMax
+    SERIES,     // SeriesMemo, kết quả từ các lần đóng nến trước
+    PREFIX_SUM, // prefix sum trong cachedIndicator
+};
+
+const int PROFILE_CACHE_COUNT = 4;
+
+struct ProfileStat
+{
+    uint64_t calls = 0;
+    uint64_t samples = 0;
+    uint64_t sampledNs = 0;
+
+    void merge(const ProfileStat &other);
+    double avgNs() const;
+    double estimatedNs() const; // avgNs * calls
+};
+
+struct BotProfile
+{
+    string name;
+    ProfileStat stat;
+};
+
+struct ProfileData
+{
+    ProfileStat ops[PROFILE_OP_COUNT];
+    unordered_map<int, BotProfile> bots; // key = bot id
+    uint64_t cacheHits[PROFILE_CACHE_COUNT] = {};
+    uint64_t cacheMisses[PROFILE_CACHE_COUNT] = {};
+    uint64_t rangeQueries[RANGE_STRATEGY_COUNT] = {}; // số truy vấn min/max đoạn theo chiến lược
+    uint64_t rangeBuilds[RANGE_STRATEGY_COUNT] = {};  // số lần dựng khối / SparseTable
+
+    void merge(const ProfileData &other);
+};
+
+class ExprProfiler
+{
+private:
+    mutex mMutex;
+    ProfileData total;
+    chrono::steady_clock::time_point lastReport = chrono::steady_clock::now();
+
+    ExprProfiler() {};
+
+public:
+    static const int SAMPLE_RATE = 64;         // lũy thừa của 2
+    static const int REPORT_INTERVAL_SEC = 300; // chu kỳ log + ghi file report
+    static const char *REPORT_FILE;
+
+    static ExprProfiler &getInstance()
+    {
+        static ExprProfiler instance;
+        return instance;
+    }
+
+    // dùng trong thread đang chạy expr
+    static bool sample();
+    static uint64_t now();
+    static void addOp(OpCode op, bool sampled, uint64_t ns);
+    static void addBot(const Bot &bot, bool sampled, uint64_t ns);
+    static void addCache(ProfileCache cache, bool hit);
+    static void addRange(RangeStrategy strategy, bool build);
+
+    void flush(); // gộp số liệu thread hiện tại vào bản chung, tới chu kỳ thì report
+    json report();
+    void logReport(int top = 10);
+};
+
+class OpProfileScope
+{
+private:
+    OpCode op;
+    bool sampled;
+    uint64_t start;
+
+public:
+    OpProfileScope(OpCode op) : op(op), sampled(ExprProfiler::sample()), start(sampled ? ExprProfiler::now() : 0) {}
+    ~OpProfileScope() { ExprProfiler::addOp(op, sampled, sampled ? ExprProfiler::now() - start : 0); }
+};
+
+class BotProfileScope
+{
+private:
+    const Bot &bot;
+    bool sampled;
+    uint64_t start;
+
+public:
+    BotProfileScope(const Bot &bot) : bot(bot), sampled(ExprProfiler::sample()), start(sampled ? ExprProfiler::now() : 0) {}
+    ~BotProfileScope() { ExprProfiler::addBot(bot, sampled, sampled ? ExprProfiler::now() - start : 0); }
+};
+
+#ifdef EXPR_PROFILE
+#define PROFILE_OP(op) OpProfileScope _profileOp(op)
+#define PROFILE_BOT(bot) BotProfileScope _profileBot(bot)
+#define PROFILE_CACHE(cache, hit) ExprProfiler::addCache(cache, hit)
+#define PROFILE_RANGE(strategy) ExprProfiler::addRange(strategy, false)
+#define PROFILE_RANGE_BUILD(strategy) ExprProfiler::addRange(strategy, true)
+#define PROFILE_FLUSH() ExprProfiler::getInstance().flush()
+#else
+#define PROFILE_OP(op)
+#define PROFILE_BOT(bot)
+#define PROFILE_CACHE(cache, hit)
+#define PROFILE_RANGE(strategy)
+#define PROFILE_RANGE_BUILD(strategy)
+#define PROFILE_FLUSH()
+#endif
@@ -0,0 +1,244 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+using namespace std;
+
+// Bytecode cho expr: cây parse được hạ thành 1 dãy lệnh postfix, tham số INT được bind sẵn lúc compile
+enum class OpCode : uint8_t
+{
+    // stack
+    CONST,
+    STRING,
+    NEG,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    ABS,
+    MIN,
+    MAX,
+
+    // candle
+    OPEN,
+    HIGH,
+    LOW,
+    CLOSE,
+    VOLUME,
+    CHANGE,
+    CHANGE_P,
+    AMPL,
+    AMPL_P,
+    UPPER_SHADOW,
+    UPPER_SHADOW_P,
+    LOWER_SHADOW,
+    LOWER_SHADOW_P,
+
+    // indicator
+    RSI,
+    RSI_SLOPE,
+    MA,
+    EMA,
+    MACD_VALUE,
+    MACD_SIGNAL,
+    MACD_HISTOGRAM,
+    BB_UPPER,
+    BB_MIDDLE,
+    BB_LOWER,
+    MACD_N_DINH,
+    MACD_SLOPE,
+
+    // avg min max
+    AVG_OPEN,
+    AVG_HIGH,
+    AVG_LOW,
+    AVG_CLOSE,
+    AVG_AMPL,
+    AVG_AMPL_P,
+    MIN_OPEN,
+    MIN_HIGH,
+    MIN_LOW,
+    MIN_CLOSE,
+    MIN_CHANGE,
+    MIN_CHANGE_P,
+    MIN_AMPL,
+    MIN_AMPL_P,
+    MAX_OPEN,
+    MAX_HIGH,
+    MAX_LOW,
+    MAX_CLOSE,
+    MAX_CHANGE,
+    MAX_CHANGE_P,
+    MAX_AMPL,
+    MAX_AMPL_P,
+    MIN_RSI,
+    MAX_RSI,
+    MARSI,
+    MIN_MACD_VALUE,
+    MAX_MACD_VALUE,
+    AVG_MACD_VALUE,
+    MIN_MACD_SIGNAL,
+    MAX_MACD_SIGNAL,
+    AVG_MACD_SIGNAL,
+    MIN_MACD_HISTOGRAM,
+    MAX_MACD_HISTOGRAM,
+    AVG_MACD_HISTOGRAM,
+
+    HOUR,
+    MINUTE,
+    FUNDING_RATE,
+
+    // candlestick
+    BULLISH_ENGULFING,
+    BEARISH_ENGULFING,
+    BULLISH_HAMMER,
+    BEARISH_HAMMER,
+    DOJI,
+};
+
+const int MAX_INSTRUCTION_ARGS = 7;
+const int MAX_PROGRAM_STACK = 64;
+const int MAX_N = 300; // số nến warm-up tối đa của RSI/EMA/MACD
+
+struct Instruction
+{
+    OpCode op;
+    int args[MAX_INSTRUCTION_ARGS] = {}; // period, shift, from, to... theo thứ tự trong grammar
+    double number = 0;                   // hằng số, stdDev của bb, diffCandle0 của macd_n_dinh
+    int poolOffset = 0;                  // diffPercents của macd_n_dinh nằm trong Program::pool
+    int poolSize = 0;
+};
+
+struct Program
+{
+    vector<Instruction> code;
+    vector<double> pool;
+    int maxStack = 0;
+    bool isString = false; // expr chỉ là 1 STRING, trả về text
+    bool isIntegral = false; // kết quả là hour()/minute(), code cũ trả về int nên in không có phần thập phân
+    string text;
+    int lookback = 0; // số nến gần nhất cần có để tính expr
+};
+
+// lệnh không lấy toán hạng từ stack
+inline bool isLeaf(OpCode op)
+{
+    return op == OpCode::CONST || op == OpCode::STRING || op >= OpCode::OPEN;
+}
+
+inline double applyBinary(OpCode op, double l, double r)
+{
+    switch (op)
+    {
+    case OpCode::ADD:
+        return l + r;
+    case OpCode::SUB:
+        return l - r;
+    case OpCode::MUL:
+        return l * r;
+    case OpCode::DIV:
+        return l / r;
+    case OpCode::LT:
+        return l < r ? 1.0 : 0.0;
+    case OpCode::LE:
+        return l <= r ? 1.0 : 0.0;
+    case OpCode::GT:
+        return l > r ? 1.0 : 0.0;
+    case OpCode::GE:
+        return l >= r ? 1.0 : 0.0;
+    case OpCode::EQ:
+        return l == r ? 1.0 : 0.0;
+    case OpCode::MIN:
+        return l < r ? l : r;
+    case OpCode::MAX:
+        return l > r ? l : r;
+    default:
+        return 0.0;
+    }
+}
+
+// số nến gần nhất (tính từ nến 0) mà lệnh đọc tới, gồm cả phần warm-up của indicator
+inline long long lookback(const Instruction &ins)
+{
+    const int *a = ins.args;
+    switch (ins.op)
+    {
+    case OpCode::OPEN:
+    case OpCode::HIGH:
+    case OpCode::LOW:
+    case OpCode::CLOSE:
+    case OpCode::VOLUME:
+    case OpCode::CHANGE:
+    case OpCode::CHANGE_P:
+    case OpCode::AMPL:
+    case OpCode::AMPL_P:
+    case OpCode::UPPER_SHADOW:
+    case OpCode::UPPER_SHADOW_P:
+    case OpCode::LOWER_SHADOW:
+    case OpCode::LOWER_SHADOW_P:
+    case OpCode::DOJI:
+        return a[0] + 1LL;
+    case OpCode::BULLISH_ENGULFING:
+    case OpCode::BEARISH_ENGULFING:
+        return a[0] + 2LL;
+    case OpCode::BULLISH_HAMMER:
+    case OpCode::BEARISH_HAMMER:
+        return a[0] + 10LL;
+    case OpCode::RSI:
+    case OpCode::RSI_SLOPE:
+    case OpCode::EMA:
+        return a[1] + (long long)MAX_N + a[0];
+    case OpCode::MA:
+    case OpCode::BB_UPPER:
+    case OpCode::BB_MIDDLE:
+    case OpCode::BB_LOWER:
+        return a[1] + (long long)a[0] + 1;
+    case OpCode::MACD_VALUE:
+    case OpCode::MACD_SIGNAL:
+    case OpCode::MACD_HISTOGRAM:
+    case OpCode::MACD_SLOPE:
+        return a[3] + (long long)MAX_N + max(a[0], a[1]);
+    case OpCode::MACD_N_DINH:
+        return a[6] + (long long)MAX_N + max(a[0], a[1]);
+    case OpCode::MIN_RSI:
+    case OpCode::MAX_RSI:
+        return a[2] + (long long)MAX_N + a[0];
+    case OpCode::MARSI:
+        return max(a[1] + (long long)MAX_N + a[0], a[2] + (long long)a[0] + 1);
+    case OpCode::MIN_MACD_VALUE:
+    case OpCode::MAX_MACD_VALUE:
+    case OpCode::AVG_MACD_VALUE:
+    case OpCode::MIN_MACD_SIGNAL:
+    case OpCode::MAX_MACD_SIGNAL:
+    case OpCode::AVG_MACD_SIGNAL:
+    case OpCode::MIN_MACD_HISTOGRAM:
+    case OpCode::MAX_MACD_HISTOGRAM:
+    case OpCode::AVG_MACD_HISTOGRAM:
+        return max(a[4] + 1LL + MAX_N + max(a[0], a[1]), a[4] + (long long)a[2] + 1);
+    case OpCode::HOUR:
+    case OpCode::MINUTE:
+        return 1;
+    default:
+        // avg/min/max theo khoảng [from, to]
+        if (ins.op >= OpCode::AVG_OPEN && ins.op <= OpCode::MAX_AMPL_P)
+            return a[1] + 1LL;
+        return 0;
+    }
+}
+
+inline int lookback(const Program &program)
+{
+    long long result = 0;
+    for (const Instruction &ins : program.code)
+    {
+        result = max(result, lookback(ins));
+    }
+    return min(result, (long long)INT_MAX);
+}
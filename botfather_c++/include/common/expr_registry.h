@@ -0,0 +1,43 @@
+#pragma once
+#include "common_type.h"
+#include "expr_program.h"
+#include <atomic>
+
+// Registry các expr đã compile, dùng chung giữa thread config (socket.io) và các worker TBB.
+// Worker đọc snapshot bất biến được publish bằng atomic (RCU), không lock.
+// Entry chỉ giữ weak_ptr, Program sống theo các bot đang dùng nó (NodeData::program).
+class ExprRegistry
+{
+private:
+    struct Entry
+    {
+        string text; // canonical text, dùng để kiểm tra trùng hash
+        weak_ptr<const Program> program;
+    };
+    typedef unordered_map<long long, vector<Entry>> Snapshot;
+
+    Snapshot master; // bản ghi của writer, chỉ truy cập khi giữ writeMutex
+    shared_ptr<const Snapshot> snapshot;
+    atomic<uint64_t> version{0};
+    mutex writeMutex;
+
+    ExprRegistry();
+    static shared_ptr<const Program> lookup(const Snapshot &snap, long long key, const string &text);
+
+public:
+    static ExprRegistry &getInstance();
+
+    // lowercase, gộp khoảng trắng ngoài chuỗi '...'
+    static string canonical(const string &text);
+
+    // lấy Program, compile nếu chưa có. Gọi từ thread config, cần commit() để worker thấy
+    shared_ptr<const Program> acquire(const string &text);
+
+    // bỏ các entry không còn bot nào dùng rồi publish snapshot mới
+    void commit();
+
+    // chỉ tra cứu trên snapshot, không lock, không compile. Gọi từ worker
+    shared_ptr<const Program> find(const string &text);
+
+    size_t size();
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "common_type.h"
+
+// Trạng thái RSI/EMA/MACD của 1 series, mỗi lần đóng nến chỉ tiến thêm các nến mới (O(1)/nến)
+// thay vì tính lại cả cửa sổ. Chỉ tính lại từ cửa sổ khi mới tạo, nến đứt quãng hoặc cửa sổ dài hơn history.
+// Giá trị của 1 nến được giữ nguyên từ lúc tính, nên seed là nến cũ nhất lúc tính lại lần cuối
+// chứ không phải nến MAX_N + period trước nến đó như iEMA/iRSI_slope/macd_slope.
+struct IndicatorStream
+{
+    long long lastTime = 0; // startTime của nến mới nhất đã tính
+    int width = 1;          // số giá trị mỗi nến: RSI/EMA 1, MACD 3 (macd, signal, histogram)
+    vector<double> history; // nến cũ trước
+    double state[3] = {};   // RSI: avgGain, avgLoss; EMA: ema; MACD: emaFast, emaSlow, signal
+
+    int size() const { return history.size() / width; }
+
+    // giá trị thứ k của nến shift (0 = nến mới nhất)
+    double at(int shift, int k = 0) const { return history[history.size() - (shift + 1) * width + k]; }
+
+    // copy n nến mới nhất vào out theo thứ tự của mảng nến (index 0 = nến mới nhất)
+    void copyTo(ArenaVector &out, int n) const;
+};
+
+// min/max đoạn của 1 cột nến, mỗi lần đóng nến chỉ slide nến mới vào thay vì dựng lại cả bảng
+struct MinMaxStream
+{
+    long long lastTime = 0;
+    SparseTable table;
+};
+
+class IndicatorStreams
+{
+private:
+    unordered_map<long long, IndicatorStream> streams; // key giống cachedIndicator
+    unordered_map<long long, MinMaxStream> minMaxStreams; // key giống cachedMinMax
+
+public:
+    static const int MAX_ADVANCE = 16; // bỏ lỡ nhiều nến hơn thì tính lại từ cửa sổ
+
+    // stream đã cập nhật tới nến 0 và có đủ giá trị cho cả cửa sổ n nến, nullptr nếu không tính được
+    const IndicatorStream *rsi(long long key, int period, const double *close, const long long *startTime, int n);
+    const IndicatorStream *ema(long long key, int period, const double *close, const long long *startTime, int n);
+    const IndicatorStream *macd(long long key, int fastPeriod, int slowPeriod, int signalPeriod, const double *close, const long long *startTime, int n);
+
+    // bảng min/max của cột a (index 0 = nến mới nhất) cho cửa sổ n nến, giá trị của nến đã đóng không được đổi
+    const SparseTable *minMax(long long key, const double *a, const long long *startTime, int n);
+
+    void clear()
+    {
+        streams.clear();
+        minMaxStreams.clear();
+    }
+    size_t size() const { return streams.size() + minMaxStreams.size(); }
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include "arena.h"
+using namespace std;
+
+// prefix sum + prefix sum bình phương của 1 series, tổng/trung bình/phương sai của đoạn bất kỳ trong O(1).
+// Dữ liệu nằm trong 1 ArenaVector để cache chung cachedIndicator:
+// [base, s[0..n], sq[0..n]], s[i] = tổng (a[j] - base) với j < i.
+// Trừ base (a[0]) để phương sai không mất số khi giá lớn mà dao động nhỏ.
+class PrefixSum
+{
+private:
+    const double *s;
+    const double *sq;
+    double base;
+    int n;
+
+public:
+    explicit PrefixSum(const ArenaVector &data);
+
+    static void build(ArenaVector &data, const double *a, int length);
+
+    // đoạn a[l..r], 0 <= l <= r < n
+    double sum(int l, int r) const;
+    double mean(int l, int r) const;
+    double variance(int l, int r) const; // phương sai tổng thể (chia cho số phần tử) như iBB
+    int size() const { return n; }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "sparse_table.h"
+using namespace std;
+
+enum class RangeStrategy : uint8_t
+{
+    SCAN,   // quét thẳng đoạn bằng kernel SIMD, không tốn gì để dựng
+    BLOCK,  // min/max từng khối BLOCK_SIZE phần tử, dựng O(n), truy vấn O(BLOCK_SIZE + n / BLOCK_SIZE)
+    SPARSE, // SparseTable, dựng O(n log n), truy vấn O(1)
+};
+
+const int RANGE_STRATEGY_COUNT = 3;
+
+// min/max đoạn trên 1 mảng (index 0 = nến mới nhất) trong 1 lần đóng nến.
+// Bắt đầu bằng quét thẳng, chỉ dựng khối / SparseTable khi tổng công quét đã vượt chi phí dựng,
+// nên series chỉ có vài truy vấn hẹp mỗi lần đóng nến không phải dựng bảng cho cả cửa sổ.
+class RangeQuery
+{
+private:
+    static const int BLOCK_SIZE = 16;
+
+    const double *a = nullptr;
+    int n = 0;
+    RangeStrategy strategy = RangeStrategy::SCAN;
+    long long cost = 0;           // tổng số phần tử đã đọc ở chiến lược hiện tại
+    // bộ nhớ lấy từ currentArena(), RangeQuery chỉ sống trong 1 lần đóng nến
+    ArenaVector values;           // bản sao khi mảng nguồn không sống hết lần đóng nến (cột MACD)
+    ArenaVector blockMin;
+    ArenaVector blockMax;
+    SparseTable ownTable;
+    const SparseTable *table = nullptr; // ownTable hoặc bảng slide của SeriesMemo
+
+    void buildBlocks();
+    void buildTable();
+    double query(int l, int r, bool isMin);
+
+public:
+    RangeQuery() : values(arenaVector()), blockMin(arenaVector()), blockMax(arenaVector()), ownTable(&currentArena()) {}
+
+    void init(const double *a, int length);                       // a phải sống hết lần đóng nến
+    void initStrided(const double *a, int stride, int length);    // copy a[i * stride]
+    void initTable(const SparseTable *table);                     // dùng bảng có sẵn
+
+    double query_min(int l, int r) { return query(l, r, true); }
+    double query_max(int l, int r) { return query(l, r, false); }
+    RangeStrategy getStrategy() const { return strategy; }
+    int size() const { return n; }
+};
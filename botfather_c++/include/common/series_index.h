@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+using namespace std;
+
+struct Bot;
+
+// series (broker:symbol_timeframe) -> các bot theo dõi series đó, để Worker::run chỉ duyệt đúng các bot cần
+// thay vì so symbolList/timeframes của mọi bot. Id của series cấp 1 lần và giữ nguyên qua các lần cập nhật.
+class SeriesIndex
+{
+private:
+    unordered_map<string, int> ids;
+    vector<vector<int>> subscribers; // id -> vị trí bot trong BotList::bots, tăng dần
+
+    void add(const Bot &bot, int position);
+
+public:
+    static string key(const string &broker, const string &symbol, const string &timeframe)
+    {
+        return broker + ":" + symbol + "_" + timeframe;
+    }
+
+    int intern(const string &series);
+    int find(const string &series) const; // -1 nếu chưa có bot nào từng theo dõi
+    const vector<int> &bots(int id) const { return subscribers[id]; }
+    size_t size() const { return ids.size(); }
+
+    void build(const vector<shared_ptr<Bot>> &bots); // id series đã có được giữ nguyên
+};
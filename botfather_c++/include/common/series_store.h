@@ -0,0 +1,71 @@
+#pragma once
+#include "common_type.h"
+#include "indicator_stream.h"
+
+// key của 1 leaf đã chuẩn hóa shift: hash của lệnh (bỏ shift) + startTime của nến mà shift trỏ tới.
+// close(1) ở nến t và close(0) ở nến t-1 có cùng key
+struct SeriesKey
+{
+    uint64_t hash;
+    long long time;
+
+    bool operator==(const SeriesKey &other) const
+    {
+        return hash == other.hash && time == other.time;
+    }
+};
+
+struct SeriesKeyHash
+{
+    size_t operator()(const SeriesKey &key) const
+    {
+        return key.hash ^ (static_cast<uint64_t>(key.time) * 0x9E3779B97F4A7C15ULL);
+    }
+};
+
+struct SeriesValue
+{
+    double value;
+    bool valid;
+    vector<double> instruction; // op, args (shift = 0), number, pool của leaf, so khi tra cứu vì key chỉ là hash
+};
+
+// kết quả leaf của 1 series (broker:symbol_timeframe), giữ qua các lần đóng nến.
+// chỉ giữ các nến có shift <= MAX_SHIFT, nến bị đứt quãng thì xóa hết (cả indicators)
+class SeriesMemo
+{
+private:
+    unordered_map<SeriesKey, SeriesValue, SeriesKeyHash> values;
+    long long lastTime = 0; // startTime[0] của lần đóng nến trước
+
+public:
+    static const int MAX_SHIFT = 8;
+
+    mutex mMutex; // Worker giữ trong suốt Worker::run
+    IndicatorStreams indicators;
+    uint64_t hits = 0;   // Expr đếm sau khi so lệnh
+    uint64_t misses = 0;
+
+    void begin(const long long *startTime, int length);
+    const SeriesValue *find(const SeriesKey &key); // nullptr nếu chưa có
+    void store(const SeriesKey &key, SeriesValue value);
+    size_t size() const { return values.size(); }
+};
+
+class SeriesStore
+{
+private:
+    mutex mMutex;
+    unordered_map<string, shared_ptr<SeriesMemo>> memos;
+
+    SeriesStore() {};
+
+public:
+    static SeriesStore &getInstance()
+    {
+        static SeriesStore instance;
+        return instance;
+    }
+
+    shared_ptr<SeriesMemo> get(const string &series);
+};
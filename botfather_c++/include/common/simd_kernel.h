@@ -0,0 +1,17 @@
+#pragma once
+
+// Kernel tổng/min/max trên mảng double cho iMA, iAvg, iMin, iMax, iBB.
+// Bản AVX-512/AVX2/SSE2 chọn 1 lần lúc khởi động theo CPU (__builtin_cpu_supports), máy không phải x86 dùng bản scalar.
+// min/max cho kết quả giống hệt scalar; tổng cộng theo nhiều làn nên thứ tự cộng khác,
+// lệch tương đối so với scalar tối đa ~ n * 2^-52 (n <= MAX_CANDLE => < 1e-12).
+struct SimdKernels
+{
+    const char *name;
+    double (*sum)(const double *a, int n);
+    double (*min)(const double *a, int n);             // n >= 1
+    double (*max)(const double *a, int n);             // n >= 1
+    double (*sumSqDiff)(const double *a, int n, double mean); // tổng (a[i] - mean)^2
+};
+
+const SimdKernels &simdKernels();     // bản tốt nhất CPU hỗ trợ
+const SimdKernels &scalarKernels();   // bản tham chiếu
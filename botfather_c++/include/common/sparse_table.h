@@ -1,20 +1,32 @@
 #pragma once
 
 #include <vector>
+#include "arena.h"
 using namespace std;
 
+// min/max đoạn O(1) trên mảng nến (index 0 = nến mới nhất).
+// Lưu theo từng tầng liền nhau: tầng j ở [j * capacity, (j + 1) * capacity), trong tầng phần tử cũ trước,
+// nên nến mới chỉ cần ghi thêm 1 ô mỗi tầng (push O(log n)) và bỏ nến cũ nhất chỉ là tăng head (pop O(1)).
 class SparseTable
 {
 private:
-    vector<vector<double>> st_min;
-    vector<vector<double>> st_max;
-    vector<int> log2s;
-    int n;
+    ArenaVector st_min; // mặc định cấp phát trên heap, bảng tạm của 1 lần đóng nến lấy từ arena
+    ArenaVector st_max;
+    int n = 0;        // số phần tử
+    int head = 0;     // vị trí của phần tử cũ nhất trong mỗi tầng
+    int capacity = 0; // số ô mỗi tầng
+    int levels = 0;
+
+    void relayout(int newCapacity);
 
 public:
-    SparseTable() = default;  // Cho phép tạo qua pool
+    SparseTable() = default;
+    explicit SparseTable(Arena *arena) : st_min(ArenaAllocator<double>(arena)), st_max(ArenaAllocator<double>(arena)) {}
     void init(const double* a, int length);  // Dùng thay constructor
+    void push(double value);  // thêm nến mới vào index 0, các nến cũ dịch lên 1
+    void pop();               // bỏ nến cũ nhất (index size() - 1)
+    void slide(double value); // push + pop, giữ nguyên số nến
     double query_min(int l, int r) const;
     double query_max(int l, int r) const;
-    int size();
-};
\ No newline at end of file
+    int size() const;
+};
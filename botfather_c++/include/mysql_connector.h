@@ -20,6 +20,9 @@ public:
 
     unique_ptr<sql::ResultSet> executeQuery(const string &query, const vector<any> &params);
     int executeUpdate(const string &query, const vector<any> &params);
+    // INSERT nhiều dòng, mỗi câu tối đa ~65535 placeholder, tất cả trong 1 transaction (lỗi thì rollback cả lô).
+    // Trả về số dòng đã ghi, -1 nếu lỗi
+    int executeBatchInsert(const string &table, const vector<string> &columns, const vector<vector<any>> &rows);
     void bindParams(sql::PreparedStatement *stmt, const vector<any> &params);
 
 private:
@@ -27,6 +30,7 @@ private:
     ~MySQLConnector();
 
     void initializePool(int size);
+    void ensureValid(std::shared_ptr<sql::Connection> &conn);
 
     sql::Driver *driver;
     string host, username, password, database;
@@ -0,0 +1,92 @@
+#pragma once
+#include "common_type.h"
+
+// tham số lệnh dạng số, chưa làm tròn
+struct OrderParams
+{
+    double stop = 0;
+    double entry = 0;
+    double sl = 0;
+    double tp = 0;
+    double volume = 0;
+    long long expiredTime = 0;
+    bool hasStop = false;
+    bool hasExpiredTime = false;
+};
+
+// lệnh worker đã tính xong, chờ gửi sàn và ghi DB
+struct PendingOrder
+{
+    shared_ptr<Bot> bot;
+    string broker;
+    string symbol;
+    string timeframe;
+    NodeData node; // type, kind và các trường dạng string đã làm tròn theo digit
+    OrderParams params;
+    Digit digit;
+    long long createdTime;
+    double open, high, low, close; // nến lúc đặt lệnh, để log
+    chrono::steady_clock::time_point submittedAt;
+};
+
+struct OrderSinkStats
+{
+    uint64_t submitted;
+    uint64_t written;
+    uint64_t failed;
+    uint64_t batches;
+    size_t queueDepth;     // lệnh chờ ghi DB
+    size_t maxQueueDepth;
+    size_t realQueueDepth; // lệnh thật chờ gửi sàn
+    size_t maxRealQueueDepth;
+    double avgFlushMs;     // thời gian ghi 1 lô
+    double maxFlushMs;
+    double maxLatencyMs;   // từ lúc submit tới lúc lô chứa lệnh được commit
+};
+
+// Thay cho mỗi lệnh 1 closure trên ThreadPool: lệnh được gom thành lô, mỗi lô ghi bằng INSERT nhiều dòng
+// trong 1 transaction trên thread riêng. Lệnh thật lên sàn đi lane riêng, không phải chờ lô DB.
+class OrderSink
+{
+private:
+    mutex mtx;
+    condition_variable flushCond;
+    condition_variable realCond;
+    deque<PendingOrder> pending;    // chờ ghi DB
+    deque<PendingOrder> realOrders; // chờ gửi sàn
+    bool stopping = false;
+    thread flushThread;
+    vector<thread> realThreads;
+
+    // metrics
+    size_t maxQueueDepth = 0;     // giữ mtx
+    size_t maxRealQueueDepth = 0; // giữ mtx
+    atomic<uint64_t> submitted{0};
+    atomic<uint64_t> written{0};
+    atomic<uint64_t> failed{0};
+    atomic<uint64_t> batches{0};
+    atomic<uint64_t> flushNs{0};
+    atomic<uint64_t> maxFlushNs{0};
+    atomic<uint64_t> maxLatencyNs{0};
+    chrono::steady_clock::time_point lastReport;
+
+    static const int MAX_BATCH = 200;         // số lệnh tối đa mỗi lô
+    static const int FLUSH_INTERVAL_MS = 50;  // đợi tối đa 50ms để gom lô
+    static const int REAL_ORDER_THREADS = 4;  // số lệnh thật gửi sàn song song
+    static const int REPORT_INTERVAL_S = 60;  // log metrics sau mỗi 60s có ghi lô
+
+    OrderSink();
+    ~OrderSink();
+    void flushLoop();
+    void realOrderLoop();
+    void writeBatch(const vector<PendingOrder> &batch);
+    void sendRealOrder(const PendingOrder &order);
+    void report();
+
+public:
+    static OrderSink &getInstance();
+
+    // làm tròn theo digit rồi xếp hàng, không chặn worker
+    void submit(PendingOrder order);
+    OrderSinkStats getStats();
+};
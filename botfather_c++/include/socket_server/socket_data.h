@@ -11,7 +11,7 @@ protected:
     WebSocket ws;
     const int BATCH_SIZE;
     std::mutex mMutex;
-    shared_ptr<vector<shared_ptr<Bot>>> botList;
+    shared_ptr<const BotList> botList; // đọc/ghi bằng atomic_load/atomic_store
     shared_ptr<boost::asio::ssl::context> on_tls_init(connection_hdl);
     unordered_map<string, Digit> digits;
     unordered_map<string, double> fundingRates;
@@ -36,7 +36,7 @@ protected:
 
 public:
     SocketData(const int _BATCH_SIZE);
-    void setBotList(shared_ptr<vector<shared_ptr<Bot>>> botList);
+    void setBotList(shared_ptr<const BotList> botList);
     void init();
 
     virtual void connectSocket() = 0;
@@ -1,5 +1,21 @@
 #pragma one
 #include "common_type.h"
+#include "expr_dag.h"
+#include "expr.h"
+#include "series_store.h"
+#include "order_sink.h"
+
+// trạng thái duyệt route của 1 luồng. Thread series dùng Worker::seriesLane với dagMemo chung,
+// lane song song có dagMemo riêng và chỉ đọc dagMemo chung (shared) đã warm-up
+struct WorkerLane
+{
+    DagMemo dagMemo;
+    const DagMemo *shared = nullptr;
+    vector<uint64_t> visited; // bitset theo RouteStep::visitId của bot đang chạy
+    vector<int> pending;      // stack index step khi duyệt RouteProgram
+
+    bool visit(int id); // false nếu node đã chạy trong lần duyệt route này
+};
 
 class Worker
 {
@@ -13,22 +29,39 @@ private:
     vector<double> close;
     vector<double> volume;
     vector<long long> startTime;
-    shared_ptr<vector<shared_ptr<Bot>>> botList;
-    unordered_map<long long, bool> visited;
+    shared_ptr<const BotList> botList;
+    int seriesId = -1; // id của series trong botList->seriesIndex, -1 nếu không bot nào theo dõi
     unordered_map<long long, any> cachedExpr;
     Digit digit;
     double fundingRate;
-    unordered_map<long long, vector<double>> cachedIndicator;
-    unordered_map<long long, unique_ptr<SparseTable>> cachedMinMax;
+    unordered_map<long long, ArenaVector> cachedIndicator;
+    unordered_map<long long, RangeQuery *> cachedMinMax;
+    fmt::memory_buffer messageBuffer; // buffer render telegram, dùng lại giữa các lần gọi
+    WorkerLane seriesLane;         // dagMemo: kết quả các node DAG dùng chung giữa các bot trong lần đóng nến này
+    mutex actionMutex;             // lane song song chạy phần ghi cache chung lần lượt
+    Arena *seriesArena = nullptr;  // exprArena của thread đang chạy run
+    shared_ptr<SeriesMemo> seriesMemo; // kết quả leaf của series qua các lần đóng nến
+
+    static const int CHAIN_SAMPLE_RATE = 8;       // đo cost 1/8 lần chạy chuỗi
+    static const int CHAIN_REORDER_INTERVAL = 64; // sắp lại thứ tự sau mỗi 64 lần chạy
+    static const int PARALLEL_MIN_BOTS = 64;      // series có từ 64 bot thì chia bot cho nhiều thread
+    static const int PARALLEL_GRAIN = 8;          // số bot tối thiểu mỗi chunk
 
     string calculateSub(string &expr);
     any calculate(string &expr);
-    bool adjustParam(NodeData &data);
+    bool calculateParam(const string &text, const shared_ptr<const Program> &program, double &result);
+    bool adjustParam(const NodeData &node, OrderParams &params);
+    bool handleChain(ExprChain &chain, const shared_ptr<Bot> &bot, WorkerLane &lane);
+    bool handleAction(NodeData &node, const shared_ptr<Bot> &bot);
+    void runBots(const vector<int> &subscribed, size_t begin, size_t end, WorkerLane &lane);
+    void warmUp(const vector<int> &subscribed);
+    void runParallel(const vector<int> &subscribed);
+    Expr createExpr();
 
 public:
     Worker() {};
-    void init(shared_ptr<vector<shared_ptr<Bot>>> botList, string broker, string symbol, string timeframe, vector<double> open, vector<double> high, vector<double> low, vector<double> close, vector<double> volume, vector<long long> startTime, Digit digit, double fundingRate);
+    void init(shared_ptr<const BotList> botList, string broker, string symbol, string timeframe, vector<double> open, vector<double> high, vector<double> low, vector<double> close, vector<double> volume, vector<long long> startTime, Digit digit, double fundingRate);
     void run();
-    void dfs_handleLogic(Route &route, const shared_ptr<Bot> &bot);
-    bool handleLogic(NodeData &node, const shared_ptr<Bot> &bot);
+    void runRoute(const RouteProgram &program, const shared_ptr<Bot> &bot, WorkerLane &lane);
+    bool handleLogic(NodeData &node, const shared_ptr<Bot> &bot, WorkerLane &lane);
 };
\ No newline at end of file
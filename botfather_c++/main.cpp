@@ -4,6 +4,7 @@
 #include "mysql_connector.h"
 #include "telegram.h"
 #include "order_monitor.h"
+#include "simd_kernel.h"
 #include <csignal>
 #include <execinfo.h> // backtrace
 #include <unistd.h>   // write
@@ -73,6 +74,7 @@ void init()
     spdlog::flush_every(chrono::seconds(3));
 
     LOGI("Hello BotFather!");
+    LOGI("SIMD kernels: {}", simdKernels().name);
 
     MySQLConnector::getInstance();
     Telegram::getInstance();
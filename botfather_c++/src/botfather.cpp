@@ -10,21 +10,563 @@
 #include "socket_bybit_future.h"
 #include "socket_okx.h"
 #include "expr.h"
+#include "expr_registry.h"
+#include "expr_dag.h"
 
 sio::client client;
 vector<SocketData *> exchanges;
 vector<thread> threads;
-shared_ptr<vector<shared_ptr<Bot>>> botList;
+shared_ptr<BotList> botList;
+mutex botListMutex; // setBotList chạy từ main lúc khởi động và từ thread socket.io khi config đổi
 
 // #define TEST
 
 #ifdef TEST
 #include "telegram.h"
 #include "binance_future.h"
+#include "expr_compiler.h"
+#include "expr_pratt.h"
+#include "series_store.h"
+#include "simd_kernel.h"
+#include "custom_indicator.h"
+#include "worker.h"
 #include <tbb/task_group.h>
 
 static tbb::task_group task;
 
+static bool sameProgram(const Program &a, const Program &b)
+{
+    if (a.code.size() != b.code.size() || a.pool != b.pool || a.isString != b.isString || a.text != b.text)
+        return false;
+    for (size_t i = 0; i < a.code.size(); i++)
+    {
+        const Instruction &x = a.code[i];
+        const Instruction &y = b.code[i];
+        if (x.op != y.op || x.number != y.number || x.poolOffset != y.poolOffset || x.poolSize != y.poolSize)
+            return false;
+        for (int k = 0; k < MAX_INSTRUCTION_ARGS; k++)
+        {
+            if (x.args[k] != y.args[k])
+                return false;
+        }
+    }
+    return true;
+}
+
+static void collectExprs(const Route &route, vector<string> &exprs)
+{
+    const NodeData &data = route.data;
+    for (const string *text : {&data.value, &data.stop, &data.entry, &data.sl, &data.tp, &data.volume, &data.expiredTime})
+    {
+        string expr;
+        if (!text->empty() && inlineSubExpr(*text, expr))
+            exprs.push_back(ExprRegistry::canonical(expr));
+    }
+    for (const Route &next : route.next)
+        collectExprs(next, exprs);
+}
+
+// so sánh parser Pratt với ANTLR trên các expr có sẵn + expr của bot trong DB
+static void testPrattParser()
+{
+    vector<string> exprs = {
+        "close(0) >= (open(1) + close(1))/2",
+        "-close() + open(1) * 2 > 3",
+        "--1 + +2 - -3.5 / 1.",
+        "max_rsi(14, 70, 48) >= 80",
+        "macd_n_dinh(12, 26, 9, 6, 8, 0, 2, 0, 5) >= 3",
+        "macd_n_dinh(12, 26, 9, 6, 8, 0, 2.5, 1, 5, -1.5, 3)",
+        "ampl(1) >= avg_ampl(25, 0) * 1.8",
+        "close(1) > max_high(100, 2)",
+        "min(close(), open(1), abs(change%(2))) = max(low(), high(3))",
+        "bb_upper(20, 2) - bb_lower(20, 2.5, 1) <= ema(50, 1)",
+        "avg_macd_histogram(12, 26, 9, 10, 2) < min_macd_value(12, 26, 9, 0)",
+        "marsi(14, 5) > 50 == 1",
+        "hour() * 60 + minute() - funding_rate()",
+        "doji() + bullish_engulfing(1) + bearish_hammer()",
+        "'text'",
+        "upper_shadow%(1) > lower_shadow%()",
+    };
+    for (const shared_ptr<Bot> &bot : getBotList(""))
+    {
+        collectExprs(bot->route, exprs);
+    }
+
+    int mismatch = 0, rejected = 0;
+    for (const string &expr : exprs)
+    {
+        Program pratt;
+        shared_ptr<Program> antlr = compileExprAntlr(expr);
+        if (!prattCompile(expr, pratt))
+        {
+            rejected++;
+            LOGD("Pratt rejected: {}", expr);
+            continue;
+        }
+        if (!antlr || !sameProgram(pratt, *antlr))
+        {
+            mismatch++;
+            LOGE("Pratt mismatch: {}", expr);
+        }
+    }
+    LOGI("Pratt parser: {} exprs, {} mismatch, {} rejected (fallback ANTLR)", exprs.size(), mismatch, rejected);
+
+    const int N = 10000;
+    {
+        Timer timer(StringFormat("compileExprAntlr x{}", N * exprs.size()));
+        for (int i = 0; i < N; i++)
+            for (const string &expr : exprs)
+                compileExprAntlr(expr);
+    }
+    {
+        Timer timer(StringFormat("prattCompile x{}", N * exprs.size()));
+        for (int i = 0; i < N; i++)
+            for (const string &expr : exprs)
+            {
+                Program program;
+                prattCompile(expr, program);
+            }
+    }
+}
+
+// trượt cửa sổ qua từng nến, so kết quả dùng SeriesMemo với tính lại từ đầu
+static void testSeriesMemo(vector<double> &open, vector<double> &high, vector<double> &low, vector<double> &close, vector<double> &volume, vector<long long> &startTime)
+{
+    vector<string> exprs = {
+        "ema(20, 1) + ma(10, 2) - bb_upper(20, 2, 3)",
+        "rsi_slope(14, 2) + macd_slope(12, 26, 9, 1)",
+        "macd_n_dinh(12, 26, 9, 6, 8, 0, 2, 1, 5)",
+        "marsi(14, 1, 5) + avg_close(2, 10) + max_high(1, 20) - min_change%(3, 7)",
+        "avg_macd_histogram(12, 26, 9, 1, 4) + bullish_hammer(2)",
+        // cặp shift 0/1 của điều kiện giao cắt => lần đóng nến sau dùng lại kết quả shift 0
+        "ma(20, 0) > ema(10, 0) + avg_high(0, 5)",
+        "ma(20, 1) > ema(10, 1) + avg_high(1, 6)",
+        "rsi(14, 0) + rsi(14, 3) + ema(50, 0)",
+        "macd_value(12, 26, 9, 0) + macd_signal(12, 26, 9, 2) + macd_histogram(12, 26, 9, 1)",
+    };
+    vector<shared_ptr<Program>> programs;
+    for (const string &expr : exprs)
+        programs.push_back(compileExpr(expr));
+
+    const int LENGTH = 400;
+    SeriesMemo memo;
+    int mismatch = 0;
+    for (int offset = open.size() - LENGTH; offset >= 0; offset--)
+    {
+        memo.begin(startTime.data() + offset, LENGTH);
+        unordered_map<long long, ArenaVector> cached, cachedMemo;
+        unordered_map<long long, RangeQuery *> cachedMinMax, cachedMinMaxMemo;
+        Expr fresh("binance", "BTCUSDT", "1h", LENGTH, open.data() + offset, high.data() + offset, low.data() + offset, close.data() + offset, volume.data() + offset, startTime.data() + offset, 0.0, &cached, &cachedMinMax);
+        Expr withMemo("binance", "BTCUSDT", "1h", LENGTH, open.data() + offset, high.data() + offset, low.data() + offset, close.data() + offset, volume.data() + offset, startTime.data() + offset, 0.0, &cachedMemo, &cachedMinMaxMemo);
+        withMemo.setSeriesMemo(&memo);
+
+        for (size_t i = 0; i < programs.size(); i++)
+        {
+            double a = 0, b = 0;
+            bool validA = fresh.run(*programs[i], a);
+            bool validB = withMemo.run(*programs[i], b);
+            // RSI/EMA/MACD của withMemo tiến dần theo stream, seed khác cửa sổ nên chỉ lệch rất nhỏ
+            if (validA != validB || (validA && abs(a - b) > 1e-6 * max(1.0, abs(a))))
+            {
+                mismatch++;
+                LOGE("Series memo mismatch: {} offset={} {} vs {}", exprs[i], offset, a, b);
+            }
+        }
+        exprArena.reset(); // như cuối Worker::run, cached* chỉ còn được hủy chứ không đọc lại
+    }
+    LOGI("Series memo: {} mismatch, {} hits, {} misses", mismatch, memo.hits, memo.misses);
+}
+
+static void testSimdKernels(const vector<double> &close)
+{
+    const SimdKernels &simd = simdKernels();
+    const SimdKernels &scalar = scalarKernels();
+
+    // min/max phải khớp tuyệt đối, tổng lệch tương đối < 1e-12
+    double maxRelative = 0.0;
+    int mismatch = 0;
+    for (int n = 1; n <= (int)close.size(); n++)
+    {
+        double mean = scalar.sum(close.data(), n) / n;
+        maxRelative = max(maxRelative, abs(simd.sum(close.data(), n) - scalar.sum(close.data(), n)) / abs(scalar.sum(close.data(), n)));
+        maxRelative = max(maxRelative, abs(simd.sumSqDiff(close.data(), n, mean) - scalar.sumSqDiff(close.data(), n, mean)) / max(1e-300, scalar.sumSqDiff(close.data(), n, mean)));
+        if (simd.min(close.data(), n) != scalar.min(close.data(), n) || simd.max(close.data(), n) != scalar.max(close.data(), n))
+            mismatch++;
+    }
+    LOGI("SIMD kernels {}: {} min/max mismatch, max relative error {}", simd.name, mismatch, maxRelative);
+
+    const int N = 1000000;
+    for (const SimdKernels *kernels : {&scalar, &simd})
+    {
+        for (int period : {20, 100, (int)close.size()})
+        {
+            double sink = 0.0;
+            {
+                Timer timer(StringFormat("{} sum+max+sumSqDiff period={} x{}", kernels->name, period, N));
+                for (int i = 0; i < N; i++)
+                    sink += kernels->sum(close.data(), period) + kernels->max(close.data(), period) + kernels->sumSqDiff(close.data(), period, close[0]);
+            }
+            LOGD("sink {}", sink);
+        }
+    }
+}
+
+// SeriesIndex phải cho đúng các bot mà bộ lọc symbolList/timeframes cũ chọn, build lại trên index cũ phải giữ id series
+static void testSeriesIndex()
+{
+    vector<string> symbols = {"binance_future:BTCUSDT", "binance_future:ETHUSDT", "bybit:BTCUSDT", "okx:SOLUSDT"};
+    vector<string> timeframes = {"1m", "5m", "1h", "4h"};
+    vector<shared_ptr<Bot>> bots;
+    for (int i = 0; i < 200; i++)
+    {
+        shared_ptr<Bot> bot = make_shared<Bot>();
+        bot->botName = "bot" + to_string(i % 50);
+        for (size_t k = 0; k < symbols.size(); k++)
+        {
+            if ((i >> k) & 1)
+            {
+                vector<string> parts = split(symbols[k], ':');
+                bot->symbolList.push_back({parts[0], parts[1], symbols[k]});
+            }
+        }
+        for (size_t k = 0; k < timeframes.size(); k++)
+        {
+            if ((i * 7 >> k) & 1)
+                bot->timeframes.push_back(timeframes[k]);
+        }
+        bots.push_back(bot);
+    }
+
+    SeriesIndex full;
+    full.build(bots);
+
+    // reload như setBotList: bot3 bị đổi nên đứng cuối danh sách mới, index mới copy từ index cũ rồi build lại
+    vector<shared_ptr<Bot>> kept, removed;
+    for (const shared_ptr<Bot> &bot : bots)
+    {
+        if (bot->botName == "bot3")
+            removed.push_back(bot);
+        else
+            kept.push_back(bot);
+    }
+    kept.insert(kept.end(), removed.begin(), removed.end());
+    SeriesIndex reloaded = full;
+    reloaded.build(kept);
+
+    int mismatch = 0;
+    for (const string &symbol : symbols)
+    {
+        for (const string &timeframe : timeframes)
+        {
+            vector<int> expected;
+            for (size_t i = 0; i < kept.size(); i++)
+            {
+                const Bot &bot = *kept[i];
+                bool hasSymbol = any_of(bot.symbolList.begin(), bot.symbolList.end(), [&](const Symbol &s)
+                                        { return s.symbolName == symbol; });
+                if (hasSymbol && find(bot.timeframes.begin(), bot.timeframes.end(), timeframe) != bot.timeframes.end())
+                    expected.push_back(i);
+            }
+            string series = symbol + "_" + timeframe;
+            int id = reloaded.find(series);
+            vector<int> actual = id < 0 ? vector<int>() : reloaded.bots(id);
+            // id series giữ nguyên qua lần reload
+            if (actual != expected || id != full.find(series))
+                mismatch++;
+        }
+    }
+    LOGI("SeriesIndex: {} series, {} mismatch", reloaded.size(), mismatch);
+}
+
+static void buildExprChains(Route &route);
+static void compileRoute(Bot &bot, const ExprDag &dag);
+
+static Route routeNode(const string &id, const string &type, vector<Route> next = {})
+{
+    Route route;
+    route.id = id;
+    route.data.id = id;
+    route.data.type = type;
+    route.data.kind = nodeKind(type);
+    route.next = move(next);
+    return route;
+}
+
+// DFS như bản đệ quy cũ: visited theo id, node fail thì không đi tiếp
+static void baselineRoute(const Route &route, const unordered_set<string> &failed, unordered_set<string> &visited, vector<string> &fired)
+{
+    if (!visited.insert(route.id == "start" ? "" : route.id).second || failed.count(route.id))
+        return;
+    if (route.data.kind == NodeKind::TELEGRAM)
+        fired.push_back(route.id);
+    for (const Route &next : route.next)
+        baselineRoute(next, failed, visited, fired);
+}
+
+// duyệt RouteProgram như Worker::runRoute, chuỗi expr chạy theo thứ tự ngược (thứ tự sắp lại xấu nhất)
+static void programRoute(const RouteProgram &program, const unordered_set<string> &failed, vector<string> &fired)
+{
+    WorkerLane lane;
+    lane.visited.assign((program.visitCount + 63) / 64, 0);
+    vector<int> pending = {0};
+    while (!pending.empty())
+    {
+        const RouteStep &step = program.steps[pending.back()];
+        pending.pop_back();
+
+        bool pass = true;
+        if (step.chain)
+        {
+            for (int i = step.chain->nodes.size() - 1; i >= 0 && pass; i--)
+                pass = lane.visit(step.chain->ids[i]) && !failed.count(step.chain->nodes[i]->id);
+        }
+        else
+            pass = lane.visit(step.visitId) && !failed.count(step.data->id);
+        if (!pass)
+            continue;
+
+        if (step.kind == NodeKind::TELEGRAM)
+            fired.push_back(step.data->id);
+        for (int i = step.childCount - 1; i >= 0; i--)
+            pending.push_back(program.children[step.firstChild + i]);
+    }
+}
+
+// route hội tụ: start -> A -> A2 -> B -> C -> T và start -> D -> B -> C -> T (B, C, T dùng chung id).
+// A fail thì T vẫn phải chạy qua nhánh D như DFS cũ, dù chuỗi của nhánh A bị sắp lại thứ tự
+static void testConvergingRoute()
+{
+    auto shared = [] { return routeNode("3", "expr", {routeNode("4", "expr", {routeNode("5", "telegram")})}); };
+    Bot bot;
+    bot.route = routeNode("start", "start", {routeNode("1", "expr", {routeNode("2", "expr", {shared()})}), routeNode("6", "expr", {shared()})});
+    buildExprChains(bot.route);
+    compileRoute(bot, ExprDag());
+
+    int mismatch = 0;
+    for (const unordered_set<string> &failed : vector<unordered_set<string>>{{}, {"1"}, {"2"}, {"1", "6"}, {"4"}})
+    {
+        unordered_set<string> visited;
+        vector<string> expected, actual;
+        baselineRoute(bot.route, failed, visited, expected);
+        programRoute(bot.program, failed, actual);
+        if (expected != actual)
+            mismatch++;
+    }
+    LOGI("Converging route: {} chain at root branch, {} mismatch", bot.route.next[0].chain ? "has" : "no", mismatch);
+}
+
+// bảng cũ vector<vector<double>> [n][log], dựng lại log2s mỗi lần init, chỉ để so tốc độ
+struct NestedSparseTable
+{
+    vector<vector<double>> st_min, st_max;
+    vector<int> log2s;
+
+    void init(const double *a, int n)
+    {
+        int max_log = log2(n) + 1;
+        log2s.resize(n + 1);
+        log2s[1] = 0;
+        for (int i = 2; i <= n; ++i)
+            log2s[i] = log2s[i / 2] + 1;
+        st_min.resize(n);
+        st_max.resize(n);
+        for (int i = 0; i < n; ++i)
+        {
+            st_min[i].resize(max_log);
+            st_max[i].resize(max_log);
+            st_min[i][0] = st_max[i][0] = a[i];
+        }
+        for (int j = 1; (1 << j) <= n; ++j)
+        {
+            for (int i = 0; i + (1 << j) <= n; ++i)
+            {
+                st_min[i][j] = min(st_min[i][j - 1], st_min[i + (1 << (j - 1))][j - 1]);
+                st_max[i][j] = max(st_max[i][j - 1], st_max[i + (1 << (j - 1))][j - 1]);
+            }
+        }
+    }
+
+    double query_min(int l, int r) const
+    {
+        int k = log2s[r - l + 1];
+        return min(st_min[l][k], st_min[r - (1 << k) + 1][k]);
+    }
+};
+
+static void testSparseTable(const vector<double> &close)
+{
+    // push/slide phải cho kết quả giống hệt init lại từ đầu
+    int n = close.size() / 2;
+    SparseTable sliding;
+    sliding.init(close.data() + close.size() - n, n);
+    int mismatch = 0;
+    for (int first = close.size() - n - 1; first >= 0; first--)
+    {
+        sliding.slide(close[first]);
+        SparseTable fresh;
+        fresh.init(close.data() + first, n);
+        for (int l = 0; l < n; l += 7)
+        {
+            for (int r = l; r < n; r += 13)
+            {
+                if (sliding.query_min(l, r) != fresh.query_min(l, r) || sliding.query_max(l, r) != fresh.query_max(l, r))
+                    mismatch++;
+            }
+        }
+    }
+    LOGI("SparseTable slide: {} mismatch", mismatch);
+
+    // RangeQuery phải khớp SparseTable ở mọi chiến lược, số truy vấn tăng dần để đi qua scan -> block -> sparse
+    SparseTable reference;
+    reference.init(close.data(), close.size());
+    for (int queries : {1, 10, 100, 1000})
+    {
+        RangeQuery range;
+        range.init(close.data(), close.size());
+        mismatch = 0;
+        for (int i = 0; i < queries; i++)
+        {
+            int l = (i * 37) % close.size();
+            int r = min<int>(close.size() - 1, l + (i * 11) % 200);
+            if (range.query_min(l, r) != reference.query_min(l, r) || range.query_max(l, r) != reference.query_max(l, r))
+                mismatch++;
+        }
+        LOGI("RangeQuery {} queries: {} mismatch, strategy {}", queries, mismatch, static_cast<int>(range.getStrategy()));
+    }
+
+    const int N = 10000;
+    int length = close.size();
+    double sink = 0.0;
+    {
+        Timer timer(StringFormat("NestedSparseTable init n={} x{}", length, N));
+        NestedSparseTable table;
+        for (int i = 0; i < N; i++)
+        {
+            table.init(close.data(), length);
+            sink += table.query_min(i % length, length - 1);
+        }
+    }
+    {
+        Timer timer(StringFormat("SparseTable init n={} x{}", length, N));
+        SparseTable table;
+        for (int i = 0; i < N; i++)
+        {
+            table.init(close.data(), length);
+            sink += table.query_min(i % length, length - 1);
+        }
+    }
+    {
+        Timer timer(StringFormat("SparseTable slide n={} x{}", length, N));
+        SparseTable table;
+        table.init(close.data(), length);
+        for (int i = 0; i < N; i++)
+        {
+            table.slide(close[i % length]);
+            sink += table.query_min(i % length, length - 1);
+        }
+    }
+    {
+        const int Q = 1000000;
+        NestedSparseTable nested;
+        nested.init(close.data(), length);
+        SparseTable flat;
+        flat.init(close.data(), length);
+        {
+            Timer timer(StringFormat("NestedSparseTable query n={} x{}", length, Q));
+            for (int i = 0; i < Q; i++)
+                sink += nested.query_min(i % length, min(length - 1, i % length + i % 97));
+        }
+        {
+            Timer timer(StringFormat("SparseTable query n={} x{}", length, Q));
+            for (int i = 0; i < Q; i++)
+                sink += flat.query_min(i % length, min(length - 1, i % length + i % 97));
+        }
+    }
+    LOGD("sink {}", sink);
+}
+
+// marsi, min/max_rsi, min/max/avg_macd_* đọc series đã cache so với các hàm tính lại cả chuỗi trong custom_indicator.
+// seed khác nhau (series seed ở nến cũ nhất, hàm cũ ở MAX_N + period trước from) nên chỉ so với sai số 1e-6
+static void testIndicatorAggregates(vector<double> &open, vector<double> &high, vector<double> &low, vector<double> &close, vector<double> &volume, vector<long long> &startTime)
+{
+    unordered_map<long long, ArenaVector> cached;
+    unordered_map<long long, RangeQuery *> cachedMinMax;
+    int length = close.size();
+    Expr e("binance", "BTCUSDT", "1h", length, open.data(), high.data(), low.data(), close.data(), volume.data(), startTime.data(), 0.0, &cached, &cachedMinMax);
+
+    int mismatch = 0, total = 0;
+    auto check = [&](const string &text, double expected)
+    {
+        double result;
+        total++;
+        if (!e.run(*compileExpr(text), result) || abs(result - expected) > 1e-6 * max(1.0, abs(expected)))
+        {
+            mismatch++;
+            LOGE("Indicator aggregate mismatch: {} = {} vs {}", text, result, expected);
+        }
+    };
+
+    for (auto [from, to] : vector<pair<int, int>>{{0, 0}, {0, 5}, {1, 3}, {2, 20}, {10, 60}, {0, 100}})
+    {
+        int k = to - from + 1;
+        check(fmt::format("marsi(14, {}, {})", from, to), iAvgRSI(14, k, close.data() + from, length - from));
+        check(fmt::format("min_rsi(14, {}, {})", from, to), iMinRSI(14, k, close.data() + from, length - from));
+        check(fmt::format("max_rsi(14, {}, {})", from, to), iMaxRSI(14, k, close.data() + from, length - from));
+
+        auto macd = [](MACD_Output output)
+        { return output.macd; };
+        auto signal = [](MACD_Output output)
+        { return output.signal; };
+        auto histogram = [](MACD_Output output)
+        { return output.histogram; };
+        check(fmt::format("avg_macd_value(12, 26, 9, {}, {})", from, to), iAvgMACD(12, 26, 9, k, close.data() + from, length - from, macd));
+        check(fmt::format("avg_macd_signal(12, 26, 9, {}, {})", from, to), iAvgMACD(12, 26, 9, k, close.data() + from, length - from, signal));
+        check(fmt::format("avg_macd_histogram(12, 26, 9, {}, {})", from, to), iAvgMACD(12, 26, 9, k, close.data() + from, length - from, histogram));
+        check(fmt::format("min_macd_value(12, 26, 9, {}, {})", from, to), iMinMACD(12, 26, 9, k, close.data() + from, length - from, macd));
+        check(fmt::format("max_macd_histogram(12, 26, 9, {}, {})", from, to), iMaxMACD(12, 26, 9, k, close.data() + from, length - from, histogram));
+    }
+    LOGI("Indicator aggregates: {}/{} mismatch", mismatch, total);
+}
+
+// chạy 1 bộ điều kiện giống bot thật, mỗi vòng là 1 lần đóng nến (cache làm mới)
+static void benchmarkExprCorpus(vector<double> &open, vector<double> &high, vector<double> &low, vector<double> &close, vector<double> &volume, vector<long long> &startTime)
+{
+    vector<string> exprs = {
+        "max_rsi(14, 70, 48) >= 80",
+        "macd_n_dinh(12, 26, 9, 6, 8, 0, 2, 0, 5) >= 3",
+        "ampl(1) >= avg_ampl(25, 0) * 1.8",
+        "close(1) > max_high(100, 2)",
+        "avg_macd_histogram(12, 26, 9, 0, 5) > 0",
+        "avg_macd_value(12, 26, 9, 1, 3) > avg_macd_signal(12, 26, 9, 1, 3)",
+        "min_change%(0, 20) < -2",
+        "max_ampl%(0, 50) > 3",
+        "bullish_hammer(1) > 0",
+    };
+    vector<shared_ptr<Program>> programs;
+    for (const string &expr : exprs)
+        programs.push_back(compileExpr(expr));
+
+    const int N = 10000;
+    double sink = 0.0;
+    {
+        Timer timer(StringFormat("expr corpus {} exprs x{}", exprs.size(), N));
+        for (int i = 0; i < N; i++)
+        {
+            unordered_map<long long, ArenaVector> cached;
+            unordered_map<long long, RangeQuery *> cachedMinMax;
+            Expr e("binance", "BTCUSDT", "1h", open.size(), open.data(), high.data(), low.data(), close.data(), volume.data(), startTime.data(), 0.0, &cached, &cachedMinMax);
+            for (auto &program : programs)
+            {
+                double result;
+                if (e.run(*program, result))
+                    sink += result;
+            }
+            exprArena.reset();
+        }
+    }
+    LOGD("sink {}", sink);
+}
+
 void test()
 {
     auto env = readEnvFile();
@@ -46,17 +588,65 @@ void test()
     vector<double> volume(rateData.volume.begin(), rateData.volume.end());
     vector<long long> startTime(rateData.startTime.begin(), rateData.startTime.end());
 
-    unordered_map<long long, vector<double>> cached;
-    unordered_map<long long, unique_ptr<SparseTable>> cachedMinMax;
+    unordered_map<long long, ArenaVector> cached;
+    unordered_map<long long, RangeQuery *> cachedMinMax;
 
     string expr = "{max_open(0,10)} - {max_high(0,10)} -  {max_low(0,10)} -  {max_close(0,10)}";
 
     LOGI(calculateSubExpr(expr, broker, symbol, timeframe, open.size(), open.data(), high.data(), low.data(), close.data(), volume.data(), startTime.data(), 0.0, &cached, &cachedMinMax));
+
+    testPrattParser();
+    testSeriesIndex();
+    testConvergingRoute();
+    testSeriesMemo(open, high, low, close, volume, startTime);
+    testSimdKernels(close);
+    testSparseTable(close);
+    testIndicatorAggregates(open, high, low, close, volume, startTime);
+    benchmarkExprCorpus(open, high, low, close, volume, startTime);
+
+    // benchmark telegram template: calculateSubExpr vs compileMessageTemplate + renderMessageTemplate
+    {
+        const int N = 100000;
+        string message = "RSI {rsi(14)} MA {ma(20)} BB {bb_upper(20, 2)} close {close(0)} change {change_p(1)}";
+        shared_ptr<const MessageTemplate> messageTemplate = compileMessageTemplate(message);
+        ExprRegistry::getInstance().commit();
+
+        Expr e(broker, symbol, timeframe, open.size(), open.data(), high.data(), low.data(), close.data(), volume.data(), startTime.data(), 0.0, &cached, &cachedMinMax);
+        fmt::memory_buffer buffer;
+        renderMessageTemplate(*messageTemplate, e, buffer);
+        string text = message;
+        LOGI("calculateSubExpr: {}", calculateSubExpr(text, broker, symbol, timeframe, open.size(), open.data(), high.data(), low.data(), close.data(), volume.data(), startTime.data(), 0.0, &cached, &cachedMinMax));
+        LOGI("renderMessageTemplate: {}", fmt::to_string(buffer));
+
+        {
+            Timer timer(StringFormat("calculateSubExpr x{}", N));
+            for (int i = 0; i < N; i++)
+            {
+                text = message;
+                calculateSubExpr(text, broker, symbol, timeframe, open.size(), open.data(), high.data(), low.data(), close.data(), volume.data(), startTime.data(), 0.0, &cached, &cachedMinMax);
+            }
+        }
+        {
+            Timer timer(StringFormat("renderMessageTemplate x{}", N));
+            for (int i = 0; i < N; i++)
+            {
+                renderMessageTemplate(*messageTemplate, e, buffer);
+            }
+        }
+    }
     SLEEP_FOR(1000000);
 }
 #endif
 
-static Route getRoute(const json &j, bool cachedTree)
+static shared_ptr<const Program> compileOrderField(const string &text)
+{
+    string expr;
+    if (text.empty() || !inlineSubExpr(text, expr))
+        return nullptr;
+    return ExprRegistry::getInstance().acquire(expr);
+}
+
+static Route getRoute(const json &j)
 {
     // j: {"data":{"id":"1744877970451","value":"Start","type":"start"},"id":"1744877970451","next":[{"data":{"id":"1744877970452","value":"max_rsi(14, 70, 48) >= 80","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970452","next":[{"data":{"id":"1744877982563","value":"macd_n_dinh(12, 26, 9, 6, 8, 0, 2, 0, 5) >= 3","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877982563","next":[{"data":{"id":"1744877970453","value":"ampl(1) >= avg_ampl(25, 0) * 1.8","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970453","next":[{"data":{"id":"1744877970454","value":"change(1) > 0","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970454","next":[{"data":{"id":"1744877970455","value":"change(0) < 0","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970455","next":[{"data":{"id":"1744877970456","value":"close(1) > max_high(100, 2)","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970456","next":[{"data":{"id":"1744877970457","value":"high(0) > max_high(100, 0)","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970457","next":[{"data":{"id":"1744877970458","value":"close(0) >= (open(1) + close(1))/2","type":"expr","unitVolume":"usd","unitEntry":"price","unitTP":"price","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"0"},"id":"1744877970458","next":[{"data":{"id":"1744877970459","value":"","type":"openSellLimit","unitVolume":"usd","unitEntry":"price","unitTP":"rr","unitSL":"price","unitStop":"price","unitExpiredTime":"candle","expiredTime":"1","volume":"5000","entry":"(close(0) + open(0))/2","sl":"high(0)","tp":"3.3","display":"Open SELL Limit. Volume=5000 (USD), Entry=(close(0) + open(0))/2 (USD), TP=3.3 (R), SL=high(0) (USD)"},"id":"1744877970459","next":[]}]}]}]}]}]}]}]}]}]}
     Route route;
@@ -99,26 +689,44 @@ static Route getRoute(const json &j, bool cachedTree)
             route.data.volume = jData["volume"].get<string>();
     }
 
+    route.data.kind = nodeKind(route.data.type);
+    if (route.data.kind == NodeKind::TELEGRAM)
+    {
+        route.data.message = compileMessageTemplate(route.data.value);
+    }
+
+    NodeKind kind = route.data.kind;
+    if (kind != NodeKind::START && kind != NodeKind::EXPR && kind != NodeKind::TELEGRAM && kind != NodeKind::CLOSE_ALL_ORDER && kind != NodeKind::CLOSE_ALL_POSITION)
+    {
+        shared_ptr<OrderTemplate> order = make_shared<OrderTemplate>();
+        order->stop = compileOrderField(route.data.stop);
+        order->entry = compileOrderField(route.data.entry);
+        order->sl = compileOrderField(route.data.sl);
+        order->tp = compileOrderField(route.data.tp);
+        order->volume = compileOrderField(route.data.volume);
+        order->expiredTime = compileOrderField(route.data.expiredTime);
+        route.data.order = order;
+    }
+
     if (j.contains("next"))
     {
         for (const auto &nextNode : j["next"])
         {
-            route.next.push_back(getRoute(nextNode, cachedTree));
+            route.next.push_back(getRoute(nextNode));
         }
     }
 
-    if (cachedTree && route.data.type != NODE_TYPE::START && route.data.type != NODE_TYPE::TELEGRAM && route.data.type != NODE_TYPE::CLOSE_ALL_ORDER && route.data.type != NODE_TYPE::CLOSE_ALL_POSITION)
+    if (kind != NodeKind::START && kind != NodeKind::TELEGRAM && kind != NodeKind::CLOSE_ALL_ORDER && kind != NodeKind::CLOSE_ALL_POSITION)
     {
-        string expr = toLowerCase(route.data.value);
-        if (!expr.empty())
+        if (!route.data.value.empty())
         {
-            cacheParseTree(expr);
+            route.data.program = ExprRegistry::getInstance().acquire(route.data.value);
         }
     }
     return route;
 }
 
-vector<shared_ptr<Bot>> getBotList(string botName, bool cachedTree)
+vector<shared_ptr<Bot>> getBotList(string botName)
 {
     Timer timer("getBotList");
     vector<shared_ptr<Bot>> botList;
@@ -174,40 +782,267 @@ vector<shared_ptr<Bot>> getBotList(string botName, bool cachedTree)
 
         string routeString = res->getString("route");
         json j = json::parse(routeString);
-        bot->route = getRoute(j, cachedTree);
+        bot->route = getRoute(j);
 
         botList.push_back(bot);
     }
     return botList;
 }
 
-void setBotList(string botName, bool cacheTree)
+static void addRouteToDag(Route &route, ExprDag &dag)
 {
-    botName = "";
-    if (botName == "")
+    if (route.data.kind == NodeKind::EXPR && route.data.program)
     {
-        botList = make_shared<vector<shared_ptr<Bot>>>(getBotList(botName, cacheTree));
+        route.data.dagNode = dag.add(*route.data.program);
     }
-    else
+    for (Route &next : route.next)
     {
-        auto list = make_shared<vector<shared_ptr<Bot>>>(getBotList(botName, cacheTree));
+        addRouteToDag(next, dag);
+    }
+}
 
-        // Xóa tất cả bot cùng tên (nếu có nhiều hơn 1)
-        botList->erase(remove_if(botList->begin(), botList->end(),
-                                 [&](const shared_ptr<Bot> &bot)
-                                 {
-                                     return bot->botName == botName;
-                                 }),
-                       botList->end());
+// key của bit visited: "" và "start" dùng chung 1 bit (key 0 của bản đệ quy cũ)
+static string visitKey(const string &id)
+{
+    return id == "start" ? "" : id;
+}
 
-        // Thêm các bot mới vào
-        botList->insert(botList->end(), list->begin(), list->end());
+static void countRouteIds(const Route &route, unordered_map<string, int> &idCount)
+{
+    idCount[visitKey(route.id)]++;
+    for (const Route &next : route.next)
+    {
+        countRouteIds(next, idCount);
     }
+}
+
+// gom các node expr nối tiếp (chỉ có 1 next) thành ExprChain để worker sắp lại thứ tự đánh giá.
+// Chỉ gom node có id xuất hiện 1 lần trong route: node dùng chung (nhiều nhánh hội tụ về cùng id)
+// bị đánh dấu visited sớm khi sắp lại thứ tự thì nhánh khác tới sau sẽ không chạy tiếp được nữa
+static void buildExprChains(Route &route, const unordered_map<string, int> &idCount)
+{
+    auto chainable = [&idCount](const Route &node)
+    { return node.data.kind == NodeKind::EXPR && idCount.at(visitKey(node.id)) == 1; };
 
+    Route *tail = &route;
+    if (chainable(route))
+    {
+        shared_ptr<ExprChain> chain = make_shared<ExprChain>();
+        while (true)
+        {
+            chain->nodes.push_back(&tail->data);
+            if (tail->next.size() != 1 || !chainable(tail->next[0]))
+                break;
+            tail = &tail->next[0];
+        }
+
+        if (chain->nodes.size() > 1)
+        {
+            vector<int> order(chain->nodes.size());
+            iota(order.begin(), order.end(), 0);
+            chain->tail = tail;
+            chain->stats.reset(new ExprNodeStats[chain->nodes.size()]);
+            chain->order = make_shared<const vector<int>>(move(order));
+            route.chain = chain;
+        }
+    }
+
+    for (Route &next : tail->next)
+    {
+        buildExprChains(next, idCount);
+    }
+}
+
+static void buildExprChains(Route &route)
+{
+    unordered_map<string, int> idCount;
+    countRouteIds(route, idCount);
+    buildExprChains(route, idCount);
+}
+
+// id route -> bit visited liền nhau
+static int visitId(const string &id, unordered_map<string, int> &ids)
+{
+    return ids.emplace(visitKey(id), ids.size()).first->second;
+}
+
+static int compileStep(Route &route, RouteProgram &program, unordered_map<string, int> &ids)
+{
+    int index = program.steps.size();
+    program.steps.push_back({route.data.kind, visitId(route.id, ids), 0, 0, &route.data, route.chain.get()});
+
+    vector<Route> *next = &route.next;
+    if (route.chain)
+    {
+        // các node của chuỗi nối nhau qua next[0] tới tail
+        ExprChain &chain = *route.chain;
+        Route *node = &route;
+        chain.ids.clear();
+        for (size_t i = 0; i < chain.nodes.size(); i++)
+        {
+            chain.ids.push_back(visitId(node->id, ids));
+            if (node != chain.tail)
+                node = &node->next[0];
+        }
+        next = &chain.tail->next;
+    }
+
+    // chừa chỗ cho con của node này trước khi đệ quy để chúng nằm liền nhau
+    int first = program.children.size();
+    int count = next->size();
+    program.children.resize(first + count);
+    program.steps[index].firstChild = first;
+    program.steps[index].childCount = count;
+    for (int i = 0; i < count; i++)
+    {
+        int child = compileStep((*next)[i], program, ids);
+        program.children[first + i] = child;
+    }
+    return index;
+}
+
+static void collectLeaves(const ExprDag &dag, int id, unordered_set<int> &seen, vector<int> &leaves)
+{
+    if (!seen.insert(id).second)
+        return;
+
+    const DagNode &node = dag.node(id);
+    if (node.left < 0)
+    {
+        if (node.ins.op != OpCode::CONST && node.ins.op != OpCode::STRING)
+            leaves.push_back(id);
+        return;
+    }
+    collectLeaves(dag, node.left, seen, leaves);
+    if (node.right >= 0)
+        collectLeaves(dag, node.right, seen, leaves);
+}
+
+static void collectRouteLeaves(const Route &route, const ExprDag &dag, unordered_set<int> &seen, vector<int> &leaves)
+{
+    if (route.data.kind == NodeKind::EXPR && route.data.dagNode >= 0)
+        collectLeaves(dag, route.data.dagNode, seen, leaves);
+    for (const Route &next : route.next)
+    {
+        collectRouteLeaves(next, dag, seen, leaves);
+    }
+}
+
+// compile bot->route thành RouteProgram, gọi sau addRouteToDag và buildExprChains
+static void compileRoute(Bot &bot, const ExprDag &dag)
+{
+    unordered_map<string, int> ids;
+    bot.program = RouteProgram();
+    compileStep(bot.route, bot.program, ids);
+    bot.program.visitCount = ids.size();
+
+    unordered_set<int> seen;
+    collectRouteLeaves(bot.route, dag, seen, bot.program.leaves);
+}
+
+static int fieldLookback(const string &text, const shared_ptr<const Program> &program)
+{
+    if (program)
+        return program->lookback;
+    // không compile được thì tính lúc chạy, không biết trước cần bao nhiêu nến
+    return text.empty() ? 0 : MAX_CANDLE;
+}
+
+// số nến gần nhất cả route cần đọc
+static int routeLookback(const Route &route)
+{
+    const NodeData &data = route.data;
+    int result = 0;
+
+    if (data.kind == NodeKind::TELEGRAM)
+    {
+        if (!data.message)
+            result = data.value.empty() ? 0 : MAX_CANDLE;
+        else
+            for (const shared_ptr<const Program> &slot : data.message->slots)
+                result = max(result, fieldLookback("", slot));
+    }
+    else if (data.order)
+    {
+        const OrderTemplate &order = *data.order;
+        // giá hiện tại và startTime[0] luôn được dùng khi đặt lệnh
+        result = max({1, fieldLookback(data.stop, order.stop), fieldLookback(data.entry, order.entry), fieldLookback(data.sl, order.sl),
+                      fieldLookback(data.tp, order.tp), fieldLookback(data.volume, order.volume), fieldLookback(data.expiredTime, order.expiredTime)});
+    }
+
+    if (data.kind != NodeKind::START && data.kind != NodeKind::TELEGRAM && data.kind != NodeKind::CLOSE_ALL_ORDER && data.kind != NodeKind::CLOSE_ALL_POSITION)
+    {
+        result = max(result, fieldLookback(data.value, data.program));
+    }
+
+    for (const Route &next : route.next)
+    {
+        result = max(result, routeLookback(next));
+    }
+    return result;
+}
+
+// số nến cần copy của mỗi series = max của các bot chạy trên series đó
+static void setLookbacks(BotList &list)
+{
+    for (const shared_ptr<Bot> &bot : list.bots)
+    {
+        int lookback = max(1, routeLookback(bot->route));
+        for (const Symbol &symbol : bot->symbolList)
+        {
+            for (const string &timeframe : bot->timeframes)
+            {
+                int &value = list.lookbacks[symbol.symbolName + "_" + timeframe];
+                value = max(value, min(lookback, MAX_CANDLE));
+            }
+        }
+    }
+
+#ifdef DEBUG_LOG
+    for (const auto &[series, lookback] : list.lookbacks)
+    {
+        LOGD("Lookback {}: {} candles", series, lookback);
+    }
+#endif
+}
+
+// luôn load lại toàn bộ bot kể cả khi chỉ botName thay đổi: BotList đã publish đang được worker đọc
+// nên không sửa tại chỗ, và DAG / lookback / series index của cả danh sách đều dựng lại từ đầu
+void setBotList(string botName)
+{
+    lock_guard<mutex> lock(botListMutex);
+    shared_ptr<BotList> list = make_shared<BotList>();
+    shared_ptr<ExprDag> dag = make_shared<ExprDag>();
+    list->bots = getBotList("");
+
+    // giữ id series cũ, chỉ dựng lại danh sách bot của từng series
+    if (botList)
+        list->seriesIndex = botList->seriesIndex;
+
+    for (const shared_ptr<Bot> &bot : list->bots)
+    {
+        addRouteToDag(bot->route, *dag);
+        buildExprChains(bot->route);
+        compileRoute(*bot, *dag);
+    }
+
+    list->dag = dag;
+    setLookbacks(*list);
+    list->seriesIndex.build(list->bots);
+    LOGI("Bot list size: {}, DAG size: {}, series: {}", list->bots.size(), dag->size(), list->lookbacks.size());
+
+    // publish các expr mới trước khi worker thấy bot list mới
+    ExprRegistry::getInstance().commit();
+
+    botList = list;
     for (SocketData *exchange : exchanges)
     {
         exchange->setBotList(botList);
     }
+
+    // bot list cũ đã được thay nên Program chỉ bot cũ dùng đã hết hạn, commit lại để bỏ khỏi registry.
+    // Worker còn đang chạy với list cũ thì phần còn lại được bỏ ở lần reload sau
+    ExprRegistry::getInstance().commit();
 }
 
 void sio_on_connected()
@@ -222,7 +1057,7 @@ void sio_on_message(string const &event, sio::message::ptr const &data, bool isA
     {
         string botName = data->get_string();
         LOGI("Update config for bot {}", botName);
-        setBotList(botName, false);
+        setBotList(botName);
     }
 }
 
@@ -251,7 +1086,7 @@ void runApp()
     client.socket()->on("onUpdateConfig", sio_on_message);
     client.connect(StringFormat("{}:{}", env["HOST_WEB_SERVER"], 8080));
 
-    setBotList("", true);
+    setBotList("");
 
     for (auto &t : threads)
     {
@@ -0,0 +1,87 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstdint>
+
+atomic<int> Arena::nextId{0};
+atomic<size_t> Arena::totalReserved{0};
+
+Arena::~Arena()
+{
+    reset();
+    releaseChunks(0);
+}
+
+// offset đầu tiên >= offset mà base + offset chia hết cho align
+static size_t alignOffset(const char *base, size_t offset, size_t align)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(base) + offset;
+    return offset + (align - address % align) % align;
+}
+
+void Arena::addChunk(size_t size)
+{
+    size_t next = chunks.empty() ? 0 : current + 1;
+    chunks.insert(chunks.begin() + next, {static_cast<char *>(::operator new(size)), size});
+    totalReserved += size;
+}
+
+void Arena::releaseChunks(size_t from)
+{
+    for (size_t i = from; i < chunks.size(); i++)
+    {
+        totalReserved -= chunks[i].size;
+        ::operator delete(chunks[i].data);
+    }
+    chunks.resize(min(from, chunks.size()));
+}
+
+void *Arena::allocate(size_t bytes, size_t align)
+{
+    size_t start = chunks.empty() ? 0 : alignOffset(chunks[current].data, offset, align);
+    if (chunks.empty() || start + bytes > chunks[current].size)
+    {
+        // chunk sau (giữ lại từ lần trước) đủ lớn thì dùng, không thì chèn chunk mới ngay sau chunk hiện tại
+        size_t next = chunks.empty() ? 0 : current + 1;
+        if (next >= chunks.size() || chunks[next].size < bytes + align)
+            addChunk(max(CHUNK_SIZE, bytes + align));
+        current = next;
+        start = alignOffset(chunks[current].data, 0, align);
+    }
+
+    offset = start + bytes;
+    used += bytes;
+    return chunks[current].data + start;
+}
+
+bool Arena::reset()
+{
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+        it->destroy(it->object);
+    destructors.clear();
+
+    bool grew = used > highWater;
+    highWater = max(highWater, used);
+
+    // lần này phải dùng nhiều chunk => gộp thành 1 chunk đủ cho high-water để lần sau liền 1 khối
+    if (chunks.size() > 1)
+    {
+        releaseChunks(0);
+        current = 0;
+        addChunk(min(MAX_RETAINED, (highWater + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE));
+    }
+    else if (!chunks.empty() && chunks[0].size > MAX_RETAINED)
+        releaseChunks(0);
+
+    current = 0;
+    offset = 0;
+    used = 0;
+    return grew;
+}
+
+size_t Arena::bytesReserved() const
+{
+    size_t size = 0;
+    for (const Chunk &chunk : chunks)
+        size += chunk.size;
+    return size;
+}
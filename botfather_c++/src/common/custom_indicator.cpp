@@ -1,14 +1,12 @@
 #include "custom_indicator.h"
-#include "vector_pool.h"
+#include "simd_kernel.h"
 
-static const int MAX_N = 300;
-static const double INF = 1e18;
+// chọn 1 lần lúc khởi động
+static const SimdKernels &kernels = simdKernels();
 
-extern thread_local VectorDoublePool vectorDoublePool;
-
-vector<double> iRSI(int period, const double close[], int n)
+ArenaVector iRSI(int period, const double close[], int n)
 {
-    vector<double> result = vectorDoublePool.acquire();
+    ArenaVector result = arenaVector();
 
     if (n <= period)
         return result;
@@ -111,12 +109,7 @@ double iMA(int period, const double close[], int n)
     if (period <= 0 || n < period)
         return 0.0;
 
-    double sum = 0.0;
-    for (int i = 0; i < period; ++i)
-    {
-        sum += close[i];
-    }
-    return sum / period;
+    return kernels.sum(close, period) / period;
 }
 
 double iEMA(int period, const double close[], int n)
@@ -138,9 +131,29 @@ double iEMA(int period, const double close[], int n)
     return ema;
 }
 
-vector<double> iMACD(int fastPeriod, int slowPeriod, int signalPeriod, const double close[], int n)
+// cả chuỗi EMA, seed ở nến n - 1 (iEMA seed ở nến MAX_N + period trước nến cần tính)
+ArenaVector iEMASeries(int period, const double close[], int n)
+{
+    ArenaVector result = arenaVector();
+
+    if (n <= 0 || period <= 0)
+        return result;
+
+    double k = 2.0 / (period + 1);
+
+    result.resize(n);
+    result[n - 1] = close[n - 1];
+    for (int i = n - 2; i >= 0; --i)
+    {
+        result[i] = close[i] * k + result[i + 1] * (1 - k);
+    }
+
+    return result;
+}
+
+ArenaVector iMACD(int fastPeriod, int slowPeriod, int signalPeriod, const double close[], int n)
 {
-    vector<double> result = vectorDoublePool.acquire();
+    ArenaVector result = arenaVector();
 
     if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
         return result;
@@ -188,22 +201,8 @@ BB_Output iBB(int period, double stdDev, const double close[], int n)
     if (n < period || period <= 0 || stdDev < 0)
         return {0.0, 0.0, 0.0};
 
-    double sum = 0.0;
-    for (int i = 0; i < period; ++i)
-    {
-        sum += close[i];
-    }
-
-    double mean = sum / period;
-
-    double variance = 0.0;
-    for (int i = 0; i < period; ++i)
-    {
-        double diff = close[i] - mean;
-        variance += diff * diff;
-    }
-
-    variance /= period;
+    double mean = kernels.sum(close, period) / period;
+    double variance = kernels.sumSqDiff(close, period, mean) / period;
     double std = sqrt(variance);
 
     double upper = mean + stdDev * std;
@@ -212,54 +211,18 @@ BB_Output iBB(int period, double stdDev, const double close[], int n)
     return {lower, mean, upper};
 }
 
-static vector<MACD_Output> iMACDs(int fastPeriod, int slowPeriod, int signalPeriod, const double close[], int n)
-{
-    n = min(n, MAX_N + slowPeriod);
-
-    if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
-        return {};
-
-    vector<MACD_Output> result;
-
-    double kFast = 2.0 / (fastPeriod + 1);
-    double kSlow = 2.0 / (slowPeriod + 1);
-    double kSignal = 2.0 / (signalPeriod + 1);
-
-    double emaFast = close[n - 1];
-    double emaSlow = close[n - 1];
-    double macd = 0.0;
-    double signalEMA = 0.0;
-
-    bool signalInitialized = false;
-
-    for (int i = n - 2; i >= 0; --i)
-    {
-        emaFast = (close[i] - emaFast) * kFast + emaFast;
-        emaSlow = (close[i] - emaSlow) * kSlow + emaSlow;
-
-        macd = emaFast - emaSlow;
-
-        if (signalInitialized)
-        {
-            signalEMA = (macd - signalEMA) * kSignal + signalEMA;
-        }
-        else
-        {
-            signalEMA = macd;
-            signalInitialized = true;
-        }
-        double histogram = macd - signalEMA;
-        result.push_back({macd, signalEMA, histogram});
-    }
-
-    reverse(result.begin(), result.end());
-
-    return result;
-}
-
-int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth, int depth, int enableDivergence, double diffCandle0, vector<double> &diffPercents, const double close[], const double open[], const double high[], int length)
+int macd_n_dinh(const double macd[], int count, int redDepth, int depth, int enableDivergence, double diffCandle0, const double diffPercents[], int diffCount, const double close[], const double open[], const double high[])
 {
-    vector<MACD_Output> values = iMACDs(fastPeriod, slowPeriod, signalPeriod, close, length);
+    // macd xen kẽ macd, signal, histogram như iMACD
+    auto valueMACD = [macd](int i)
+    { return macd[i * 3]; };
+    auto valueSignal = [macd](int i)
+    { return macd[i * 3 + 1]; };
+    auto valueHistogram = [macd](int i)
+    { return macd[i * 3 + 2]; };
+
+    int last = count - 1;
+    int diffIndex = 0; // thay cho xóa phần tử đầu của diffPercents
     int i = 0;
     int cnt = 0;
     int n = 0;
@@ -267,19 +230,19 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
     int indexMaxPrice = i, preIndexMaxPrice = i;
 
     {
-        while (i < values.size() - 1)
+        while (i < last)
         {
-            if (values[i].macd <= 0)
+            if (valueMACD(i) <= 0)
             {
                 break;
             };
-            if (values[i].signal <= 0)
+            if (valueSignal(i) <= 0)
             {
                 break;
             };
-            if (values[i].histogram >= 0)
+            if (valueHistogram(i) >= 0)
                 break;
-            if (values[i].macd > values[indexMaxMACD].macd)
+            if (valueMACD(i) > valueMACD(indexMaxMACD))
             {
                 indexMaxMACD = i;
             }
@@ -300,21 +263,21 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
 
         cnt = 0;
         int check = 0;
-        while (i < values.size() - 1)
+        while (i < last)
         {
-            if (values[i].macd <= 0)
+            if (valueMACD(i) <= 0)
             {
                 check = 3;
                 break;
             }
-            if (values[i].signal <= 0)
+            if (valueSignal(i) <= 0)
             {
                 check = 3;
                 break;
             }
-            if (values[i].histogram < 0)
+            if (valueHistogram(i) < 0)
                 break;
-            if (values[i].macd > values[indexMaxMACD].macd)
+            if (valueMACD(i) > valueMACD(indexMaxMACD))
             {
                 indexMaxMACD = i;
             }
@@ -335,12 +298,12 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
         }
         if (check == 3)
         {
-            while (i < values.size() - 1)
+            while (i < last)
             {
-                if (values[i].histogram < 0)
+                if (valueHistogram(i) < 0)
                     break;
                 cnt++;
-                if (values[i].macd > values[indexMaxMACD].macd)
+                if (valueMACD(i) > valueMACD(indexMaxMACD))
                 {
                     indexMaxMACD = i;
                 }
@@ -373,26 +336,26 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
 
     preIndexMaxMACD = i;
     preIndexMaxPrice = i;
-    for (; i < values.size() - 1; i++)
+    for (; i < last; i++)
     {
         cnt = 0;
         int cntRed = 0;
         int check = 0;
-        while (i < values.size() - 1)
+        while (i < last)
         {
-            if (values[i].macd <= 0)
+            if (valueMACD(i) <= 0)
             {
                 check = 1;
                 break;
             };
-            if (values[i].signal <= 0)
+            if (valueSignal(i) <= 0)
             {
                 check = 1;
                 break;
             };
-            if (values[i].histogram >= 0)
+            if (valueHistogram(i) >= 0)
                 break;
-            if (values[i].macd > values[preIndexMaxMACD].macd)
+            if (valueMACD(i) > valueMACD(preIndexMaxMACD))
             {
                 preIndexMaxMACD = i;
             }
@@ -415,21 +378,21 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
         // }
 
         cnt = 0;
-        while (i < values.size() - 1)
+        while (i < last)
         {
-            if (values[i].macd <= 0)
+            if (valueMACD(i) <= 0)
             {
                 check = 3;
                 break;
             }
-            if (values[i].signal <= 0)
+            if (valueSignal(i) <= 0)
             {
                 check = 3;
                 break;
             }
-            if (values[i].histogram < 0)
+            if (valueHistogram(i) < 0)
                 break;
-            if (values[i].macd > values[preIndexMaxMACD].macd)
+            if (valueMACD(i) > valueMACD(preIndexMaxMACD))
             {
                 preIndexMaxMACD = i;
             }
@@ -444,11 +407,11 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
 
         if (check == 3)
         {
-            while (i < values.size() - 1)
+            while (i < last)
             {
-                if (values[i].histogram < 0)
+                if (valueHistogram(i) < 0)
                     break;
-                if (values[i].macd > values[preIndexMaxMACD].macd)
+                if (valueMACD(i) > valueMACD(preIndexMaxMACD))
                 {
                     preIndexMaxMACD = i;
                 }
@@ -463,16 +426,16 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
         }
         // console.log({ enableDivergence, preIndexMaxMACD, indexMaxMACD, m1: values[preIndexMaxMACD], m2: values[indexMaxMACD], indexMaxPrice, preIndexMaxPrice, p: data[preIndexMaxPrice], p2: data[indexMaxPrice], diff: diffPercents[0] });
 
-        if (enableDivergence == 1 && values[preIndexMaxMACD].macd <= values[indexMaxMACD].macd)
+        if (enableDivergence == 1 && valueMACD(preIndexMaxMACD) <= valueMACD(indexMaxMACD))
         {
             return n;
         }
-        if (high[indexMaxPrice] - high[preIndexMaxPrice] <= high[preIndexMaxPrice] * diffPercents[0] / 100)
+        if (high[indexMaxPrice] - high[preIndexMaxPrice] <= high[preIndexMaxPrice] * diffPercents[diffIndex] / 100)
         {
             return n;
         }
-        if (diffPercents.size() > 1)
-            diffPercents.erase(diffPercents.begin());
+        if (diffCount - diffIndex > 1)
+            diffIndex++;
         indexMaxMACD = preIndexMaxMACD;
         indexMaxPrice = preIndexMaxPrice;
 
@@ -493,10 +456,8 @@ int macd_n_dinh(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth,
     return n;
 }
 
-int macd_n_day(int fastPeriod, int slowPeriod, int signalPeriod, int redDepth, int depth, int enableDivergence, double diffCandle0, vector<double> &diffPercents, const double close[], const double open[], const double high[], int length)
+int macd_n_day(const double macd[], int count, int redDepth, int depth, int enableDivergence, double diffCandle0, const double diffPercents[], int diffCount, const double close[], const double open[], const double high[])
 {
-    vector<MACD_Output> values = iMACDs(fastPeriod, slowPeriod, signalPeriod, close, length);
-
     return 0;
 }
 
@@ -570,12 +531,7 @@ double iAvg(int period, const double close[], int n)
     if (period <= 0 || n < period)
         return 0.0;
 
-    double sum = 0.0;
-    for (int i = 0; i < period; ++i)
-    {
-        sum += close[i];
-    }
-    return sum / period;
+    return kernels.sum(close, period) / period;
 }
 
 double iMin(int period, const double close[], int n)
@@ -583,12 +539,7 @@ double iMin(int period, const double close[], int n)
     if (period <= 0 || n < period)
         return 0.0;
 
-    double minVal = close[0];
-    for (int i = 1; i < period; ++i)
-    {
-        minVal = min(minVal, close[i]);
-    }
-    return minVal;
+    return kernels.min(close, period);
 }
 
 double iMax(int period, const double close[], int n)
@@ -596,55 +547,7 @@ double iMax(int period, const double close[], int n)
     if (period <= 0 || n < period)
         return 0.0;
 
-    double maxVal = close[0];
-    for (int i = 1; i < period; ++i)
-    {
-        maxVal = max(maxVal, close[i]);
-    }
-    return maxVal;
-}
-
-double iAvg(int period, int n, function<double(int)> f)
-{
-    if (period <= 0 || n < period)
-        return 0.0;
-
-    double sum = 0.0;
-    for (int i = 0; i < period; ++i)
-    {
-        sum += f(i);
-    }
-    return sum / period;
-}
-
-double iMin(int period, int n, function<double(int)> f)
-{
-    if (period <= 0 || n < period)
-        return 0.0;
-
-    double minVal = f(0);
-
-    for (int i = 1; i < period; ++i)
-    {
-        minVal = min(minVal, f(i));
-    }
-
-    return minVal;
-}
-
-double iMax(int period, int n, function<double(int)> f)
-{
-    if (period <= 0 || n < period)
-        return 0.0;
-
-    double maxVal = f(0);
-
-    for (int i = 1; i < period; ++i)
-    {
-        maxVal = max(maxVal, f(i));
-    }
-
-    return maxVal;
+    return kernels.max(close, period);
 }
 
 double iMinRSI(int period, int k, const double close[], int n)
@@ -774,140 +677,3 @@ double iAvgRSI(int period, int k, const double close[], int n)
 
     return sumRSI / k;
 }
-
-double iMinMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, function<double(MACD_Output)> f)
-{
-    n = min(n, MAX_N + slowPeriod + k);
-
-    if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
-        return INF;
-
-    double kFast = 2.0 / (fastPeriod + 1);
-    double kSlow = 2.0 / (slowPeriod + 1);
-    double kSignal = 2.0 / (signalPeriod + 1);
-
-    double emaFast = close[n - 1];
-    double emaSlow = close[n - 1];
-    double macd = 0.0;
-    double signalEMA = 0.0;
-
-    bool signalInitialized = false;
-
-    double result = INF;
-
-    for (int i = n - 2; i >= 0; --i)
-    {
-        emaFast = (close[i] - emaFast) * kFast + emaFast;
-        emaSlow = (close[i] - emaSlow) * kSlow + emaSlow;
-
-        macd = emaFast - emaSlow;
-
-        if (signalInitialized)
-        {
-            signalEMA = (macd - signalEMA) * kSignal + signalEMA;
-        }
-        else
-        {
-            signalEMA = macd;
-            signalInitialized = true;
-        }
-
-        if (i < k)
-        {
-            result = min(result, f({macd, signalEMA, macd - signalEMA}));
-        }
-    }
-
-    return result;
-}
-
-double iMaxMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, function<double(MACD_Output)> f)
-{
-    n = min(n, MAX_N + slowPeriod + k);
-
-    if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
-        return INF;
-
-    double kFast = 2.0 / (fastPeriod + 1);
-    double kSlow = 2.0 / (slowPeriod + 1);
-    double kSignal = 2.0 / (signalPeriod + 1);
-
-    double emaFast = close[n - 1];
-    double emaSlow = close[n - 1];
-    double macd = 0.0;
-    double signalEMA = 0.0;
-
-    bool signalInitialized = false;
-
-    double result = -INF;
-
-    for (int i = n - 2; i >= 0; --i)
-    {
-        emaFast = (close[i] - emaFast) * kFast + emaFast;
-        emaSlow = (close[i] - emaSlow) * kSlow + emaSlow;
-
-        macd = emaFast - emaSlow;
-
-        if (signalInitialized)
-        {
-            signalEMA = (macd - signalEMA) * kSignal + signalEMA;
-        }
-        else
-        {
-            signalEMA = macd;
-            signalInitialized = true;
-        }
-
-        if (i < k)
-        {
-            result = max(result, f({macd, signalEMA, macd - signalEMA}));
-        }
-    }
-
-    return result;
-}
-double iAvgMACD(int fastPeriod, int slowPeriod, int signalPeriod, int k, const double close[], int n, function<double(MACD_Output)> f)
-{
-    n = min(n, MAX_N + slowPeriod + k);
-
-    if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
-        return 0.0;
-
-    double kFast = 2.0 / (fastPeriod + 1);
-    double kSlow = 2.0 / (slowPeriod + 1);
-    double kSignal = 2.0 / (signalPeriod + 1);
-
-    double emaFast = close[n - 1];
-    double emaSlow = close[n - 1];
-    double macd = 0.0;
-    double signalEMA = 0.0;
-
-    bool signalInitialized = false;
-
-    double sum = 0;
-
-    for (int i = n - 2; i >= 0; --i)
-    {
-        emaFast = (close[i] - emaFast) * kFast + emaFast;
-        emaSlow = (close[i] - emaSlow) * kSlow + emaSlow;
-
-        macd = emaFast - emaSlow;
-
-        if (signalInitialized)
-        {
-            signalEMA = (macd - signalEMA) * kSignal + signalEMA;
-        }
-        else
-        {
-            signalEMA = macd;
-            signalInitialized = true;
-        }
-
-        if (i < k)
-        {
-            sum += f({macd, signalEMA, macd - signalEMA});
-        }
-    }
-
-    return sum / k;
-}
\ No newline at end of file
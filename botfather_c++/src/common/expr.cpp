@@ -1,1463 +1,1186 @@
 #include "expr.h"
+#include "expr_compiler.h"
+#include "expr_registry.h"
 #include "util.h"
 #include "custom_indicator.h"
 #include "timer.h"
-#include "vector_pool.h"
-
-extern thread_local VectorDoublePool vectorDoublePool;
-extern thread_local SparseTablePool sparseTablePool;
-
-static const long long ID_RSI = 1;
-static const long long ID_MACD = 2;
-static const long long ID_MM_OPEN = 3;
-static const long long ID_MM_HIGH = 4;
-static const long long ID_MM_LOW = 5;
-static const long long ID_MM_CLOSE = 6;
-static const long long ID_MM_RSI = 7;
-static const long long ID_MM_MACD_VALUE = 8;
-static const long long ID_MM_MACD_SIGNAL = 9;
-static const long long ID_MM_MACD_HISTOGRAM = 10;
-
-any Expr::visitNumber(ExprParser::NumberContext *ctx)
-{
-    if (ctx->INT())
-    {
-        return visit(ctx->INT());
-    }
-    else if (ctx->FLOAT())
-    {
-        return visit(ctx->FLOAT());
-    }
-    else
-    {
-        return {};
-    }
-}
+#include "expr_profiler.h"
+#include "series_store.h"
+#include "indicator_stream.h"
+#include "prefix_sum.h"
+#include <cstring>
 
-any Expr::visitFloat(ExprParser::FloatContext *ctx)
+// loại dữ liệu trong cachedIndicator, cachedMinMax và IndicatorStreams, tham số đi kèm ghi ở comment
+enum class CacheId : uint8_t
 {
-    return stod(ctx->FLOAT()->getText());
-}
+    RSI = 1,         // period
+    MACD,            // fast, slow, signal
+    EMA,             // period
+    RSI_SLOPE,       // period
+    MACD_SLOPE,      // fast, slow, signal
+    COLUMN,          // OpCode cột dẫn xuất
+    PREFIX_SUM,      // OpCode cột
+    MIN_MAX_COLUMN,  // OpCode cột
+    MIN_MAX_RSI,     // period
+    MIN_MAX_MACD,    // fast, slow, signal, cột (0 macd, 1 signal, 2 histogram)
+    PREFIX_SUM_RSI,  // period
+    PREFIX_SUM_MACD, // fast, slow, signal, cột
+    MACD_N_DINH,     // hash của lệnh
+};
 
-any Expr::visitInt(ExprParser::IntContext *ctx)
+// mỗi tham số 10 bit, cột MACD 2 bit
+static long long cacheKey(CacheId id, long long p0 = 0, long long p1 = 0, long long p2 = 0, long long p3 = 0)
 {
-    return stod(ctx->INT()->getText());
+    return static_cast<long long>(id) | (p0 << 10) | (p1 << 20) | (p2 << 30) | (p3 << 40);
 }
 
-any Expr::visitString(ExprParser::StringContext *ctx)
+static long long cacheKey(CacheId id, OpCode column)
 {
-    return ctx->STRING()->getText();
+    return cacheKey(id, static_cast<long long>(column));
 }
 
-any Expr::visitNegative(ExprParser::NegativeContext *ctx)
+// key theo hash cho tham số không gói được vào 10 bit, 8 bit thấp vẫn là id
+static long long hashedCacheKey(CacheId id, uint64_t hash)
 {
-    auto value = visit(ctx->expr());
-
-    if (!value.has_value())
-        return {};
-
-    double v = any_cast<double>(value);
-    return -v;
+    return static_cast<long long>((hash << 8) | static_cast<uint64_t>(id));
 }
 
-any Expr::visitPositive(ExprParser::PositiveContext *ctx)
+static uint64_t mixHash(uint64_t h, uint64_t v)
 {
-    return visit(ctx->expr());
+    // splitmix64
+    h ^= v + 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
 }
 
-any Expr::visitMulDiv(ExprParser::MulDivContext *ctx)
+// hash của op, args (đã chuẩn hóa nếu cần), number và pool của lệnh
+static uint64_t hashInstruction(const Instruction &ins, const int *args, const double *pool)
 {
-    auto left = visit(ctx->expr(0));
-    auto right = visit(ctx->expr(1));
-
-    if (!left.has_value() || !right.has_value())
-        return {};
+    uint64_t number;
+    memcpy(&number, &ins.number, sizeof(number));
 
-    double l = any_cast<double>(left);
-    double r = any_cast<double>(right);
-
-    return ctx->children[1]->getText() == "*" ? l * r : l / r;
+    uint64_t hash = mixHash(static_cast<uint64_t>(ins.op), number);
+    for (int i = 0; i < MAX_INSTRUCTION_ARGS; i++)
+    {
+        hash = mixHash(hash, static_cast<uint32_t>(args[i]));
+    }
+    for (int i = 0; i < ins.poolSize; i++)
+    {
+        memcpy(&number, &pool[ins.poolOffset + i], sizeof(number));
+        hash = mixHash(hash, number);
+    }
+    return hash;
 }
 
-any Expr::visitAddSub(ExprParser::AddSubContext *ctx)
+// cache theo hash lưu kèm op, args, number và pool của lệnh để so khi tra cứu
+template <class Vector>
+static void appendInstruction(Vector &value, const Instruction &ins, const int *args, const double *pool)
 {
-    auto left = visit(ctx->expr(0));
-    auto right = visit(ctx->expr(1));
-
-    if (!left.has_value() || !right.has_value())
-        return {};
-
-    double l = any_cast<double>(left);
-    double r = any_cast<double>(right);
-
-    return ctx->children[1]->getText() == "+" ? l + r : l - r;
+    value.push_back(static_cast<double>(ins.op));
+    value.insert(value.end(), args, args + MAX_INSTRUCTION_ARGS);
+    value.push_back(ins.number);
+    value.insert(value.end(), pool + ins.poolOffset, pool + ins.poolOffset + ins.poolSize);
 }
 
-any Expr::visitComparison(ExprParser::ComparisonContext *ctx)
+static bool sameInstruction(const double *stored, size_t size, const Instruction &ins, const int *args, const double *pool)
 {
-    auto left = visit(ctx->expr(0));
-    auto right = visit(ctx->expr(1));
-
-    if (!left.has_value() || !right.has_value())
-        return {};
+    if (size != 1 + MAX_INSTRUCTION_ARGS + 1 + (size_t)ins.poolSize || stored[0] != static_cast<double>(ins.op))
+        return false;
 
-    double l = any_cast<double>(left);
-    double r = any_cast<double>(right);
-
-    string op = ctx->comparisonOp()->getText();
-
-    if (op == "==")
-        return l == r ? 1.0 : 0.0;
-    if (op == "=")
-        return l == r ? 1.0 : 0.0;
-    if (op == "<")
-        return l < r ? 1.0 : 0.0;
-    if (op == "<=")
-        return l <= r ? 1.0 : 0.0;
-    if (op == ">")
-        return l > r ? 1.0 : 0.0;
-    if (op == ">=")
-        return l >= r ? 1.0 : 0.0;
-
-    return {};
+    stored++;
+    for (int i = 0; i < MAX_INSTRUCTION_ARGS; i++)
+    {
+        if (stored[i] != args[i])
+            return false;
+    }
+    stored += MAX_INSTRUCTION_ARGS;
+    return memcmp(stored, &ins.number, sizeof(double)) == 0 && memcmp(stored + 1, pool + ins.poolOffset, ins.poolSize * sizeof(double)) == 0;
 }
 
-any Expr::visitParens(ExprParser::ParensContext *ctx)
+ArenaVector &Expr::getRSI(int period)
 {
-    return visit(ctx->expr());
-}
+    long long key = cacheKey(CacheId::RSI, period);
 
-any Expr::visitABS(ExprParser::ABSContext *ctx)
-{
-    auto value = visit(ctx->expr());
-    double v = any_cast<double>(value);
-    return abs(v);
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        const IndicatorStream *stream = getRSIStream(period);
+        if (stream)
+        {
+            ArenaVector rsi = arenaVector();
+            stream->copyTo(rsi, length - 1 - period);
+            it = cachedIndicator->emplace(key, move(rsi)).first;
+        }
+        else
+            it = cachedIndicator->emplace(key, iRSI(period, close, length)).first;
+    }
+    return it->second;
 }
 
-any Expr::visitMIN(ExprParser::MINContext *ctx)
+ArenaVector &Expr::getMACD(int fastPeriod, int slowPeriod, int signalPeriod)
 {
-    auto left = visit(ctx->expr(0));
-    auto right = visit(ctx->expr(1));
-
-    double l = any_cast<double>(left);
-    double r = any_cast<double>(right);
+    long long key = cacheKey(CacheId::MACD, fastPeriod, slowPeriod, signalPeriod);
 
-    return l < r ? l : r;
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        const IndicatorStream *stream = getMACDStream(fastPeriod, slowPeriod, signalPeriod);
+        if (stream)
+        {
+            ArenaVector macd = arenaVector();
+            stream->copyTo(macd, length - 1);
+            it = cachedIndicator->emplace(key, move(macd)).first;
+        }
+        else
+            it = cachedIndicator->emplace(key, iMACD(fastPeriod, slowPeriod, signalPeriod, close, length)).first;
+    }
+    return it->second;
 }
 
-any Expr::visitMAX(ExprParser::MAXContext *ctx)
+const IndicatorStream *Expr::getRSIStream(int period)
 {
-    auto left = visit(ctx->expr(0));
-    auto right = visit(ctx->expr(1));
-
-    double l = any_cast<double>(left);
-    double r = any_cast<double>(right);
-
-    return l > r ? l : r;
+    if (!seriesMemo)
+        return nullptr;
+    return seriesMemo->indicators.rsi(cacheKey(CacheId::RSI, period), period, close, startTime, length);
 }
 
-any Expr::visitOpen(ExprParser::OpenContext *ctx)
+const IndicatorStream *Expr::getEMAStream(int period)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    return open[shift];
+    if (!seriesMemo)
+        return nullptr;
+    return seriesMemo->indicators.ema(cacheKey(CacheId::EMA, period), period, close, startTime, length);
 }
 
-any Expr::visitHigh(ExprParser::HighContext *ctx)
+const IndicatorStream *Expr::getMACDStream(int fastPeriod, int slowPeriod, int signalPeriod)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    return high[shift];
+    if (!seriesMemo)
+        return nullptr;
+    return seriesMemo->indicators.macd(cacheKey(CacheId::MACD, fastPeriod, slowPeriod, signalPeriod), fastPeriod, slowPeriod, signalPeriod, close, startTime, length);
 }
 
-any Expr::visitLow(ExprParser::LowContext *ctx)
+// góc (độ) của đoạn tăng diff trên độ rộng wide, dùng cho rsi_slope/macd_slope
+static double slopeDegree(double diff, double wide)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    return low[shift];
+    return atan(diff / wide) / M_PI * 180;
 }
 
-any Expr::visitClose(ExprParser::CloseContext *ctx)
+ArenaVector &Expr::getEMA(int period)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
+    long long key = cacheKey(CacheId::EMA, period);
 
-    return close[shift];
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        const IndicatorStream *stream = getEMAStream(period);
+        if (stream)
+        {
+            ArenaVector ema = arenaVector();
+            stream->copyTo(ema, length);
+            it = cachedIndicator->emplace(key, move(ema)).first;
+        }
+        else
+            it = cachedIndicator->emplace(key, iEMASeries(period, close, length)).first;
+    }
+    return it->second;
 }
 
-any Expr::visitVolume(ExprParser::VolumeContext *ctx)
+ArenaVector &Expr::getRSISlope(int period)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
+    long long key = cacheKey(CacheId::RSI_SLOPE, period);
 
-    return volume[shift];
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        const ArenaVector &rsi = getRSI(period);
+        ArenaVector slope = arenaVector();
+        if (rsi.size() > 1)
+        {
+            slope.resize(rsi.size() - 1);
+            for (size_t i = 0; i < slope.size(); ++i)
+                slope[i] = slopeDegree(rsi[i] - rsi[i + 1], 3.0);
+        }
+        it = cachedIndicator->emplace(key, move(slope)).first;
+    }
+    return it->second;
 }
 
-any Expr::visitChange(ExprParser::ChangeContext *ctx)
+ArenaVector &Expr::getMACDSlope(int fastPeriod, int slowPeriod, int signalPeriod)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
+    long long key = cacheKey(CacheId::MACD_SLOPE, fastPeriod, slowPeriod, signalPeriod);
 
-    return close[shift] - open[shift];
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        // như macd_slope: macd(i) - macd(i + 1) so với độ lệch MA(slowPeriod) của macd giữa nến i và i + 1,
+        // độ lệch đó = (macd(i) - macd(i + slowPeriod)) / slowPeriod
+        const ArenaVector &macd = getMACD(fastPeriod, slowPeriod, signalPeriod);
+        int n = macd.size() / 3;
+        ArenaVector slope = arenaVector();
+        if (n > slowPeriod)
+        {
+            slope.resize(n - slowPeriod);
+            for (size_t i = 0; i < slope.size(); ++i)
+                slope[i] = slopeDegree(macd[i * 3] - macd[(i + 1) * 3], abs(macd[i * 3] - macd[(i + slowPeriod) * 3]) / slowPeriod);
+        }
+        it = cachedIndicator->emplace(key, move(slope)).first;
+    }
+    return it->second;
 }
 
-any Expr::visitChangeP(ExprParser::ChangePContext *ctx)
+RangeQuery &Expr::getMinMax(long long key, const double *a, int n)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
+    auto it = cachedMinMax->find(key);
+    PROFILE_CACHE(ProfileCache::MIN_MAX, it != cachedMinMax->end());
+    if (it == cachedMinMax->end())
+    {
+        RangeQuery *range = currentArena().create<RangeQuery>();
+        range->init(a, n);
 
-    return (close[shift] - open[shift]) / open[shift] * 100.0;
+        it = cachedMinMax->emplace(key, range).first;
+    }
+    return *it->second;
 }
 
-any Expr::visitAmpl(ExprParser::AmplContext *ctx)
+RangeQuery &Expr::getMinMaxMACD(long long key, const ArenaVector &cachedMACD, int offset)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
+    auto it = cachedMinMax->find(key);
+    PROFILE_CACHE(ProfileCache::MIN_MAX, it != cachedMinMax->end());
+    if (it == cachedMinMax->end())
+    {
+        RangeQuery *range = currentArena().create<RangeQuery>();
+        range->initStrided(cachedMACD.data() + offset, 3, cachedMACD.size() / 3);
 
-    return high[shift] - low[shift];
+        it = cachedMinMax->emplace(key, range).first;
+    }
+    return *it->second;
 }
 
-any Expr::visitAmplP(ExprParser::AmplPContext *ctx)
+// giá trị dẫn xuất của 1 nến: change, ampl, shadow và bản %
+static double candleValue(OpCode op, double open, double high, double low, double close)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    return (high[shift] - low[shift]) / open[shift] * 100.0;
+    switch (op)
+    {
+    case OpCode::CHANGE:
+        return close - open;
+    case OpCode::CHANGE_P:
+        return (close - open) / open * 100.0;
+    case OpCode::AMPL:
+        return high - low;
+    case OpCode::AMPL_P:
+        return (high - low) / open * 100.0;
+    case OpCode::UPPER_SHADOW:
+        return high - max(open, close);
+    case OpCode::UPPER_SHADOW_P:
+        return (high - max(open, close)) / open * 100.0;
+    case OpCode::LOWER_SHADOW:
+        return min(open, close) - low;
+    default:
+        return (min(open, close) - low) / open * 100.0;
+    }
 }
 
-any Expr::visitUpper_shadow(ExprParser::Upper_shadowContext *ctx)
-{
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    return high[shift] - max(open[shift], close[shift]);
-}
-any Expr::visitUpper_shadowP(ExprParser::Upper_shadowPContext *ctx)
+const double *Expr::getColumn(OpCode column)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
+    switch (column)
+    {
+    case OpCode::OPEN:
+        return open;
+    case OpCode::HIGH:
+        return high;
+    case OpCode::LOW:
+        return low;
+    case OpCode::CLOSE:
+        return close;
+    case OpCode::VOLUME:
+        return volume;
+    default:
+        break;
+    }
 
-    double upperShadow = high[shift] - max(open[shift], close[shift]);
-    return upperShadow / open[shift] * 100.0;
+    long long key = cacheKey(CacheId::COLUMN, column);
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        ArenaVector values = arenaVector();
+        values.resize(length);
+        for (int i = 0; i < length; ++i)
+            values[i] = candleValue(column, open[i], high[i], low[i], close[i]);
+        it = cachedIndicator->emplace(key, move(values)).first;
+    }
+    return it->second.data();
 }
 
-any Expr::visitLower_shadow(ExprParser::Lower_shadowContext *ctx)
+PrefixSum Expr::getPrefixSum(long long key, const double *a, int n)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    return min(open[shift], close[shift]) - low[shift];
+    auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::PREFIX_SUM, it != cachedIndicator->end());
+    if (it == cachedIndicator->end())
+    {
+        ArenaVector data = arenaVector();
+        PrefixSum::build(data, a, n);
+        it = cachedIndicator->emplace(key, move(data)).first;
+    }
+    return PrefixSum(it->second);
 }
 
-any Expr::visitLower_shadowP(ExprParser::Lower_shadowPContext *ctx)
+PrefixSum Expr::getPrefixSum(OpCode column)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-    if (shift < 0 || shift >= length)
-        return {};
-
-    double lowerShadow = min(open[shift], close[shift]) - low[shift];
-    return lowerShadow / open[shift] * 100.0;
+    return getPrefixSum(cacheKey(CacheId::PREFIX_SUM, column), getColumn(column), length);
 }
 
-vector<double> &Expr::getRSI(int period)
+PrefixSum Expr::getPrefixSumMACD(long long key, const ArenaVector &cachedMACD, int offset)
 {
-    long long key = ID_RSI | (static_cast<long long>(period) << 10);
-
     auto it = cachedIndicator->find(key);
+    PROFILE_CACHE(ProfileCache::PREFIX_SUM, it != cachedIndicator->end());
     if (it == cachedIndicator->end())
     {
-        it = cachedIndicator->emplace(key, iRSI(period, close, length)).first;
+        ArenaVector v = arenaVector();
+        v.resize(cachedMACD.size() / 3);
+        for (size_t i = 0; i < v.size(); ++i)
+        {
+            v[i] = cachedMACD[i * 3 + offset];
+        }
+
+        ArenaVector data = arenaVector();
+        PrefixSum::build(data, v.data(), v.size());
+        it = cachedIndicator->emplace(key, move(data)).first;
     }
-    return it->second;
+    return PrefixSum(it->second);
 }
 
-any Expr::visitRsi(ExprParser::RsiContext *ctx)
+RangeQuery &Expr::getMinMax(OpCode column)
 {
-    int period = stoi(ctx->INT(0)->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (period <= 0 || shift < 0 || shift >= length - period)
-        return {};
-
-    const vector<double> &cached = getRSI(period);
-
-    if (shift >= cached.size())
+    long long key = cacheKey(CacheId::MIN_MAX_COLUMN, column);
+    if (seriesMemo)
     {
-        return {};
+        // cột nến không đổi sau khi đóng nến nên giữ bảng qua các lần đóng nến, chỉ slide nến mới vào
+        auto it = cachedMinMax->find(key);
+        PROFILE_CACHE(ProfileCache::MIN_MAX, it != cachedMinMax->end());
+        if (it != cachedMinMax->end())
+            return *it->second;
+
+        const SparseTable *table = seriesMemo->indicators.minMax(key, getColumn(column), startTime, length);
+        if (table)
+        {
+            RangeQuery *range = currentArena().create<RangeQuery>();
+            range->initTable(table);
+            return *cachedMinMax->emplace(key, range).first->second;
+        }
     }
-
-    return cached[shift];
+    return getMinMax(key, getColumn(column), length);
 }
 
-any Expr::visitRsi_slope(ExprParser::Rsi_slopeContext *ctx)
+// các hàm lấy dữ liệu nến/indicator, trả về false nếu không có giá trị
+bool Expr::evalLeaf(const Instruction &ins, const double *pool, double &result)
 {
-    int period = stoi(ctx->INT(0)->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (period <= 0 || shift < 0 || shift >= length - period - 1)
-        return {};
+    PROFILE_OP(ins.op);
+    const int *args = ins.args;
 
-    return iRSI_slope(period, close + shift, length - shift);
-}
+    switch (ins.op)
+    {
+    case OpCode::OPEN:
+    case OpCode::HIGH:
+    case OpCode::LOW:
+    case OpCode::CLOSE:
+    case OpCode::VOLUME:
+    case OpCode::CHANGE:
+    case OpCode::CHANGE_P:
+    case OpCode::AMPL:
+    case OpCode::AMPL_P:
+    case OpCode::UPPER_SHADOW:
+    case OpCode::UPPER_SHADOW_P:
+    case OpCode::LOWER_SHADOW:
+    case OpCode::LOWER_SHADOW_P:
+    {
+        int shift = args[0];
+        if (shift < 0 || shift >= length)
+            return false;
 
-any Expr::visitMa(ExprParser::MaContext *ctx)
-{
-    int period = stoi(ctx->INT(0)->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+        switch (ins.op)
+        {
+        case OpCode::OPEN:
+            result = open[shift];
+            break;
+        case OpCode::HIGH:
+            result = high[shift];
+            break;
+        case OpCode::LOW:
+            result = low[shift];
+            break;
+        case OpCode::CLOSE:
+            result = close[shift];
+            break;
+        case OpCode::VOLUME:
+            result = volume[shift];
+            break;
+        default:
+            result = candleValue(ins.op, open[shift], high[shift], low[shift], close[shift]);
+            break;
+        }
+        return true;
+    }
 
-    if (period <= 0 || shift < 0 || shift >= length - period)
-        return {};
+    case OpCode::RSI:
+    {
+        int period = args[0], shift = args[1];
+        if (period <= 0 || shift < 0 || shift >= length - period)
+            return false;
 
-    return iMA(period, close + shift, length - shift);
-}
+        // stream giữ cả nến ngoài cửa sổ, giới hạn shift như iRSI
+        const IndicatorStream *stream = getRSIStream(period);
+        if (stream)
+        {
+            if (shift >= length - 1 - period)
+                return false;
+            result = stream->at(shift);
+            return true;
+        }
 
-any Expr::visitEma(ExprParser::EmaContext *ctx)
-{
-    int period = stoi(ctx->INT(0)->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+        const ArenaVector &cached = getRSI(period);
+        if ((size_t)shift >= cached.size())
+            return false;
 
-    if (period <= 0 || shift < 0 || shift >= length - period)
-        return {};
+        result = cached[shift];
+        return true;
+    }
 
-    return iEMA(period, close + shift, length - shift);
-}
+    case OpCode::RSI_SLOPE:
+    {
+        int period = args[0], shift = args[1];
+        if (period <= 0 || shift < 0 || shift >= length - period - 1)
+            return false;
 
-vector<double> &Expr::getMACD(int fastPeriod, int slowPeriod, int signalPeriod)
-{
-    long long key = ID_MACD | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
+        const ArenaVector &slope = getRSISlope(period);
+        result = (size_t)shift < slope.size() ? slope[shift] : iRSI_slope(period, close + shift, length - shift);
+        return true;
+    }
 
-    auto it = cachedIndicator->find(key);
-    if (it == cachedIndicator->end())
+    case OpCode::MA:
+    case OpCode::EMA:
     {
-        it = cachedIndicator->emplace(key, iMACD(fastPeriod, slowPeriod, signalPeriod, close, length)).first;
-    }
-    return it->second;
-}
-any Expr::visitMacd_value(ExprParser::Macd_valueContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int shift = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
+        int period = args[0], shift = args[1];
+        if (period <= 0 || shift < 0 || shift >= length - period)
+            return false;
 
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || shift < 0 || shift >= length - slowPeriod)
-        return {};
+        if (ins.op == OpCode::MA)
+        {
+            result = getPrefixSum(OpCode::CLOSE).mean(shift, shift + period - 1);
+            return true;
+        }
 
-    const vector<double> &cached = getMACD(fastPeriod, slowPeriod, signalPeriod);
+        const IndicatorStream *stream = getEMAStream(period);
+        result = stream ? stream->at(shift) : getEMA(period)[shift];
+        return true;
+    }
 
-    if (shift * 3 >= cached.size())
+    case OpCode::MACD_VALUE:
+    case OpCode::MACD_SIGNAL:
+    case OpCode::MACD_HISTOGRAM:
     {
-        return {};
-    }
-    return cached[shift * 3];
-}
+        int fastPeriod = args[0], slowPeriod = args[1], signalPeriod = args[2], shift = args[3];
+        int offset = ins.op == OpCode::MACD_VALUE ? 0 : ins.op == OpCode::MACD_SIGNAL ? 1
+                                                                                       : 2;
 
-any Expr::visitMacd_signal(ExprParser::Macd_signalContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int shift = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
+        // macd_histogram không kiểm tra tham số, giữ như cũ
+        if (ins.op != OpCode::MACD_HISTOGRAM && (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || shift < 0 || shift >= length - slowPeriod))
+            return false;
 
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || shift < 0 || shift >= length - slowPeriod)
-        return {};
+        const IndicatorStream *stream = getMACDStream(fastPeriod, slowPeriod, signalPeriod);
+        if (stream)
+        {
+            if (shift < 0 || shift >= length - 1)
+                return false;
+            result = stream->at(shift, offset);
+            return true;
+        }
 
-    const vector<double> &cached = getMACD(fastPeriod, slowPeriod, signalPeriod);
+        const ArenaVector &cached = getMACD(fastPeriod, slowPeriod, signalPeriod);
+        // macd_histogram chưa kiểm tra shift < 0
+        if (shift < 0 || (size_t)(shift * 3 + offset) >= cached.size())
+            return false;
 
-    if (shift * 3 + 1 >= cached.size())
-    {
-        return {};
+        result = cached[shift * 3 + offset];
+        return true;
     }
-    return cached[shift * 3 + 1];
-}
 
-any Expr::visitMacd_histogram(ExprParser::Macd_histogramContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int shift = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-
-    const vector<double> &cached = getMACD(fastPeriod, slowPeriod, signalPeriod);
-
-    if (shift * 3 + 2 >= cached.size())
+    case OpCode::BB_UPPER:
+    case OpCode::BB_MIDDLE:
+    case OpCode::BB_LOWER:
     {
-        return {};
+        int period = args[0], shift = args[1];
+        double stdDev = ins.number;
+        if (period <= 0 || stdDev <= 0 || shift < 0 || shift >= length - period)
+            return false;
+
+        // giống iBB: mean +- stdDev * độ lệch chuẩn tổng thể
+        PrefixSum ps = getPrefixSum(OpCode::CLOSE);
+        double mean = ps.mean(shift, shift + period - 1);
+        double std = sqrt(ps.variance(shift, shift + period - 1));
+        result = ins.op == OpCode::BB_UPPER ? mean + stdDev * std : ins.op == OpCode::BB_MIDDLE ? mean
+                                                                                                : mean - stdDev * std;
+        return true;
     }
-    return cached[shift * 3 + 2];
-}
 
-any Expr::visitBb_upper(ExprParser::Bb_upperContext *ctx)
-{
-    int period = stoi(ctx->INT(0)->getText());
-    double stdDev = stod(ctx->number()->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+    case OpCode::MACD_N_DINH:
+    {
+        int fastPeriod = args[0], slowPeriod = args[1], signalPeriod = args[2];
+        int redDepth = args[3], depth = args[4], enableDivergence = args[5], shift = args[6];
+        double diffCandle0 = ins.number;
+
+        if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || redDepth < 0 || depth < 0 || enableDivergence < 0 || diffCandle0 < 0 || shift < 0 || shift >= length - slowPeriod)
+            return false;
+
+        // cùng bộ tham số (kể cả shift) chỉ quét 1 lần mỗi snapshot
+        long long key = hashedCacheKey(CacheId::MACD_N_DINH, hashInstruction(ins, args, pool));
+        auto it = cachedIndicator->find(key);
+        PROFILE_CACHE(ProfileCache::INDICATOR, it != cachedIndicator->end());
+        // value[0] là kết quả, sau đó là lệnh
+        if (it != cachedIndicator->end() && sameInstruction(it->second.data() + 1, it->second.size() - 1, ins, args, pool))
+        {
+            result = it->second[0];
+            return true;
+        }
 
-    if (period <= 0 || stdDev <= 0 || shift < 0 || shift >= length - period)
-        return {};
+        // như iMACDs: chỉ tính trên MAX_N + slowPeriod nến tính từ shift
+        const ArenaVector &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
+        int count = min((int)cachedMACD.size() / 3 - shift, MAX_N + slowPeriod - 1);
+        if (count <= 0)
+            return false;
 
-    return iBB(period, stdDev, close + shift, length - shift).upper;
-}
+        result = macd_n_dinh(cachedMACD.data() + shift * 3, count, redDepth, depth, enableDivergence, diffCandle0, pool + ins.poolOffset, ins.poolSize, close + shift, open + shift, high + shift);
 
-any Expr::visitBb_middle(ExprParser::Bb_middleContext *ctx)
-{
-    int period = stoi(ctx->INT(0)->getText());
-    double stdDev = stod(ctx->number()->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+        // trùng hash với lệnh khác thì không cache, giữ entry cũ
+        if (it == cachedIndicator->end())
+        {
+            ArenaVector value = arenaVector();
+            value.push_back(result);
+            appendInstruction(value, ins, args, pool);
+            cachedIndicator->emplace(key, move(value));
+        }
+        return true;
+    }
 
-    if (period <= 0 || stdDev <= 0 || shift < 0 || shift >= length - period)
-        return {};
+    case OpCode::MACD_SLOPE:
+    {
+        int fastPeriod = args[0], slowPeriod = args[1], signalPeriod = args[2], shift = args[3];
+        if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || shift < 0 || shift >= length - slowPeriod - 1)
+            return false;
 
-    return iBB(period, stdDev, close + shift, length - shift).middle;
-}
+        const ArenaVector &slope = getMACDSlope(fastPeriod, slowPeriod, signalPeriod);
+        result = (size_t)shift < slope.size() ? slope[shift] : macd_slope(fastPeriod, slowPeriod, signalPeriod, close + shift, length - shift);
+        return true;
+    }
 
-any Expr::visitBb_lower(ExprParser::Bb_lowerContext *ctx)
-{
-    int period = stoi(ctx->INT(0)->getText());
-    double stdDev = stod(ctx->number()->getText());
-    int shift = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+    case OpCode::AVG_OPEN:
+    case OpCode::AVG_HIGH:
+    case OpCode::AVG_LOW:
+    case OpCode::AVG_CLOSE:
+    case OpCode::AVG_AMPL:
+    case OpCode::AVG_AMPL_P:
+    case OpCode::MIN_OPEN:
+    case OpCode::MIN_HIGH:
+    case OpCode::MIN_LOW:
+    case OpCode::MIN_CLOSE:
+    case OpCode::MIN_CHANGE:
+    case OpCode::MIN_CHANGE_P:
+    case OpCode::MIN_AMPL:
+    case OpCode::MIN_AMPL_P:
+    case OpCode::MAX_OPEN:
+    case OpCode::MAX_HIGH:
+    case OpCode::MAX_LOW:
+    case OpCode::MAX_CLOSE:
+    case OpCode::MAX_CHANGE:
+    case OpCode::MAX_CHANGE_P:
+    case OpCode::MAX_AMPL:
+    case OpCode::MAX_AMPL_P:
+    {
+        // from <= to đã được sắp lúc compile
+        int from = args[0], to = args[1];
+        if (from < 0 || to >= length)
+            return false;
 
-    if (period <= 0 || stdDev <= 0 || shift < 0 || shift >= length - period)
-        return {};
+        OpCode column;
+        switch (ins.op)
+        {
+        case OpCode::AVG_OPEN:
+        case OpCode::MIN_OPEN:
+        case OpCode::MAX_OPEN:
+            column = OpCode::OPEN;
+            break;
+        case OpCode::AVG_HIGH:
+        case OpCode::MIN_HIGH:
+        case OpCode::MAX_HIGH:
+            column = OpCode::HIGH;
+            break;
+        case OpCode::AVG_LOW:
+        case OpCode::MIN_LOW:
+        case OpCode::MAX_LOW:
+            column = OpCode::LOW;
+            break;
+        case OpCode::AVG_CLOSE:
+        case OpCode::MIN_CLOSE:
+        case OpCode::MAX_CLOSE:
+            column = OpCode::CLOSE;
+            break;
+        case OpCode::MIN_CHANGE:
+        case OpCode::MAX_CHANGE:
+            column = OpCode::CHANGE;
+            break;
+        case OpCode::MIN_CHANGE_P:
+        case OpCode::MAX_CHANGE_P:
+            column = OpCode::CHANGE_P;
+            break;
+        case OpCode::AVG_AMPL:
+        case OpCode::MIN_AMPL:
+        case OpCode::MAX_AMPL:
+            column = OpCode::AMPL;
+            break;
+        default:
+            column = OpCode::AMPL_P;
+            break;
+        }
 
-    return iBB(period, stdDev, close + shift, length - shift).lower;
-}
+        if (ins.op >= OpCode::AVG_OPEN && ins.op <= OpCode::AVG_AMPL_P)
+            result = getPrefixSum(column).mean(from, to);
+        else if (ins.op >= OpCode::MIN_OPEN && ins.op <= OpCode::MIN_AMPL_P)
+            result = getMinMax(column).query_min(from, to);
+        else
+            result = getMinMax(column).query_max(from, to);
+        return true;
+    }
 
-any Expr::visitMacd_n_dinh(ExprParser::Macd_n_dinhContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int redDepth = stoi(ctx->INT(3)->getText());
-    int depth = stoi(ctx->INT(4)->getText());
-    int enableDivergence = stoi(ctx->INT(5)->getText());
-    double diffCandle0 = stod(ctx->number(0)->getText());
-    int shift = ctx->INT(6) ? stoi(ctx->INT(6)->getText()) : 0;
-    vector<double> diffPercents;
-
-    for (int i = 1; ctx->number(i); i++)
+    case OpCode::MIN_RSI:
+    case OpCode::MAX_RSI:
     {
-        diffPercents.push_back(stod(ctx->number(i)->getText()));
+        int period = args[0], from = args[1], to = args[2];
+        if (period <= 0 || from < 0 || to >= length - period)
+            return false;
+
+        ArenaVector &cachedRSI = getRSI(period);
+        if ((size_t)from >= cachedRSI.size() || (size_t)to >= cachedRSI.size())
+            return false;
+
+        RangeQuery &st = getMinMax(cacheKey(CacheId::MIN_MAX_RSI, period), cachedRSI.data(), cachedRSI.size());
+        result = ins.op == OpCode::MIN_RSI ? st.query_min(from, to) : st.query_max(from, to);
+        return true;
     }
 
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || redDepth < 0 || depth < 0 || enableDivergence < 0 || diffCandle0 < 0 || shift < 0 || shift >= length - slowPeriod)
-        return {};
+    case OpCode::MARSI:
+    {
+        int period = args[0], from = args[1], to = args[2];
+        if (period <= 0 || from < 0 || to >= length - period)
+            return false;
 
-    int result = macd_n_dinh(fastPeriod, slowPeriod, signalPeriod, redDepth, depth, enableDivergence, diffCandle0, diffPercents, close + shift, open + shift, high + shift, length - shift);
-    return (double)result;
-}
+        // trung bình RSI của nến from..to, RSI chưa đủ nến thì 0 như iAvgRSI
+        ArenaVector &cachedRSI = getRSI(period);
+        if ((size_t)to >= cachedRSI.size())
+        {
+            result = 0.0;
+            return true;
+        }
 
-any Expr::visitMacd_slope(ExprParser::Macd_slopeContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int shift = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
+        result = getPrefixSum(cacheKey(CacheId::PREFIX_SUM_RSI, period), cachedRSI.data(), cachedRSI.size()).mean(from, to);
+        return true;
+    }
 
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || shift < 0 || shift >= length - slowPeriod - 1)
-        return {};
+    case OpCode::MIN_MACD_VALUE:
+    case OpCode::MAX_MACD_VALUE:
+    case OpCode::AVG_MACD_VALUE:
+    case OpCode::MIN_MACD_SIGNAL:
+    case OpCode::MAX_MACD_SIGNAL:
+    case OpCode::AVG_MACD_SIGNAL:
+    case OpCode::MIN_MACD_HISTOGRAM:
+    case OpCode::MAX_MACD_HISTOGRAM:
+    case OpCode::AVG_MACD_HISTOGRAM:
+    {
+        int fastPeriod = args[0], slowPeriod = args[1], signalPeriod = args[2], from = args[3], to = args[4];
+        if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
+            return false;
+
+        int offset;
+        if (ins.op == OpCode::MIN_MACD_VALUE || ins.op == OpCode::MAX_MACD_VALUE || ins.op == OpCode::AVG_MACD_VALUE)
+            offset = 0;
+        else if (ins.op == OpCode::MIN_MACD_SIGNAL || ins.op == OpCode::MAX_MACD_SIGNAL || ins.op == OpCode::AVG_MACD_SIGNAL)
+            offset = 1;
+        else
+            offset = 2;
 
-    return macd_slope(fastPeriod, slowPeriod, signalPeriod, close + shift, length - shift);
-}
+        ArenaVector &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
+        if ((size_t)(from * 3 + offset) >= cachedMACD.size() || (size_t)(to * 3 + offset) >= cachedMACD.size())
+            return false;
 
-any Expr::visitAvg_open(ExprParser::Avg_openContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+        if (ins.op == OpCode::AVG_MACD_VALUE || ins.op == OpCode::AVG_MACD_SIGNAL || ins.op == OpCode::AVG_MACD_HISTOGRAM)
+        {
+            result = getPrefixSumMACD(cacheKey(CacheId::PREFIX_SUM_MACD, fastPeriod, slowPeriod, signalPeriod, offset), cachedMACD, offset).mean(from, to);
+            return true;
+        }
 
-    if (to < from)
-        swap(from, to);
+        RangeQuery &st = getMinMaxMACD(cacheKey(CacheId::MIN_MAX_MACD, fastPeriod, slowPeriod, signalPeriod, offset), cachedMACD, offset);
+        bool isMin = ins.op == OpCode::MIN_MACD_VALUE || ins.op == OpCode::MIN_MACD_SIGNAL || ins.op == OpCode::MIN_MACD_HISTOGRAM;
+        result = isMin ? st.query_min(from, to) : st.query_max(from, to);
+        return true;
+    }
 
-    if (from < 0 || to >= length)
-        return {};
+    case OpCode::HOUR:
+    case OpCode::MINUTE:
+    {
+        long long timestamp_ms = startTime[0];
+        long long seconds = timestamp_ms / 1000;
+        long long seconds_in_day = seconds % 86400;
 
-    int period = to - from + 1;
+        int hour = seconds_in_day / 3600;
+        int minute = (seconds_in_day % 3600) / 60;
 
-    return iAvg(period, open + from, length - from);
-}
+        result = ins.op == OpCode::HOUR ? hour : minute;
+        return true;
+    }
 
-any Expr::visitAvg_high(ExprParser::Avg_highContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+    case OpCode::FUNDING_RATE:
+        result = fundingRate;
+        return true;
+
+    case OpCode::BULLISH_ENGULFING:
+    {
+        int shift = args[0];
+        if (shift + 1 >= length)
+            return false;
+
+        // Nến trước phải là nến đỏ (giảm), nến hiện tại phải là nến xanh (tăng)
+        if (close[shift + 1] >= open[shift + 1] || close[shift] <= open[shift])
+            result = 0.0;
+        else // Thân nến hiện tại phải bao trùm thân nến trước
+            result = (open[shift] < close[shift + 1] && close[shift] > open[shift + 1]) ? 1.0 : 0.0;
+        return true;
+    }
 
-    if (to < from)
-        swap(from, to);
+    case OpCode::BEARISH_ENGULFING:
+    {
+        int shift = args[0];
+        if (shift + 1 >= length)
+            return false;
+
+        // Nến trước phải là nến xanh (tăng), nến hiện tại phải là nến đỏ (giảm)
+        if (close[shift + 1] <= open[shift + 1] || close[shift] >= open[shift])
+            result = 0.0;
+        else // Thân nến hiện tại phải bao trùm thân nến trước
+            result = (open[shift] > close[shift + 1] && close[shift] < open[shift + 1]) ? 1.0 : 0.0;
+        return true;
+    }
 
-    if (from < 0 || to >= length)
-        return {};
+    case OpCode::BULLISH_HAMMER:
+    case OpCode::BEARISH_HAMMER:
+    {
+        int shift = args[0];
+        if (shift >= length)
+            return false;
 
-    int period = to - from + 1;
+        double o = open[shift], c = close[shift], h = high[shift], l = low[shift];
 
-    return iAvg(period, high + from, length - from);
-}
+        if (ins.op == OpCode::BULLISH_HAMMER)
+        {
+            // phải xuất hiện ở cuối xu hướng giảm (đáy của 10 nến gần nhất)
+            double minLow = iMin(10, low + shift, length - shift);
+            if (l > minLow)
+                return false;
+        }
+        else
+        {
+            // phải xuất hiện ở cuối xu hướng tăng (đỉnh của 10 nến gần nhất)
+            double maxHigh = iMax(10, high + shift, length - shift);
+            if (h < maxHigh)
+                return false;
+        }
 
-any Expr::visitAvg_low(ExprParser::Avg_lowContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+        double body = abs(c - o);
+        double lowerWick = min(o, c) - l;
+        double upperWick = h - max(o, c);
 
-    if (to < from)
-        swap(from, to);
+        // Tránh chia cho 0
+        if (body == 0)
+            body = 0.0001;
 
-    if (from < 0 || to >= length)
-        return {};
+        // bóng dưới ≥ 2 * thân và bóng trên nhỏ
+        result = (lowerWick >= 2 * body && upperWick <= body) ? 1.0 : 0.0;
+        return true;
+    }
 
-    int period = to - from + 1;
+    case OpCode::DOJI:
+    {
+        int shift = args[0];
+        if (shift >= length)
+            return false;
+
+        double o = open[shift], c = close[shift], h = high[shift], l = low[shift];
+        double range = h - l;
+        double body = abs(c - o);
+
+        // tránh chia 0 nếu range quá nhỏ
+        if (range == 0)
+            result = 0.0;
+        else // thân nhỏ hơn 10% tổng chiều dài nến => doji
+            result = (body / range <= 0.1) ? 1.0 : 0.0;
+        return true;
+    }
 
-    return iAvg(period, low + from, length - from);
+    default:
+        return false;
+    }
 }
 
-any Expr::visitAvg_close(ExprParser::Avg_closeContext *ctx)
+// hash của lệnh sau khi bỏ shift, chỉ cho các lệnh chỉ đọc nến từ shift trở về trước và có số nến bị chặn
+// (khi đủ nến thì kết quả không phụ thuộc độ dài dữ liệu). rsi, macd, min/max_rsi, min/max_macd tính
+// trên cả series nên không dùng được; nến đơn lẻ thì tính lại còn rẻ hơn tra bảng
+// args là tham số đã chuẩn hóa (shift = 0), dùng để tính hash và so khi tra cứu
+static bool seriesHash(const Instruction &ins, const double *pool, int args[MAX_INSTRUCTION_ARGS], uint64_t &hash, int &shift)
 {
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
+    copy(ins.args, ins.args + MAX_INSTRUCTION_ARGS, args);
 
-    if (from < 0 || to >= length)
-        return {};
+    int shiftArg;
+    switch (ins.op)
+    {
+    case OpCode::MA:
+    case OpCode::EMA:
+    case OpCode::RSI_SLOPE:
+    case OpCode::BB_UPPER:
+    case OpCode::BB_MIDDLE:
+    case OpCode::BB_LOWER:
+        shiftArg = 1;
+        break;
+    case OpCode::MACD_SLOPE:
+        shiftArg = 3;
+        break;
+    case OpCode::MACD_N_DINH:
+        shiftArg = 6;
+        break;
+    case OpCode::BULLISH_HAMMER:
+    case OpCode::BEARISH_HAMMER:
+        shiftArg = 0;
+        break;
+    case OpCode::MARSI:
+        // [from, to] => [shift, độ rộng]
+        args[2] -= args[1];
+        shiftArg = 1;
+        break;
+    case OpCode::AVG_MACD_VALUE:
+    case OpCode::AVG_MACD_SIGNAL:
+    case OpCode::AVG_MACD_HISTOGRAM:
+        args[4] -= args[3];
+        shiftArg = 3;
+        break;
+    default:
+        if (ins.op < OpCode::AVG_OPEN || ins.op > OpCode::MAX_AMPL_P)
+            return false;
+        args[1] -= args[0];
+        shiftArg = 0;
+        break;
+    }
 
-    int period = to - from + 1;
+    shift = args[shiftArg];
+    if (shift < 0)
+        return false;
+    args[shiftArg] = 0;
 
-    return iAvg(period, close + from, length - from);
+    hash = hashInstruction(ins, args, pool);
+    return true;
 }
 
-any Expr::visitAvg_ampl(ExprParser::Avg_amplContext *ctx)
+bool Expr::evalLeafMemo(const Instruction &ins, const double *pool, double &result)
 {
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
+    SeriesKey key;
+    int args[MAX_INSTRUCTION_ARGS];
+    int shift;
+    // chưa đủ nến thì kết quả phụ thuộc độ dài dữ liệu, không dùng lại được
+    if (!seriesMemo || !seriesHash(ins, pool, args, key.hash, shift) || shift > SeriesMemo::MAX_SHIFT || lookback(ins) > length)
+        return evalLeaf(ins, pool, result);
 
-    if (from < 0 || to >= length)
-        return {};
+    key.time = startTime[shift];
 
-    int period = to - from + 1;
+    // shift = 0 là nến vừa đóng, chưa có ở lần trước. Trùng hash với leaf khác thì tính lại và ghi đè
+    if (shift > 0)
+    {
+        const SeriesValue *cached = seriesMemo->find(key);
+        if (cached && sameInstruction(cached->instruction.data(), cached->instruction.size(), ins, args, pool))
+        {
+            PROFILE_CACHE(ProfileCache::SERIES, true);
+            seriesMemo->hits++;
+            result = cached->value;
+            return cached->valid;
+        }
+        seriesMemo->misses++;
+    }
+    PROFILE_CACHE(ProfileCache::SERIES, false);
 
-    return iAvg(period, length - from, [this, from](int i)
-                { return this->high[from + i] - this->low[from + i]; });
+    SeriesValue value;
+    bool valid = evalLeaf(ins, pool, result);
+    value.valid = valid;
+    value.value = result;
+    appendInstruction(value.instruction, ins, args, pool);
+    seriesMemo->store(key, move(value));
+    return valid;
 }
 
-any Expr::visitAvg_amplP(ExprParser::Avg_amplPContext *ctx)
+bool Expr::run(const Program &program, double &result)
 {
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
+    double values[MAX_PROGRAM_STACK];
+    bool valid[MAX_PROGRAM_STACK];
+    int top = 0;
 
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
+    for (const Instruction &ins : program.code)
+    {
+        switch (ins.op)
+        {
+        case OpCode::CONST:
+            values[top] = ins.number;
+            valid[top++] = true;
+            break;
+        case OpCode::STRING:
+            // string nằm trong biểu thức số => không có giá trị
+            values[top] = 0;
+            valid[top++] = false;
+            break;
+        case OpCode::NEG:
+            values[top - 1] = -values[top - 1];
+            break;
+        case OpCode::ABS:
+            values[top - 1] = abs(values[top - 1]);
+            break;
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+        case OpCode::DIV:
+        case OpCode::LT:
+        case OpCode::LE:
+        case OpCode::GT:
+        case OpCode::GE:
+        case OpCode::EQ:
+        case OpCode::MIN:
+        case OpCode::MAX:
+            top--;
+            valid[top - 1] = valid[top - 1] && valid[top];
+            values[top - 1] = applyBinary(ins.op, values[top - 1], values[top]);
+            break;
+        default:
+            values[top] = 0;
+            valid[top] = evalLeafMemo(ins, program.pool.data(), values[top]);
+            top++;
+            break;
+        }
+    }
 
-    return iAvg(period, length - from, [this, from](int i)
-                { return (this->high[from + i] - this->low[from + i]) / this->open[from + i] * 100.0; });
+    result = values[0];
+    return top == 1 && valid[0];
 }
 
-any Expr::visitMin_open(ExprParser::Min_openContext *ctx)
+bool Expr::run(const ExprDag &dag, int id, DagMemo &memo, double &result, const DagMemo *shared)
 {
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
+    if (shared && shared->stamp[id] == shared->epoch)
+    {
+        result = shared->values[id];
+        return shared->valid[id];
+    }
 
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_OPEN;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(open, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-
-any Expr::visitMin_high(ExprParser::Min_highContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_HIGH;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(high, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-any Expr::visitMin_low(ExprParser::Min_lowContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_LOW;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(low, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-any Expr::visitMin_close(ExprParser::Min_closeContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_CLOSE;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(close, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-
-any Expr::visitMin_change(ExprParser::Min_changeContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
-
-    return iMin(period, length - from, [this, from](int i)
-                { return this->close[from + i] - this->open[from + i]; });
-}
-
-any Expr::visitMin_changeP(ExprParser::Min_changePContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
-
-    return iMin(period, length - from, [this, from](int i)
-                { return (this->close[from + i] - this->open[from + i]) / this->open[from + i] * 100.0; });
-}
-
-any Expr::visitMin_ampl(ExprParser::Min_amplContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
-
-    return iMin(period, length - from, [this, from](int i)
-                { return this->high[from + i] - this->low[from + i]; });
-}
-any Expr::visitMin_amplP(ExprParser::Min_amplPContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
-
-    return iMin(period, length - from, [this, from](int i)
-                { return (this->high[from + i] - this->low[from + i]) / this->open[from + i] * 100.0; });
-}
-
-any Expr::visitMax_open(ExprParser::Max_openContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_OPEN;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(open, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_max(from, to);
-}
-
-any Expr::visitMax_high(ExprParser::Max_highContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_HIGH;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(high, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_max(from, to);
-}
-
-any Expr::visitMax_low(ExprParser::Max_lowContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_LOW;
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
+    if (memo.stamp[id] != memo.epoch)
     {
-        auto st = sparseTablePool.acquire();
-        st->init(low, length);
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_max(from, to);
-}
-
-any Expr::visitMax_close(ExprParser::Max_closeContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
+        const DagNode &node = dag.node(id);
+        const Instruction &ins = node.ins;
+        double value = 0;
+        bool valid;
 
-    if (from < 0 || to >= length)
-        return {};
-
-    long long key = ID_MM_CLOSE;
+        if (ins.op == OpCode::CONST)
+        {
+            value = ins.number;
+            valid = true;
+        }
+        else if (ins.op == OpCode::STRING)
+        {
+            valid = false;
+        }
+        else if (node.left < 0)
+        {
+            valid = !shared && evalLeafMemo(ins, dag.poolData(), value);
+        }
+        else
+        {
+            double l, r = 0;
+            valid = run(dag, node.left, memo, l, shared);
+            if (node.right >= 0)
+            {
+                valid = run(dag, node.right, memo, r, shared) && valid;
+            }
 
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(close, length);
+            if (ins.op == OpCode::NEG)
+                value = -l;
+            else if (ins.op == OpCode::ABS)
+                value = abs(l);
+            else
+                value = applyBinary(ins.op, l, r);
+        }
 
-        it = cachedMinMax->emplace(key, move(st)).first;
+        memo.values[id] = value;
+        memo.valid[id] = valid;
+        memo.stamp[id] = memo.epoch;
     }
-    return it->second->query_max(from, to);
-}
-any Expr::visitMax_change(ExprParser::Max_changeContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
 
-    return iMax(period, length - from, [this, from](int i)
-                { return this->close[from + i] - this->open[from + i]; });
+    result = memo.values[id];
+    return memo.valid[id];
 }
 
-any Expr::visitMax_changeP(ExprParser::Max_changePContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
-
-    return iMax(period, length - from, [this, from](int i)
-                { return (this->close[from + i] - this->open[from + i]) / this->open[from + i] * 100.0; });
-}
-
-any Expr::visitMax_ampl(ExprParser::Max_amplContext *ctx)
-{
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (from < 0 || to >= length)
-        return {};
-
-    int period = to - from + 1;
-
-    return iMax(period, length - from, [this, from](int i)
-                { return this->high[from + i] - this->low[from + i]; });
-}
-
-any Expr::visitMax_amplP(ExprParser::Max_amplPContext *ctx)
+//////////////////////////////////////////////////////////////////
+any calculateExpr(const Program &program, const string &broker, const string &symbol, const string &timeframe, int length,
+                  const double *open, const double *high, const double *low, const double *close,
+                  const double *volume, long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax)
 {
-    int from = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 0;
-    int to = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
+    if (program.isString)
+        return program.text;
 
-    if (from < 0 || to >= length)
+    Expr expr(broker, symbol, timeframe, length, open, high, low, close, volume, startTime, fundingRate, cachedIndicator, cachedMinMax);
+    double result;
+    if (!expr.run(program, result))
         return {};
-
-    int period = to - from + 1;
-
-    return iMax(period, length - from, [this, from](int i)
-                { return (this->high[from + i] - this->low[from + i]) / this->open[from + i] * 100.0; });
+    return result;
 }
 
-any Expr::visitMin_rsi(ExprParser::Min_rsiContext *ctx)
+static shared_ptr<const Program> findProgram(const string &inputText)
 {
-    int period = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 14;
-    int from = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-    int to = ctx->INT(2) ? stoi(ctx->INT(2)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (period <= 0 || from < 0 || to >= length - period)
-        return {};
-
-    vector<double> &cachedRSI = getRSI(period);
-    if (from >= cachedRSI.size() || to >= cachedRSI.size())
-    {
-        return {};
-    }
-
-    long long key = ID_MM_RSI | (static_cast<long long>(period) << 10);
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
+    shared_ptr<const Program> program = ExprRegistry::getInstance().find(inputText);
+    if (!program)
     {
-        auto st = sparseTablePool.acquire();
-        st->init(cachedRSI.data(), cachedRSI.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
+        // expr sinh ra lúc chạy (tham số lệnh, telegram), không có trong registry
+        program = compileExpr(ExprRegistry::canonical(inputText));
     }
-    return it->second->query_min(from, to);
+    return program;
 }
 
-any Expr::visitMax_rsi(ExprParser::Max_rsiContext *ctx)
-{
-    int period = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 14;
-    int from = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-    int to = ctx->INT(2) ? stoi(ctx->INT(2)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (period <= 0 || from < 0 || to >= length - period)
-        return {};
-
-    vector<double> &cachedRSI = getRSI(period);
-    if (from >= cachedRSI.size() || to >= cachedRSI.size())
-    {
-        return {};
-    }
-
-    long long key = ID_MM_RSI | (static_cast<long long>(period) << 10);
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        auto st = sparseTablePool.acquire();
-        st->init(cachedRSI.data(), cachedRSI.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_max(from, to);
-}
-
-any Expr::visitMarsi(ExprParser::MarsiContext *ctx)
+any calculateExpr(const string &inputText, const string &broker, const string &symbol, const string &timeframe, int length,
+                  const double *open, const double *high, const double *low, const double *close,
+                  const double *volume, long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax)
 {
-    int period = ctx->INT(0) ? stoi(ctx->INT(0)->getText()) : 14;
-    int from = ctx->INT(1) ? stoi(ctx->INT(1)->getText()) : 0;
-    int to = ctx->INT(2) ? stoi(ctx->INT(2)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (period <= 0 || from < 0 || to >= length - period)
+    shared_ptr<const Program> program = findProgram(inputText);
+    if (!program)
         return {};
 
-    int k = to - from + 1;
-    return iAvgRSI(period, k, close + from, length - from);
+    return calculateExpr(*program, broker, symbol, timeframe, length, open, high, low, close, volume, startTime, fundingRate, cachedIndicator, cachedMinMax);
 }
 
-any Expr::visitMin_macd_value(ExprParser::Min_macd_valueContext *ctx)
+bool inlineSubExpr(const string &expr, string &result)
 {
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    vector<double> &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
-
-    if (from * 3 >= cachedMACD.size() || to * 3 >= cachedMACD.size())
+    result.clear();
+    bool open = false;
+    for (char c : expr)
     {
-        return {};
-    }
-
-    long long key = ID_MM_MACD_VALUE | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        vector<double> v(cachedMACD.size() / 3);
-        for (int i = 0; i < v.size(); ++i)
+        if (c == '{')
         {
-            v[i] = cachedMACD[i * 3];
+            if (open)
+                return false;
+            open = true;
+            result.push_back('(');
         }
-
-        auto st = sparseTablePool.acquire();
-        st->init(v.data(), v.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-
-any Expr::visitMax_macd_value(ExprParser::Max_macd_valueContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    vector<double> &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
-    if (from * 3 >= cachedMACD.size() || to * 3 >= cachedMACD.size())
-    {
-        return {};
-    }
-    long long key = ID_MM_MACD_VALUE | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        vector<double> v(cachedMACD.size() / 3);
-        for (int i = 0; i < v.size(); ++i)
+        else if (c == '}')
         {
-            v[i] = cachedMACD[i * 3];
+            if (!open)
+                return false;
+            open = false;
+            result.push_back(')');
         }
-        auto st = sparseTablePool.acquire();
-        st->init(v.data(), v.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_max(from, to);
-}
-any Expr::visitAvg_macd_value(ExprParser::Avg_macd_valueContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    int k = to - from + 1;
-    return iAvgMACD(fastPeriod, slowPeriod, signalPeriod, k, close + from, length - from, [](MACD_Output output)
-                    { return output.macd; });
-}
-
-any Expr::visitMax_macd_signal(ExprParser::Max_macd_signalContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    vector<double> &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
-    if (from * 3 + 1 >= cachedMACD.size() || to * 3 + 1 >= cachedMACD.size())
-    {
-        return {};
-    }
-    long long key = ID_MM_MACD_SIGNAL | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        vector<double> v(cachedMACD.size() / 3);
-        for (int i = 0; i < v.size(); ++i)
+        else
         {
-            v[i] = cachedMACD[i * 3 + 1];
+            result.push_back(c);
         }
-        auto st = sparseTablePool.acquire();
-        st->init(v.data(), v.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
     }
-    return it->second->query_max(from, to);
+    return !open;
 }
-any Expr::visitMin_macd_signal(ExprParser::Min_macd_signalContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    vector<double> &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
-    if (from * 3 + 1 >= cachedMACD.size() || to * 3 + 1 >= cachedMACD.size())
-    {
-        return {};
-    }
-    long long key = ID_MM_MACD_SIGNAL | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
 
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
+shared_ptr<const MessageTemplate> compileMessageTemplate(const string &text)
+{
+    shared_ptr<MessageTemplate> message = make_shared<MessageTemplate>();
+    string fragment;
+    string slot;
+    bool open = false;
+    for (char c : text)
     {
-        vector<double> v(cachedMACD.size() / 3);
-        for (int i = 0; i < v.size(); ++i)
+        if (c == '{')
         {
-            v[i] = cachedMACD[i * 3 + 1];
+            if (open)
+                return nullptr;
+            open = true;
+            slot.clear();
         }
-        auto st = sparseTablePool.acquire();
-        st->init(v.data(), v.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-any Expr::visitAvg_macd_signal(ExprParser::Avg_macd_signalContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    int k = to - from + 1;
-    return iAvgMACD(fastPeriod, slowPeriod, signalPeriod, k, close + from, length - from, [](MACD_Output output)
-                    { return output.signal; });
-}
-any Expr::visitMin_macd_histogram(ExprParser::Min_macd_histogramContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
+        else if (c == '}')
+        {
+            if (!open || slot.empty())
+                return nullptr;
+            open = false;
 
-    vector<double> &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
-    if (from * 3 + 2 >= cachedMACD.size() || to * 3 + 2 >= cachedMACD.size())
-    {
-        return {};
-    }
-    long long key = ID_MM_MACD_HISTOGRAM | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
+            shared_ptr<const Program> program = ExprRegistry::getInstance().acquire(slot);
+            if (!program)
+                return nullptr;
 
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        vector<double> v(cachedMACD.size() / 3);
-        for (int i = 0; i < v.size(); ++i)
+            message->fragments.push_back(move(fragment));
+            message->slots.push_back(program);
+            fragment.clear();
+        }
+        else if (open)
         {
-            v[i] = cachedMACD[i * 3 + 2];
+            slot.push_back(c);
         }
-        auto st = sparseTablePool.acquire();
-        st->init(v.data(), v.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
-    }
-    return it->second->query_min(from, to);
-}
-any Expr::visitMax_macd_histogram(ExprParser::Max_macd_histogramContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
-
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    vector<double> &cachedMACD = getMACD(fastPeriod, slowPeriod, signalPeriod);
-    if (from * 3 + 2 >= cachedMACD.size() || to * 3 + 2 >= cachedMACD.size())
-    {
-        return {};
-    }
-    long long key = ID_MM_MACD_HISTOGRAM | (static_cast<long long>(fastPeriod) << 10) | (static_cast<long long>(slowPeriod) << 20) | (static_cast<long long>(signalPeriod) << 30);
-
-    auto it = cachedMinMax->find(key);
-    if (it == cachedMinMax->end())
-    {
-        vector<double> v(cachedMACD.size() / 3);
-        for (int i = 0; i < v.size(); ++i)
+        else
         {
-            v[i] = cachedMACD[i * 3 + 2];
+            fragment.push_back(c);
         }
-        auto st = sparseTablePool.acquire();
-        st->init(v.data(), v.size());
-
-        it = cachedMinMax->emplace(key, move(st)).first;
     }
-    return it->second->query_max(from, to);
-}
-
-any Expr::visitAvg_macd_histogram(ExprParser::Avg_macd_histogramContext *ctx)
-{
-    int fastPeriod = stoi(ctx->INT(0)->getText());
-    int slowPeriod = stoi(ctx->INT(1)->getText());
-    int signalPeriod = stoi(ctx->INT(2)->getText());
-    int from = ctx->INT(3) ? stoi(ctx->INT(3)->getText()) : 0;
-    int to = ctx->INT(4) ? stoi(ctx->INT(4)->getText()) : 0;
-
-    if (to < from)
-        swap(from, to);
+    if (open)
+        return nullptr;
 
-    if (fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0 || from < 0 || to >= length - slowPeriod || to >= length - signalPeriod)
-        return {};
-
-    int k = to - from + 1;
-    return iAvgMACD(fastPeriod, slowPeriod, signalPeriod, k, close + from, length - from, [](MACD_Output output)
-                    { return output.histogram; });
+    message->fragments.push_back(move(fragment));
+    return message;
 }
 
-any Expr::visitHour(ExprParser::HourContext *ctx)
+// hour()/minute() in như to_string(int) của code cũ, còn lại như to_string(double)
+static void formatNumber(fmt::memory_buffer &buffer, const Program &program, double value)
 {
-    long long timestamp_ms = startTime[0];
-    long long seconds = timestamp_ms / 1000;
-    long long seconds_in_day = seconds % 86400;
-
-    int hour = seconds_in_day / 3600;
-
-    return hour;
-}
-
-any Expr::visitMinute(ExprParser::MinuteContext *ctx)
-{
-    long long timestamp_ms = startTime[0];
-    long long seconds = timestamp_ms / 1000;
-    long long seconds_in_day = seconds % 86400;
-
-    int hour = seconds_in_day / 3600;
-    int minute = (seconds_in_day % 3600) / 60;
-
-    return minute;
-}
-
-any Expr::visitFunding_rate(ExprParser::Funding_rateContext *ctx)
-{
-    return fundingRate;
+    if (program.isIntegral)
+        fmt::format_to(back_inserter(buffer), "{}", (long long)value);
+    else
+        fmt::format_to(back_inserter(buffer), "{:f}", value);
 }
 
-any Expr::visitBullish_engulfing(ExprParser::Bullish_engulfingContext *ctx)
+bool renderMessageTemplate(const MessageTemplate &message, Expr &expr, fmt::memory_buffer &buffer)
 {
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-
-    if (shift + 1 >= length)
+    buffer.clear();
+    for (size_t i = 0; i < message.slots.size(); i++)
     {
-        return {};
-    }
-
-    // Nến trước phải là nến đỏ (giảm)
-    if (close[shift + 1] >= open[shift + 1])
-        return 0.0;
-
-    // Nến hiện tại phải là nến xanh (tăng)
-    if (close[shift] <= open[shift])
-        return 0.0;
-
-    // Thân nến hiện tại phải bao trùm thân nến trước
-    return (open[shift] < close[shift + 1] && close[shift] > open[shift + 1]) ? 1.0 : 0.0;
-}
-any Expr::visitBearish_engulfing(ExprParser::Bearish_engulfingContext *ctx)
-{
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-
-    if (shift + 1 >= length)
-    {
-        return {};
-    }
-
-    // Nến trước phải là nến xanh (tăng)
-    if (close[shift + 1] <= open[shift + 1])
-        return 0.0;
-
-    // Nến hiện tại phải là nến đỏ (giảm)
-    if (close[shift] >= open[shift])
-        return 0.0;
-
-    // Thân nến hiện tại phải bao trùm thân nến trước
-    return (open[shift] > close[shift + 1] && close[shift] < open[shift + 1]) ? 1.0 : 0.0;
-}
+        const string &fragment = message.fragments[i];
+        buffer.append(fragment.data(), fragment.data() + fragment.size());
+        buffer.push_back(' ');
 
-any Expr::visitBullish_hammer(ExprParser::Bullish_hammerContext *ctx)
-{
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-
-    if (shift >= length)
-        return {};
-
-    double o = open[shift], c = close[shift], h = high[shift], l = low[shift];
-
-    // phải xuất hiện ở cuối xu hướng giảm (đáy của 10 nến gần nhất)
-    double minLow = iMin(10, low + shift, length - shift);
-    if (l > minLow)
-        return {};
-
-    double body = abs(c - o);
-    double lowerWick = min(o, c) - l;
-    double upperWick = h - max(o, c);
-
-    // Tránh chia cho 0
-    if (body == 0)
-        body = 0.0001;
-
-    // bóng dưới ≥ 2 * thân và bóng trên nhỏ
-    return (lowerWick >= 2 * body && upperWick <= body) ? 1.0 : 0.0;
-}
-
-any Expr::visitBearish_hammer(ExprParser::Bearish_hammerContext *ctx)
-{
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-
-    if (shift >= length)
-        return {};
-
-    double o = open[shift], c = close[shift], h = high[shift], l = low[shift];
-
-    // phải xuất hiện ở cuối xu hướng tăng (đỉnh của 10 nến gần nhất)
-    double maxHigh = iMax(10, high + shift, length - shift);
-    if (h < maxHigh)
-        return {};
-
-    double body = abs(c - o);
-    double lowerWick = min(o, c) - l;
-    double upperWick = h - max(o, c);
-
-    // Tránh chia cho 0
-    if (body == 0)
-        body = 0.0001;
-
-    // bóng dưới ≥ 2 * thân và bóng trên nhỏ
-    return (lowerWick >= 2 * body && upperWick <= body) ? 1.0 : 0.0;
-}
-
-any Expr::visitDoji(ExprParser::DojiContext *ctx)
-{
-    auto args = ctx->INT();
-    int shift = args ? stoi(args->getText()) : 0;
-
-    if (shift >= length)
-        return {};
-
-    double o = open[shift], c = close[shift], h = high[shift], l = low[shift];
-    double range = h - l;
-    double body = abs(c - o);
-
-    // tránh chia 0 nếu range quá nhỏ
-    if (range == 0)
-        return 0.0;
-
-    // thân nhỏ hơn 10% tổng chiều dài nến => doji
-    return (body / range <= 0.1) ? 1.0 : 0.0;
-}
-
-//////////////////////////////////////////////////////////////////
-static unordered_map<long long, cachedIndicatorParseTree> parseCache;
-
-void cacheParseTree(const string &expr)
-{
-    long long key = hashString(expr);
-    auto it = parseCache.find(key);
-    if (it != parseCache.end() && it->second.tree)
-        return;
+        const Program &program = *message.slots[i];
+        if (program.isString)
+        {
+            buffer.append(program.text.data(), program.text.data() + program.text.size());
+            continue;
+        }
 
-    auto &entry = parseCache[key];
-    if (!entry.tree)
-    {
-        entry.input = make_unique<ANTLRInputStream>(expr);
-        entry.lexer = make_unique<ExprLexer>(entry.input.get());
-        entry.tokens = make_unique<CommonTokenStream>(entry.lexer.get());
-        entry.parser = make_unique<ExprParser>(entry.tokens.get());
-        entry.tree = entry.parser->expr();
+        double value;
+        if (!expr.run(program, value))
+            return false;
+        formatNumber(buffer, program, value);
     }
-}
-
-any calculateExpr(const string &inputText, const string &broker, const string &symbol, const string &timeframe, int length,
-                  const double *open, const double *high, const double *low, const double *close,
-                  const double *volume, long long *startTime, double fundingRate, unordered_map<long long, vector<double>> *cachedIndicator, unordered_map<long long, unique_ptr<SparseTable>> *cachedMinMax)
-{
-    const string text = toLowerCase(inputText);
-    const long long key = hashString(text);
-    Expr expr(broker, symbol, timeframe, length, open, high, low, close, volume, startTime, fundingRate, cachedIndicator, cachedMinMax);
 
-    auto it = parseCache.find(key);
-    if (it != parseCache.end() && it->second.tree)
-    {
-        return expr.visit(it->second.tree);
-    }
-    else
-    {
-        ANTLRInputStream input(text);
-        ExprLexer lexer(&input);
-        CommonTokenStream tokens(&lexer);
-        ExprParser parser(&tokens);
-        antlr4::tree::ParseTree *tree = parser.expr();
-        return expr.visit(tree);
-    }
+    const string &last = message.fragments.back();
+    buffer.append(last.data(), last.data() + last.size());
+    return true;
 }
 
 string calculateSubExpr(string &expr, const string &broker, const string &symbol, const string &timeframe, int length,
                         const double *open, const double *high, const double *low, const double *close,
-                        const double *volume, long long *startTime, double fundingRate, unordered_map<long long, vector<double>> *cachedIndicator, unordered_map<long long, unique_ptr<SparseTable>> *cachedMinMax)
+                        const double *volume, long long *startTime, double fundingRate, unordered_map<long long, ArenaVector> *cachedIndicator, unordered_map<long long, RangeQuery *> *cachedMinMax)
 {
     stack<string> st;
     string s;
@@ -1477,11 +1200,14 @@ string calculateSubExpr(string &expr, const string &broker, const string &symbol
             }
             string lastS = st.top();
             st.pop();
-            any result = calculateExpr(s, broker, symbol, timeframe, length, open, high, low, close, volume, startTime, fundingRate, cachedIndicator, cachedMinMax);
+            shared_ptr<const Program> program = findProgram(s);
+            any result = program ? calculateExpr(*program, broker, symbol, timeframe, length, open, high, low, close, volume, startTime, fundingRate, cachedIndicator, cachedMinMax) : any();
             s = lastS + " ";
             if (result.type() == typeid(double))
             {
-                s += to_string(any_cast<double>(result));
+                fmt::memory_buffer buffer;
+                formatNumber(buffer, *program, any_cast<double>(result));
+                s.append(buffer.data(), buffer.size());
             }
             else if (result.type() == typeid(int))
             {
@@ -0,0 +1,660 @@
+#include "expr_compiler.h"
+#include "expr_pratt.h"
+
+static int intArg(antlr4::tree::TerminalNode *node, int defaultValue = 0)
+{
+    return node ? stoi(node->getText()) : defaultValue;
+}
+
+void ExprCompiler::emit(const Instruction &ins)
+{
+    if (isLeaf(ins.op))
+    {
+        depth++;
+        program.maxStack = max(program.maxStack, depth);
+        if (depth > MAX_PROGRAM_STACK)
+            throw runtime_error("Expression too deep");
+    }
+    else if (ins.op != OpCode::NEG && ins.op != OpCode::ABS)
+    {
+        depth--;
+    }
+    program.code.push_back(ins);
+}
+
+void ExprCompiler::emitOp(OpCode op, initializer_list<int> args, double number)
+{
+    Instruction ins;
+    ins.op = op;
+    int i = 0;
+    for (int arg : args)
+    {
+        ins.args[i++] = arg;
+    }
+    ins.number = number;
+    emit(ins);
+}
+
+void ExprCompiler::emitExpr(ExprParser::ExprContext *ctx)
+{
+    if (!ctx)
+        throw runtime_error("Missing operand");
+    visit(ctx);
+}
+
+void ExprCompiler::emitBinary(OpCode op, ExprParser::ExprContext *left, ExprParser::ExprContext *right)
+{
+    emitExpr(left);
+    emitExpr(right);
+    emitOp(op, {});
+}
+
+void ExprCompiler::emitRange(OpCode op, antlr4::tree::TerminalNode *fromNode, antlr4::tree::TerminalNode *toNode)
+{
+    int from = intArg(fromNode);
+    int to = intArg(toNode);
+    if (to < from)
+        swap(from, to);
+    emitOp(op, {from, to});
+}
+
+any ExprCompiler::visitFloat(ExprParser::FloatContext *ctx)
+{
+    emitOp(OpCode::CONST, {}, stod(ctx->FLOAT()->getText()));
+    return {};
+}
+
+any ExprCompiler::visitInt(ExprParser::IntContext *ctx)
+{
+    emitOp(OpCode::CONST, {}, stod(ctx->INT()->getText()));
+    return {};
+}
+
+any ExprCompiler::visitString(ExprParser::StringContext *ctx)
+{
+    program.text = ctx->STRING()->getText();
+    emitOp(OpCode::STRING, {});
+    return {};
+}
+
+any ExprCompiler::visitNegative(ExprParser::NegativeContext *ctx)
+{
+    emitExpr(ctx->expr());
+    emitOp(OpCode::NEG, {});
+    return {};
+}
+
+any ExprCompiler::visitPositive(ExprParser::PositiveContext *ctx)
+{
+    emitExpr(ctx->expr());
+    return {};
+}
+
+any ExprCompiler::visitMulDiv(ExprParser::MulDivContext *ctx)
+{
+    emitBinary(ctx->children[1]->getText() == "*" ? OpCode::MUL : OpCode::DIV, ctx->expr(0), ctx->expr(1));
+    return {};
+}
+
+any ExprCompiler::visitAddSub(ExprParser::AddSubContext *ctx)
+{
+    emitBinary(ctx->children[1]->getText() == "+" ? OpCode::ADD : OpCode::SUB, ctx->expr(0), ctx->expr(1));
+    return {};
+}
+
+any ExprCompiler::visitComparison(ExprParser::ComparisonContext *ctx)
+{
+    string op = ctx->comparisonOp()->getText();
+
+    OpCode code;
+    if (op == "==" || op == "=")
+        code = OpCode::EQ;
+    else if (op == "<")
+        code = OpCode::LT;
+    else if (op == "<=")
+        code = OpCode::LE;
+    else if (op == ">")
+        code = OpCode::GT;
+    else if (op == ">=")
+        code = OpCode::GE;
+    else
+        throw runtime_error("Unknown comparison " + op);
+
+    emitBinary(code, ctx->expr(0), ctx->expr(1));
+    return {};
+}
+
+any ExprCompiler::visitParens(ExprParser::ParensContext *ctx)
+{
+    emitExpr(ctx->expr());
+    return {};
+}
+
+any ExprCompiler::visitABS(ExprParser::ABSContext *ctx)
+{
+    emitExpr(ctx->expr());
+    emitOp(OpCode::ABS, {});
+    return {};
+}
+
+any ExprCompiler::visitMIN(ExprParser::MINContext *ctx)
+{
+    auto args = ctx->expr();
+    emitExpr(args.empty() ? nullptr : args[0]);
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        emitExpr(args[i]);
+        emitOp(OpCode::MIN, {});
+    }
+    return {};
+}
+
+any ExprCompiler::visitMAX(ExprParser::MAXContext *ctx)
+{
+    auto args = ctx->expr();
+    emitExpr(args.empty() ? nullptr : args[0]);
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        emitExpr(args[i]);
+        emitOp(OpCode::MAX, {});
+    }
+    return {};
+}
+
+any ExprCompiler::visitOpen(ExprParser::OpenContext *ctx)
+{
+    emitOp(OpCode::OPEN, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitHigh(ExprParser::HighContext *ctx)
+{
+    emitOp(OpCode::HIGH, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitLow(ExprParser::LowContext *ctx)
+{
+    emitOp(OpCode::LOW, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitClose(ExprParser::CloseContext *ctx)
+{
+    emitOp(OpCode::CLOSE, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitVolume(ExprParser::VolumeContext *ctx)
+{
+    emitOp(OpCode::VOLUME, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitChange(ExprParser::ChangeContext *ctx)
+{
+    emitOp(OpCode::CHANGE, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitChangeP(ExprParser::ChangePContext *ctx)
+{
+    emitOp(OpCode::CHANGE_P, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitAmpl(ExprParser::AmplContext *ctx)
+{
+    emitOp(OpCode::AMPL, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitAmplP(ExprParser::AmplPContext *ctx)
+{
+    emitOp(OpCode::AMPL_P, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitUpper_shadow(ExprParser::Upper_shadowContext *ctx)
+{
+    emitOp(OpCode::UPPER_SHADOW, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitUpper_shadowP(ExprParser::Upper_shadowPContext *ctx)
+{
+    emitOp(OpCode::UPPER_SHADOW_P, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitLower_shadow(ExprParser::Lower_shadowContext *ctx)
+{
+    emitOp(OpCode::LOWER_SHADOW, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitLower_shadowP(ExprParser::Lower_shadowPContext *ctx)
+{
+    emitOp(OpCode::LOWER_SHADOW_P, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitRsi(ExprParser::RsiContext *ctx)
+{
+    emitOp(OpCode::RSI, {intArg(ctx->INT(0)), intArg(ctx->INT(1))});
+    return {};
+}
+
+any ExprCompiler::visitRsi_slope(ExprParser::Rsi_slopeContext *ctx)
+{
+    emitOp(OpCode::RSI_SLOPE, {intArg(ctx->INT(0)), intArg(ctx->INT(1))});
+    return {};
+}
+
+any ExprCompiler::visitMa(ExprParser::MaContext *ctx)
+{
+    emitOp(OpCode::MA, {intArg(ctx->INT(0)), intArg(ctx->INT(1))});
+    return {};
+}
+
+any ExprCompiler::visitEma(ExprParser::EmaContext *ctx)
+{
+    emitOp(OpCode::EMA, {intArg(ctx->INT(0)), intArg(ctx->INT(1))});
+    return {};
+}
+
+any ExprCompiler::visitMacd_value(ExprParser::Macd_valueContext *ctx)
+{
+    emitOp(OpCode::MACD_VALUE, {intArg(ctx->INT(0)), intArg(ctx->INT(1)), intArg(ctx->INT(2)), intArg(ctx->INT(3))});
+    return {};
+}
+
+any ExprCompiler::visitMacd_signal(ExprParser::Macd_signalContext *ctx)
+{
+    emitOp(OpCode::MACD_SIGNAL, {intArg(ctx->INT(0)), intArg(ctx->INT(1)), intArg(ctx->INT(2)), intArg(ctx->INT(3))});
+    return {};
+}
+
+any ExprCompiler::visitMacd_histogram(ExprParser::Macd_histogramContext *ctx)
+{
+    emitOp(OpCode::MACD_HISTOGRAM, {intArg(ctx->INT(0)), intArg(ctx->INT(1)), intArg(ctx->INT(2)), intArg(ctx->INT(3))});
+    return {};
+}
+
+any ExprCompiler::visitBb_upper(ExprParser::Bb_upperContext *ctx)
+{
+    emitOp(OpCode::BB_UPPER, {intArg(ctx->INT(0)), intArg(ctx->INT(1))}, stod(ctx->number()->getText()));
+    return {};
+}
+
+any ExprCompiler::visitBb_middle(ExprParser::Bb_middleContext *ctx)
+{
+    emitOp(OpCode::BB_MIDDLE, {intArg(ctx->INT(0)), intArg(ctx->INT(1))}, stod(ctx->number()->getText()));
+    return {};
+}
+
+any ExprCompiler::visitBb_lower(ExprParser::Bb_lowerContext *ctx)
+{
+    emitOp(OpCode::BB_LOWER, {intArg(ctx->INT(0)), intArg(ctx->INT(1))}, stod(ctx->number()->getText()));
+    return {};
+}
+
+any ExprCompiler::visitMacd_n_dinh(ExprParser::Macd_n_dinhContext *ctx)
+{
+    Instruction ins;
+    ins.op = OpCode::MACD_N_DINH;
+    for (int i = 0; i < MAX_INSTRUCTION_ARGS; i++)
+    {
+        ins.args[i] = intArg(ctx->INT(i));
+    }
+    ins.number = stod(ctx->number(0)->getText());
+    ins.poolOffset = program.pool.size();
+    for (int i = 1; ctx->number(i); i++)
+    {
+        program.pool.push_back(stod(ctx->number(i)->getText()));
+    }
+    ins.poolSize = program.pool.size() - ins.poolOffset;
+    emit(ins);
+    return {};
+}
+
+any ExprCompiler::visitMacd_slope(ExprParser::Macd_slopeContext *ctx)
+{
+    emitOp(OpCode::MACD_SLOPE, {intArg(ctx->INT(0)), intArg(ctx->INT(1)), intArg(ctx->INT(2)), intArg(ctx->INT(3))});
+    return {};
+}
+
+any ExprCompiler::visitAvg_open(ExprParser::Avg_openContext *ctx)
+{
+    emitRange(OpCode::AVG_OPEN, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitAvg_high(ExprParser::Avg_highContext *ctx)
+{
+    emitRange(OpCode::AVG_HIGH, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitAvg_low(ExprParser::Avg_lowContext *ctx)
+{
+    emitRange(OpCode::AVG_LOW, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitAvg_close(ExprParser::Avg_closeContext *ctx)
+{
+    emitRange(OpCode::AVG_CLOSE, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitAvg_ampl(ExprParser::Avg_amplContext *ctx)
+{
+    emitRange(OpCode::AVG_AMPL, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitAvg_amplP(ExprParser::Avg_amplPContext *ctx)
+{
+    emitRange(OpCode::AVG_AMPL_P, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_open(ExprParser::Min_openContext *ctx)
+{
+    emitRange(OpCode::MIN_OPEN, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_high(ExprParser::Min_highContext *ctx)
+{
+    emitRange(OpCode::MIN_HIGH, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_low(ExprParser::Min_lowContext *ctx)
+{
+    emitRange(OpCode::MIN_LOW, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_close(ExprParser::Min_closeContext *ctx)
+{
+    emitRange(OpCode::MIN_CLOSE, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_change(ExprParser::Min_changeContext *ctx)
+{
+    emitRange(OpCode::MIN_CHANGE, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_changeP(ExprParser::Min_changePContext *ctx)
+{
+    emitRange(OpCode::MIN_CHANGE_P, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_ampl(ExprParser::Min_amplContext *ctx)
+{
+    emitRange(OpCode::MIN_AMPL, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMin_amplP(ExprParser::Min_amplPContext *ctx)
+{
+    emitRange(OpCode::MIN_AMPL_P, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_open(ExprParser::Max_openContext *ctx)
+{
+    emitRange(OpCode::MAX_OPEN, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_high(ExprParser::Max_highContext *ctx)
+{
+    emitRange(OpCode::MAX_HIGH, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_low(ExprParser::Max_lowContext *ctx)
+{
+    emitRange(OpCode::MAX_LOW, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_close(ExprParser::Max_closeContext *ctx)
+{
+    emitRange(OpCode::MAX_CLOSE, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_change(ExprParser::Max_changeContext *ctx)
+{
+    emitRange(OpCode::MAX_CHANGE, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_changeP(ExprParser::Max_changePContext *ctx)
+{
+    emitRange(OpCode::MAX_CHANGE_P, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_ampl(ExprParser::Max_amplContext *ctx)
+{
+    emitRange(OpCode::MAX_AMPL, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+any ExprCompiler::visitMax_amplP(ExprParser::Max_amplPContext *ctx)
+{
+    emitRange(OpCode::MAX_AMPL_P, ctx->INT(0), ctx->INT(1));
+    return {};
+}
+
+static void rsiRangeArgs(antlr4::tree::TerminalNode *periodNode, antlr4::tree::TerminalNode *fromNode, antlr4::tree::TerminalNode *toNode, int &period, int &from, int &to)
+{
+    period = intArg(periodNode, 14);
+    from = intArg(fromNode);
+    to = intArg(toNode);
+    if (to < from)
+        swap(from, to);
+}
+
+any ExprCompiler::visitMin_rsi(ExprParser::Min_rsiContext *ctx)
+{
+    int period, from, to;
+    rsiRangeArgs(ctx->INT(0), ctx->INT(1), ctx->INT(2), period, from, to);
+    emitOp(OpCode::MIN_RSI, {period, from, to});
+    return {};
+}
+
+any ExprCompiler::visitMax_rsi(ExprParser::Max_rsiContext *ctx)
+{
+    int period, from, to;
+    rsiRangeArgs(ctx->INT(0), ctx->INT(1), ctx->INT(2), period, from, to);
+    emitOp(OpCode::MAX_RSI, {period, from, to});
+    return {};
+}
+
+any ExprCompiler::visitMarsi(ExprParser::MarsiContext *ctx)
+{
+    int period, from, to;
+    rsiRangeArgs(ctx->INT(0), ctx->INT(1), ctx->INT(2), period, from, to);
+    emitOp(OpCode::MARSI, {period, from, to});
+    return {};
+}
+
+static void macdRangeArgs(const vector<antlr4::tree::TerminalNode *> &ints, int args[5])
+{
+    for (int i = 0; i < 5; i++)
+    {
+        args[i] = (size_t)i < ints.size() ? stoi(ints[i]->getText()) : 0;
+    }
+    if (args[4] < args[3])
+        swap(args[3], args[4]);
+}
+
+any ExprCompiler::visitMin_macd_value(ExprParser::Min_macd_valueContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::MIN_MACD_VALUE, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitMax_macd_value(ExprParser::Max_macd_valueContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::MAX_MACD_VALUE, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitAvg_macd_value(ExprParser::Avg_macd_valueContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::AVG_MACD_VALUE, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitMin_macd_signal(ExprParser::Min_macd_signalContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::MIN_MACD_SIGNAL, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitMax_macd_signal(ExprParser::Max_macd_signalContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::MAX_MACD_SIGNAL, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitAvg_macd_signal(ExprParser::Avg_macd_signalContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::AVG_MACD_SIGNAL, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitMin_macd_histogram(ExprParser::Min_macd_histogramContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::MIN_MACD_HISTOGRAM, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitMax_macd_histogram(ExprParser::Max_macd_histogramContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::MAX_MACD_HISTOGRAM, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitAvg_macd_histogram(ExprParser::Avg_macd_histogramContext *ctx)
+{
+    int a[5];
+    macdRangeArgs(ctx->INT(), a);
+    emitOp(OpCode::AVG_MACD_HISTOGRAM, {a[0], a[1], a[2], a[3], a[4]});
+    return {};
+}
+
+any ExprCompiler::visitHour(ExprParser::HourContext *ctx)
+{
+    emitOp(OpCode::HOUR, {});
+    return {};
+}
+
+any ExprCompiler::visitMinute(ExprParser::MinuteContext *ctx)
+{
+    emitOp(OpCode::MINUTE, {});
+    return {};
+}
+
+any ExprCompiler::visitFunding_rate(ExprParser::Funding_rateContext *ctx)
+{
+    emitOp(OpCode::FUNDING_RATE, {});
+    return {};
+}
+
+any ExprCompiler::visitBullish_engulfing(ExprParser::Bullish_engulfingContext *ctx)
+{
+    emitOp(OpCode::BULLISH_ENGULFING, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitBearish_engulfing(ExprParser::Bearish_engulfingContext *ctx)
+{
+    emitOp(OpCode::BEARISH_ENGULFING, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitBullish_hammer(ExprParser::Bullish_hammerContext *ctx)
+{
+    emitOp(OpCode::BULLISH_HAMMER, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitBearish_hammer(ExprParser::Bearish_hammerContext *ctx)
+{
+    emitOp(OpCode::BEARISH_HAMMER, {intArg(ctx->INT())});
+    return {};
+}
+
+any ExprCompiler::visitDoji(ExprParser::DojiContext *ctx)
+{
+    emitOp(OpCode::DOJI, {intArg(ctx->INT())});
+    return {};
+}
+
+shared_ptr<Program> compileExprAntlr(const string &text)
+{
+    try
+    {
+        ANTLRInputStream input(text);
+        ExprLexer lexer(&input);
+        CommonTokenStream tokens(&lexer);
+        ExprParser parser(&tokens);
+        ExprParser::ExprContext *tree = parser.expr();
+
+        auto program = make_shared<Program>();
+        ExprCompiler compiler(*program);
+        compiler.visit(tree);
+        if (program->code.empty())
+            return nullptr;
+        program->isString = program->code.size() == 1 && program->code[0].op == OpCode::STRING;
+        return program;
+    }
+    catch (const exception &e)
+    {
+        LOGE("Compile expr error: {}. expr={}", e.what(), text);
+        return nullptr;
+    }
+}
+
+shared_ptr<Program> compileExpr(const string &text)
+{
+    shared_ptr<Program> program = make_shared<Program>();
+    if (!prattCompile(text, *program))
+        program = compileExprAntlr(text);
+
+    if (program)
+    {
+        program->lookback = lookback(*program);
+        OpCode root = program->code.back().op;
+        program->isIntegral = root == OpCode::HOUR || root == OpCode::MINUTE;
+    }
+    return program;
+}
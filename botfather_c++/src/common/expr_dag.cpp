@@ -0,0 +1,101 @@
+#include "expr_dag.h"
+
+template <typename T>
+static void appendKey(string &key, const T &value)
+{
+    key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// không có MIN/MAX: với NaN applyBinary trả về r, đổi chỗ 2 vế sẽ đổi kết quả
+static bool isCommutative(OpCode op)
+{
+    return op == OpCode::ADD || op == OpCode::MUL || op == OpCode::EQ;
+}
+
+int ExprDag::intern(DagNode &node, const vector<double> &programPool)
+{
+    Instruction &ins = node.ins;
+
+    // gộp hằng số
+    if (node.left >= 0 && nodes[node.left].ins.op == OpCode::CONST && (node.right < 0 || nodes[node.right].ins.op == OpCode::CONST))
+    {
+        double l = nodes[node.left].ins.number;
+        double value;
+        if (ins.op == OpCode::NEG)
+            value = -l;
+        else if (ins.op == OpCode::ABS)
+            value = abs(l);
+        else
+            value = applyBinary(ins.op, l, nodes[node.right].ins.number);
+
+        ins = Instruction();
+        ins.op = OpCode::CONST;
+        ins.number = value;
+        node.left = node.right = -1;
+    }
+
+    // a > b => b < a, a >= b => b <= a
+    if (ins.op == OpCode::GT || ins.op == OpCode::GE)
+    {
+        ins.op = ins.op == OpCode::GT ? OpCode::LT : OpCode::LE;
+        swap(node.left, node.right);
+    }
+    if (isCommutative(ins.op) && node.left > node.right)
+    {
+        swap(node.left, node.right);
+    }
+
+    string key;
+    appendKey(key, ins.op);
+    appendKey(key, ins.args);
+    appendKey(key, ins.number);
+    appendKey(key, node.left);
+    appendKey(key, node.right);
+    for (int i = 0; i < ins.poolSize; i++)
+    {
+        appendKey(key, programPool[ins.poolOffset + i]);
+    }
+
+    auto it = index.find(key);
+    if (it != index.end())
+        return it->second;
+
+    if (ins.poolSize > 0)
+    {
+        int offset = pool.size();
+        pool.insert(pool.end(), programPool.begin() + ins.poolOffset, programPool.begin() + ins.poolOffset + ins.poolSize);
+        ins.poolOffset = offset;
+    }
+
+    int id = nodes.size();
+    nodes.push_back(node);
+    index.emplace(move(key), id);
+    return id;
+}
+
+int ExprDag::add(const Program &program)
+{
+    if (program.isString)
+        return -1;
+
+    vector<int> st;
+    for (const Instruction &ins : program.code)
+    {
+        DagNode node;
+        node.ins = ins;
+        if (ins.op == OpCode::NEG || ins.op == OpCode::ABS)
+        {
+            node.left = st.back();
+            st.pop_back();
+        }
+        else if (!isLeaf(ins.op))
+        {
+            node.right = st.back();
+            st.pop_back();
+            node.left = st.back();
+            st.pop_back();
+        }
+        st.push_back(intern(node, program.pool));
+    }
+    return st.size() == 1 ? st.back() : -1;
+}
@@ -0,0 +1,587 @@
+#include "expr_pratt.h"
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+// độ ưu tiên theo thứ tự alternative trong Expr.g4 (alternative đứng trước ưu tiên cao hơn)
+static const int PREC_COMPARISON = 1;
+static const int PREC_POSITIVE = 2;
+static const int PREC_NEGATIVE = 3;
+static const int PREC_ADD_SUB = 4;
+static const int PREC_MUL_DIV = 5;
+
+static const int MAX_NESTING = 256;
+
+enum class Token : uint8_t
+{
+    END,
+    ERROR,
+    INT,
+    FLOAT,
+    STRING,
+    LPAREN,
+    RPAREN,
+    COMMA,
+    PLUS,
+    MINUS,
+    STAR,
+    SLASH,
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    ABS,
+    MIN,
+    MAX,
+    FUNCTION,
+};
+
+// dạng tham số của các hàm trong grammar
+enum class ArgKind : uint8_t
+{
+    NONE,        // hour()
+    SHIFT,       // close(INT?)
+    PERIOD,      // rsi(INT (, INT)?)
+    RANGE,       // avg_open(INT (, INT)?), from/to được sắp lại
+    MACD,        // macd_value(INT, INT, INT (, INT)?)
+    BB,          // bb_upper(INT, number (, INT)?)
+    MACD_N_DINH, // macd_n_dinh(INT x6, number, INT (, number)*)
+    RSI_RANGE,   // min_rsi(INT, INT (, INT)?)
+    MACD_RANGE,  // min_macd_value(INT x4 (, INT)?)
+};
+
+struct Function
+{
+    OpCode op;
+    ArgKind kind;
+};
+
+static const unordered_map<string_view, Function> &functionTable()
+{
+    static const unordered_map<string_view, Function> table = {
+        {"hour", {OpCode::HOUR, ArgKind::NONE}},
+        {"minute", {OpCode::MINUTE, ArgKind::NONE}},
+        {"funding_rate", {OpCode::FUNDING_RATE, ArgKind::NONE}},
+
+        {"open", {OpCode::OPEN, ArgKind::SHIFT}},
+        {"high", {OpCode::HIGH, ArgKind::SHIFT}},
+        {"low", {OpCode::LOW, ArgKind::SHIFT}},
+        {"close", {OpCode::CLOSE, ArgKind::SHIFT}},
+        {"volume", {OpCode::VOLUME, ArgKind::SHIFT}},
+        {"change", {OpCode::CHANGE, ArgKind::SHIFT}},
+        {"change%", {OpCode::CHANGE_P, ArgKind::SHIFT}},
+        {"ampl", {OpCode::AMPL, ArgKind::SHIFT}},
+        {"ampl%", {OpCode::AMPL_P, ArgKind::SHIFT}},
+        {"upper_shadow", {OpCode::UPPER_SHADOW, ArgKind::SHIFT}},
+        {"upper_shadow%", {OpCode::UPPER_SHADOW_P, ArgKind::SHIFT}},
+        {"lower_shadow", {OpCode::LOWER_SHADOW, ArgKind::SHIFT}},
+        {"lower_shadow%", {OpCode::LOWER_SHADOW_P, ArgKind::SHIFT}},
+        {"bullish_engulfing", {OpCode::BULLISH_ENGULFING, ArgKind::SHIFT}},
+        {"bearish_engulfing", {OpCode::BEARISH_ENGULFING, ArgKind::SHIFT}},
+        {"bullish_hammer", {OpCode::BULLISH_HAMMER, ArgKind::SHIFT}},
+        {"bearish_hammer", {OpCode::BEARISH_HAMMER, ArgKind::SHIFT}},
+        {"doji", {OpCode::DOJI, ArgKind::SHIFT}},
+
+        {"rsi", {OpCode::RSI, ArgKind::PERIOD}},
+        {"rsi_slope", {OpCode::RSI_SLOPE, ArgKind::PERIOD}},
+        {"ma", {OpCode::MA, ArgKind::PERIOD}},
+        {"ema", {OpCode::EMA, ArgKind::PERIOD}},
+
+        {"macd_value", {OpCode::MACD_VALUE, ArgKind::MACD}},
+        {"macd_signal", {OpCode::MACD_SIGNAL, ArgKind::MACD}},
+        {"macd_histogram", {OpCode::MACD_HISTOGRAM, ArgKind::MACD}},
+        {"macd_slope", {OpCode::MACD_SLOPE, ArgKind::MACD}},
+
+        {"bb_upper", {OpCode::BB_UPPER, ArgKind::BB}},
+        {"bb_middle", {OpCode::BB_MIDDLE, ArgKind::BB}},
+        {"bb_lower", {OpCode::BB_LOWER, ArgKind::BB}},
+
+        {"macd_n_dinh", {OpCode::MACD_N_DINH, ArgKind::MACD_N_DINH}},
+
+        {"avg_open", {OpCode::AVG_OPEN, ArgKind::RANGE}},
+        {"avg_high", {OpCode::AVG_HIGH, ArgKind::RANGE}},
+        {"avg_low", {OpCode::AVG_LOW, ArgKind::RANGE}},
+        {"avg_close", {OpCode::AVG_CLOSE, ArgKind::RANGE}},
+        {"avg_ampl", {OpCode::AVG_AMPL, ArgKind::RANGE}},
+        {"avg_ampl%", {OpCode::AVG_AMPL_P, ArgKind::RANGE}},
+        {"min_open", {OpCode::MIN_OPEN, ArgKind::RANGE}},
+        {"min_high", {OpCode::MIN_HIGH, ArgKind::RANGE}},
+        {"min_low", {OpCode::MIN_LOW, ArgKind::RANGE}},
+        {"min_close", {OpCode::MIN_CLOSE, ArgKind::RANGE}},
+        {"min_change", {OpCode::MIN_CHANGE, ArgKind::RANGE}},
+        {"min_change%", {OpCode::MIN_CHANGE_P, ArgKind::RANGE}},
+        {"min_ampl", {OpCode::MIN_AMPL, ArgKind::RANGE}},
+        {"min_ampl%", {OpCode::MIN_AMPL_P, ArgKind::RANGE}},
+        {"max_open", {OpCode::MAX_OPEN, ArgKind::RANGE}},
+        {"max_high", {OpCode::MAX_HIGH, ArgKind::RANGE}},
+        {"max_low", {OpCode::MAX_LOW, ArgKind::RANGE}},
+        {"max_close", {OpCode::MAX_CLOSE, ArgKind::RANGE}},
+        {"max_change", {OpCode::MAX_CHANGE, ArgKind::RANGE}},
+        {"max_change%", {OpCode::MAX_CHANGE_P, ArgKind::RANGE}},
+        {"max_ampl", {OpCode::MAX_AMPL, ArgKind::RANGE}},
+        {"max_ampl%", {OpCode::MAX_AMPL_P, ArgKind::RANGE}},
+
+        {"min_rsi", {OpCode::MIN_RSI, ArgKind::RSI_RANGE}},
+        {"max_rsi", {OpCode::MAX_RSI, ArgKind::RSI_RANGE}},
+        {"marsi", {OpCode::MARSI, ArgKind::RSI_RANGE}},
+
+        {"min_macd_value", {OpCode::MIN_MACD_VALUE, ArgKind::MACD_RANGE}},
+        {"max_macd_value", {OpCode::MAX_MACD_VALUE, ArgKind::MACD_RANGE}},
+        {"avg_macd_value", {OpCode::AVG_MACD_VALUE, ArgKind::MACD_RANGE}},
+        {"min_macd_signal", {OpCode::MIN_MACD_SIGNAL, ArgKind::MACD_RANGE}},
+        {"max_macd_signal", {OpCode::MAX_MACD_SIGNAL, ArgKind::MACD_RANGE}},
+        {"avg_macd_signal", {OpCode::AVG_MACD_SIGNAL, ArgKind::MACD_RANGE}},
+        {"min_macd_histogram", {OpCode::MIN_MACD_HISTOGRAM, ArgKind::MACD_RANGE}},
+        {"max_macd_histogram", {OpCode::MAX_MACD_HISTOGRAM, ArgKind::MACD_RANGE}},
+        {"avg_macd_histogram", {OpCode::AVG_MACD_HISTOGRAM, ArgKind::MACD_RANGE}},
+    };
+    return table;
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool isWordChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || c == '_';
+}
+
+class PrattParser
+{
+private:
+    const char *p;
+    const char *end;
+    Program &program;
+    int depth = 0;   // số phần tử trên stack của VM
+    int nesting = 0; // độ sâu đệ quy
+
+    Token token;
+    const char *tokenStart;
+    Function function;
+
+    void next()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+
+        tokenStart = p;
+        if (p >= end)
+        {
+            token = Token::END;
+            return;
+        }
+
+        char c = *p;
+        if (isDigit(c) || (c == '-' && p + 1 < end && isDigit(p[1])))
+        {
+            // INT: '-'? [0-9]+, FLOAT: '-'? [0-9]+ '.' [0-9]*
+            const char *q = p + 1;
+            while (q < end && isDigit(*q))
+                q++;
+            token = Token::INT;
+            if (q < end && *q == '.')
+            {
+                q++;
+                while (q < end && isDigit(*q))
+                    q++;
+                token = Token::FLOAT;
+            }
+            p = q;
+            return;
+        }
+
+        if (c == '\'')
+        {
+            const char *q = p + 1;
+            while (q < end && *q != '\'' && *q != '\r' && *q != '\n')
+                q++;
+            if (q >= end || *q != '\'')
+            {
+                token = Token::ERROR;
+                return;
+            }
+            p = q + 1;
+            token = Token::STRING;
+            return;
+        }
+
+        if (isWordChar(c))
+        {
+            const char *q = p;
+            while (q < end && isWordChar(*q))
+                q++;
+            string_view word(p, q - p);
+
+            // 'abs(' 'min(' 'max(' là 1 token
+            if (q < end && *q == '(' && (word == "abs" || word == "min" || word == "max"))
+            {
+                token = word == "abs" ? Token::ABS : word == "min" ? Token::MIN
+                                                                   : Token::MAX;
+                p = q + 1;
+                return;
+            }
+
+            const auto &table = functionTable();
+            if (q < end && *q == '%')
+            {
+                auto it = table.find(string_view(p, q - p + 1));
+                if (it != table.end())
+                {
+                    function = it->second;
+                    token = Token::FUNCTION;
+                    p = q + 1;
+                    return;
+                }
+            }
+
+            auto it = table.find(word);
+            if (it == table.end())
+            {
+                token = Token::ERROR;
+                return;
+            }
+            function = it->second;
+            token = Token::FUNCTION;
+            p = q;
+            return;
+        }
+
+        p++;
+        switch (c)
+        {
+        case '(':
+            token = Token::LPAREN;
+            break;
+        case ')':
+            token = Token::RPAREN;
+            break;
+        case ',':
+            token = Token::COMMA;
+            break;
+        case '+':
+            token = Token::PLUS;
+            break;
+        case '-':
+            token = Token::MINUS;
+            break;
+        case '*':
+            token = Token::STAR;
+            break;
+        case '/':
+            token = Token::SLASH;
+            break;
+        case '<':
+            token = Token::LT;
+            if (p < end && *p == '=')
+            {
+                p++;
+                token = Token::LE;
+            }
+            break;
+        case '>':
+            token = Token::GT;
+            if (p < end && *p == '=')
+            {
+                p++;
+                token = Token::GE;
+            }
+            break;
+        case '=':
+            token = Token::EQ;
+            if (p < end && *p == '=')
+                p++;
+            break;
+        default:
+            token = Token::ERROR;
+            break;
+        }
+    }
+
+    bool expect(Token t)
+    {
+        if (token != t)
+            return false;
+        next();
+        return true;
+    }
+
+    bool emit(const Instruction &ins)
+    {
+        if (isLeaf(ins.op))
+        {
+            if (++depth > MAX_PROGRAM_STACK)
+                return false;
+            program.maxStack = max(program.maxStack, depth);
+        }
+        else if (ins.op != OpCode::NEG && ins.op != OpCode::ABS)
+        {
+            depth--;
+        }
+        program.code.push_back(ins);
+        return true;
+    }
+
+    bool emitOp(OpCode op, double number = 0)
+    {
+        Instruction ins;
+        ins.op = op;
+        ins.number = number;
+        return emit(ins);
+    }
+
+    bool readInt(int &value)
+    {
+        if (token != Token::INT)
+            return false;
+
+        // giống stoi: tràn int thì coi như lỗi
+        errno = 0;
+        char *stop;
+        long v = strtol(tokenStart, &stop, 10);
+        if (stop != p || errno == ERANGE || v < INT_MIN || v > INT_MAX)
+            return false;
+
+        value = v;
+        next();
+        return true;
+    }
+
+    bool readNumber(double &value)
+    {
+        if (token != Token::INT && token != Token::FLOAT)
+            return false;
+
+        errno = 0;
+        char *stop;
+        value = strtod(tokenStart, &stop);
+        if (stop != p || errno == ERANGE)
+            return false;
+
+        next();
+        return true;
+    }
+
+    // INT (, INT)*: count bắt buộc, optional không bắt buộc
+    bool readInts(int *args, int count, int optional)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (i > 0 && !expect(Token::COMMA))
+                return false;
+            if (!readInt(args[i]))
+                return false;
+        }
+        for (int i = count; i < count + optional && token == Token::COMMA; i++)
+        {
+            next();
+            if (!readInt(args[i]))
+                return false;
+        }
+        return true;
+    }
+
+    bool parseCall()
+    {
+        Function f = function;
+        next();
+        if (!expect(Token::LPAREN))
+            return false;
+
+        Instruction ins;
+        ins.op = f.op;
+        int *a = ins.args;
+
+        switch (f.kind)
+        {
+        case ArgKind::NONE:
+            break;
+        case ArgKind::SHIFT:
+            if (token == Token::INT && !readInt(a[0]))
+                return false;
+            break;
+        case ArgKind::PERIOD:
+            if (!readInts(a, 1, 1))
+                return false;
+            break;
+        case ArgKind::RANGE:
+            if (!readInts(a, 1, 1))
+                return false;
+            if (a[1] < a[0])
+                swap(a[0], a[1]);
+            break;
+        case ArgKind::MACD:
+            if (!readInts(a, 3, 1))
+                return false;
+            break;
+        case ArgKind::RSI_RANGE:
+            if (!readInts(a, 2, 1))
+                return false;
+            if (a[2] < a[1])
+                swap(a[1], a[2]);
+            break;
+        case ArgKind::MACD_RANGE:
+            if (!readInts(a, 4, 1))
+                return false;
+            if (a[4] < a[3])
+                swap(a[3], a[4]);
+            break;
+        case ArgKind::BB:
+            if (!readInt(a[0]) || !expect(Token::COMMA) || !readNumber(ins.number))
+                return false;
+            if (token == Token::COMMA)
+            {
+                next();
+                if (!readInt(a[1]))
+                    return false;
+            }
+            break;
+        case ArgKind::MACD_N_DINH:
+            if (!readInts(a, 6, 0) || !expect(Token::COMMA) || !readNumber(ins.number) || !expect(Token::COMMA) || !readInt(a[6]))
+                return false;
+            ins.poolOffset = program.pool.size();
+            while (token == Token::COMMA)
+            {
+                next();
+                double value;
+                if (!readNumber(value))
+                    return false;
+                program.pool.push_back(value);
+            }
+            ins.poolSize = program.pool.size() - ins.poolOffset;
+            break;
+        }
+
+        return expect(Token::RPAREN) && emit(ins);
+    }
+
+    bool parsePrimary()
+    {
+        switch (token)
+        {
+        case Token::MINUS:
+            next();
+            return parseExpr(PREC_NEGATIVE) && emitOp(OpCode::NEG);
+        case Token::PLUS:
+            next();
+            return parseExpr(PREC_POSITIVE);
+        case Token::LPAREN:
+            next();
+            return parseExpr(0) && expect(Token::RPAREN);
+        case Token::ABS:
+            next();
+            return parseExpr(0) && expect(Token::RPAREN) && emitOp(OpCode::ABS);
+        case Token::MIN:
+        case Token::MAX:
+        {
+            OpCode op = token == Token::MIN ? OpCode::MIN : OpCode::MAX;
+            next();
+            if (!parseExpr(0))
+                return false;
+            while (token == Token::COMMA)
+            {
+                next();
+                if (!parseExpr(0) || !emitOp(op))
+                    return false;
+            }
+            return expect(Token::RPAREN);
+        }
+        case Token::INT:
+        case Token::FLOAT:
+        {
+            double value;
+            return readNumber(value) && emitOp(OpCode::CONST, value);
+        }
+        case Token::STRING:
+            program.text.assign(tokenStart, p - tokenStart);
+            next();
+            return emitOp(OpCode::STRING);
+        case Token::FUNCTION:
+            return parseCall();
+        default:
+            return false;
+        }
+    }
+
+    bool parseExpr(int minPrec)
+    {
+        if (++nesting > MAX_NESTING)
+            return false;
+
+        if (!parsePrimary())
+            return false;
+
+        while (true)
+        {
+            int prec;
+            OpCode op;
+            switch (token)
+            {
+            case Token::STAR:
+                prec = PREC_MUL_DIV, op = OpCode::MUL;
+                break;
+            case Token::SLASH:
+                prec = PREC_MUL_DIV, op = OpCode::DIV;
+                break;
+            case Token::PLUS:
+                prec = PREC_ADD_SUB, op = OpCode::ADD;
+                break;
+            case Token::MINUS:
+                prec = PREC_ADD_SUB, op = OpCode::SUB;
+                break;
+            case Token::LT:
+                prec = PREC_COMPARISON, op = OpCode::LT;
+                break;
+            case Token::LE:
+                prec = PREC_COMPARISON, op = OpCode::LE;
+                break;
+            case Token::GT:
+                prec = PREC_COMPARISON, op = OpCode::GT;
+                break;
+            case Token::GE:
+                prec = PREC_COMPARISON, op = OpCode::GE;
+                break;
+            case Token::EQ:
+                prec = PREC_COMPARISON, op = OpCode::EQ;
+                break;
+            default:
+                prec = -1, op = OpCode::CONST;
+                break;
+            }
+            if (prec < minPrec)
+                break;
+
+            // toán tử trái kết hợp: vế phải chỉ nhận toán tử ưu tiên cao hơn
+            next();
+            if (!parseExpr(prec + 1) || !emitOp(op))
+                return false;
+        }
+
+        nesting--;
+        return true;
+    }
+
+public:
+    PrattParser(const string &text, Program &program) : p(text.data()), end(text.data() + text.size()), program(program) {}
+
+    bool parse()
+    {
+        next();
+        if (!parseExpr(0) || token != Token::END || program.code.empty())
+            return false;
+
+        program.isString = program.code.size() == 1 && program.code[0].op == OpCode::STRING;
+        return true;
+    }
+};
+
+bool prattCompile(const string &text, Program &program)
+{
+    PrattParser parser(text, program);
+    return parser.parse();
+}
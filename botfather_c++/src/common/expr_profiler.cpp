@@ -0,0 +1,230 @@
+#include "expr_profiler.h"
+#include <fstream>
+
+// tên theo grammar, đúng thứ tự OpCode
+static const char *OP_NAMES[PROFILE_OP_COUNT] = {
+    "const", "string", "neg", "+", "-", "*", "/", "<", "<=", ">", ">=", "==", "abs", "min", "max", "open",
+    "high", "low", "close", "volume", "change", "change%", "ampl", "ampl%", "upper_shadow", "upper_shadow%",
+    "lower_shadow", "lower_shadow%", "rsi", "rsi_slope", "ma", "ema", "macd_value", "macd_signal",
+    "macd_histogram", "bb_upper", "bb_middle", "bb_lower", "macd_n_dinh", "macd_slope", "avg_open",
+    "avg_high", "avg_low", "avg_close", "avg_ampl", "avg_ampl%", "min_open", "min_high", "min_low",
+    "min_close", "min_change", "min_change%", "min_ampl", "min_ampl%", "max_open", "max_high", "max_low",
+    "max_close", "max_change", "max_change%", "max_ampl", "max_ampl%", "min_rsi", "max_rsi", "marsi",
+    "min_macd_value", "max_macd_value", "avg_macd_value", "min_macd_signal", "max_macd_signal",
+    "avg_macd_signal", "min_macd_histogram", "max_macd_histogram", "avg_macd_histogram", "hour", "minute",
+    "funding_rate", "bullish_engulfing", "bearish_engulfing", "bullish_hammer", "bearish_hammer", "doji",
+};
+
+static const char *CACHE_NAMES[PROFILE_CACHE_COUNT] = {"indicator", "minMax", "series", "prefixSum"};
+
+static const char *RANGE_NAMES[RANGE_STRATEGY_COUNT] = {"scan", "block", "sparse"};
+
+const char *ExprProfiler::REPORT_FILE = "expr_profile.json";
+
+static thread_local ProfileData localData;
+static thread_local uint32_t sampleTick = 0;
+
+void ProfileStat::merge(const ProfileStat &other)
+{
+    calls += other.calls;
+    samples += other.samples;
+    sampledNs += other.sampledNs;
+}
+
+double ProfileStat::avgNs() const
+{
+    return samples == 0 ? 0.0 : static_cast<double>(sampledNs) / samples;
+}
+
+double ProfileStat::estimatedNs() const
+{
+    return avgNs() * calls;
+}
+
+void ProfileData::merge(const ProfileData &other)
+{
+    for (int i = 0; i < PROFILE_OP_COUNT; i++)
+    {
+        ops[i].merge(other.ops[i]);
+    }
+    for (const auto &[id, bot] : other.bots)
+    {
+        BotProfile &profile = bots[id];
+        profile.name = bot.name;
+        profile.stat.merge(bot.stat);
+    }
+    for (int i = 0; i < PROFILE_CACHE_COUNT; i++)
+    {
+        cacheHits[i] += other.cacheHits[i];
+        cacheMisses[i] += other.cacheMisses[i];
+    }
+    for (int i = 0; i < RANGE_STRATEGY_COUNT; i++)
+    {
+        rangeQueries[i] += other.rangeQueries[i];
+        rangeBuilds[i] += other.rangeBuilds[i];
+    }
+}
+
+bool ExprProfiler::sample()
+{
+    return (++sampleTick & (SAMPLE_RATE - 1)) == 0;
+}
+
+uint64_t ExprProfiler::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ExprProfiler::addOp(OpCode op, bool sampled, uint64_t ns)
+{
+    ProfileStat &stat = localData.ops[static_cast<int>(op)];
+    stat.calls++;
+    if (sampled)
+    {
+        stat.samples++;
+        stat.sampledNs += ns;
+    }
+}
+
+void ExprProfiler::addBot(const Bot &bot, bool sampled, uint64_t ns)
+{
+    BotProfile &profile = localData.bots[bot.id];
+    if (profile.name.empty())
+        profile.name = bot.botName;
+
+    profile.stat.calls++;
+    if (sampled)
+    {
+        profile.stat.samples++;
+        profile.stat.sampledNs += ns;
+    }
+}
+
+void ExprProfiler::addCache(ProfileCache cache, bool hit)
+{
+    int i = static_cast<int>(cache);
+    if (hit)
+        localData.cacheHits[i]++;
+    else
+        localData.cacheMisses[i]++;
+}
+
+void ExprProfiler::addRange(RangeStrategy strategy, bool build)
+{
+    int i = static_cast<int>(strategy);
+    if (build)
+        localData.rangeBuilds[i]++;
+    else
+        localData.rangeQueries[i]++;
+}
+
+void ExprProfiler::flush()
+{
+    bool due;
+    {
+        lock_guard<mutex> lock(mMutex);
+        total.merge(localData);
+
+        auto current = chrono::steady_clock::now();
+        due = current - lastReport >= chrono::seconds(REPORT_INTERVAL_SEC);
+        if (due)
+            lastReport = current;
+    }
+    localData = ProfileData();
+
+    if (due)
+    {
+        logReport();
+        ofstream file(REPORT_FILE);
+        file << report().dump(2);
+    }
+}
+
+static json statToJson(const ProfileStat &stat)
+{
+    return {{"calls", stat.calls}, {"samples", stat.samples}, {"avgNs", stat.avgNs()}, {"estimatedNs", stat.estimatedNs()}};
+}
+
+json ExprProfiler::report()
+{
+    ProfileData data;
+    {
+        lock_guard<mutex> lock(mMutex);
+        data = total;
+    }
+
+    json ops = json::array();
+    vector<int> order;
+    for (int i = 0; i < PROFILE_OP_COUNT; i++)
+    {
+        if (data.ops[i].calls > 0)
+            order.push_back(i);
+    }
+    sort(order.begin(), order.end(), [&data](int a, int b)
+         { return data.ops[a].estimatedNs() > data.ops[b].estimatedNs(); });
+    for (int i : order)
+    {
+        json item = statToJson(data.ops[i]);
+        item["op"] = OP_NAMES[i];
+        ops.push_back(item);
+    }
+
+    vector<pair<int, const BotProfile *>> bots;
+    for (const auto &[id, bot] : data.bots)
+    {
+        bots.emplace_back(id, &bot);
+    }
+    sort(bots.begin(), bots.end(), [](const auto &a, const auto &b)
+         { return a.second->stat.estimatedNs() > b.second->stat.estimatedNs(); });
+
+    json botsJson = json::array();
+    for (const auto &[id, bot] : bots)
+    {
+        json item = statToJson(bot->stat);
+        item["id"] = id;
+        item["name"] = bot->name;
+        botsJson.push_back(item);
+    }
+
+    json cache;
+    for (int i = 0; i < PROFILE_CACHE_COUNT; i++)
+    {
+        uint64_t lookups = data.cacheHits[i] + data.cacheMisses[i];
+        cache[CACHE_NAMES[i]] = {{"hits", data.cacheHits[i]}, {"misses", data.cacheMisses[i]}, {"hitRate", lookups == 0 ? 0.0 : static_cast<double>(data.cacheHits[i]) / lookups}};
+    }
+
+    json range;
+    for (int i = 0; i < RANGE_STRATEGY_COUNT; i++)
+    {
+        range[RANGE_NAMES[i]] = {{"queries", data.rangeQueries[i]}, {"builds", data.rangeBuilds[i]}};
+    }
+
+    return {{"sampleRate", SAMPLE_RATE}, {"ops", ops}, {"bots", botsJson}, {"cache", cache}, {"range", range}};
+}
+
+void ExprProfiler::logReport(int top)
+{
+    json data = report();
+
+    LOGI("Expr profile (sample 1/{}):", SAMPLE_RATE);
+    for (int i = 0; i < min<int>(top, data["ops"].size()); i++)
+    {
+        const json &op = data["ops"][i];
+        LOGI("  op {}: {} calls, avg {:.0f} ns, total ~{:.3f} ms", op["op"].get<string>(), op["calls"].get<uint64_t>(), op["avgNs"].get<double>(), op["estimatedNs"].get<double>() / 1e6);
+    }
+    for (int i = 0; i < min<int>(top, data["bots"].size()); i++)
+    {
+        const json &bot = data["bots"][i];
+        LOGI("  bot {} ({}): {} runs, avg {:.0f} ns, total ~{:.3f} ms", bot["name"].get<string>(), bot["id"].get<int>(), bot["calls"].get<uint64_t>(), bot["avgNs"].get<double>(), bot["estimatedNs"].get<double>() / 1e6);
+    }
+    for (const char *name : CACHE_NAMES)
+    {
+        const json &cache = data["cache"][name];
+        LOGI("  cache {}: {} hits, {} misses", name, cache["hits"].get<uint64_t>(), cache["misses"].get<uint64_t>());
+    }
+    for (const char *name : RANGE_NAMES)
+    {
+        const json &range = data["range"][name];
+        LOGI("  range {}: {} queries, {} builds", name, range["queries"].get<uint64_t>(), range["builds"].get<uint64_t>());
+    }
+}
@@ -0,0 +1,135 @@
+#include "expr_registry.h"
+#include "expr_compiler.h"
+#include "util.h"
+
+ExprRegistry::ExprRegistry()
+{
+    snapshot = make_shared<const Snapshot>();
+}
+
+ExprRegistry &ExprRegistry::getInstance()
+{
+    static ExprRegistry instance;
+    return instance;
+}
+
+string ExprRegistry::canonical(const string &text)
+{
+    string result;
+    result.reserve(text.size());
+    bool inString = false;
+    bool pendingSpace = false;
+    for (char c : text)
+    {
+        if (c == '\'')
+        {
+            inString = !inString;
+        }
+        else if (!inString && isspace((unsigned char)c))
+        {
+            pendingSpace = !result.empty();
+            continue;
+        }
+
+        if (pendingSpace)
+        {
+            result.push_back(' ');
+            pendingSpace = false;
+        }
+        result.push_back(tolower((unsigned char)c));
+    }
+    return result;
+}
+
+shared_ptr<const Program> ExprRegistry::lookup(const Snapshot &snap, long long key, const string &text)
+{
+    auto it = snap.find(key);
+    if (it == snap.end())
+        return nullptr;
+
+    for (const Entry &entry : it->second)
+    {
+        if (entry.text == text)
+            return entry.program.lock();
+    }
+    return nullptr;
+}
+
+shared_ptr<const Program> ExprRegistry::acquire(const string &text)
+{
+    string canonicalText = canonical(text);
+    long long key = hashString(canonicalText);
+
+    lock_guard<mutex> lock(writeMutex);
+    shared_ptr<const Program> program = lookup(master, key, canonicalText);
+    if (program)
+        return program;
+
+    shared_ptr<Program> compiled = compileExpr(canonicalText);
+    if (!compiled)
+        return nullptr;
+
+    vector<Entry> &entries = master[key];
+    for (Entry &entry : entries)
+    {
+        // entry cũ đã hết hạn
+        if (entry.text == canonicalText)
+        {
+            entry.program = compiled;
+            return compiled;
+        }
+    }
+    if (!entries.empty())
+    {
+        LOGI("Hash collision {}: {} - {}", key, entries[0].text, canonicalText);
+    }
+    entries.push_back({canonicalText, compiled});
+    return compiled;
+}
+
+void ExprRegistry::commit()
+{
+    lock_guard<mutex> lock(writeMutex);
+    for (auto it = master.begin(); it != master.end();)
+    {
+        vector<Entry> &entries = it->second;
+        entries.erase(remove_if(entries.begin(), entries.end(), [](const Entry &entry)
+                                { return entry.program.expired(); }),
+                      entries.end());
+        if (entries.empty())
+            it = master.erase(it);
+        else
+            ++it;
+    }
+
+    atomic_store(&snapshot, shared_ptr<const Snapshot>(make_shared<Snapshot>(master)));
+    version.fetch_add(1, memory_order_release);
+    LOGI("ExprRegistry size: {}, version: {}", master.size(), version.load());
+}
+
+shared_ptr<const Program> ExprRegistry::find(const string &text)
+{
+    // mỗi thread giữ 1 bản snapshot, chỉ load lại khi version thay đổi
+    struct LocalSnapshot
+    {
+        uint64_t version = UINT64_MAX;
+        shared_ptr<const Snapshot> snapshot;
+    };
+    thread_local LocalSnapshot local;
+
+    uint64_t current = version.load(memory_order_acquire);
+    if (local.version != current)
+    {
+        local.snapshot = atomic_load(&snapshot);
+        local.version = current;
+    }
+
+    string canonicalText = canonical(text);
+    return lookup(*local.snapshot, hashString(canonicalText), canonicalText);
+}
+
+size_t ExprRegistry::size()
+{
+    lock_guard<mutex> lock(writeMutex);
+    return master.size();
+}
@@ -0,0 +1,192 @@
+#include "indicator_stream.h"
+
+void IndicatorStream::copyTo(ArenaVector &out, int n) const
+{
+    out.resize(n * width);
+    const double *newest = history.data() + history.size() - width;
+    for (int i = 0; i < n; i++)
+    {
+        for (int k = 0; k < width; k++)
+            out[i * width + k] = newest[-i * width + k];
+    }
+}
+
+// số nến mới kể từ lần cập nhật trước, -1 nếu phải tính lại từ cửa sổ
+static int pendingCandles(const IndicatorStream &stream, const long long *startTime, int n, int need)
+{
+    if (stream.history.empty())
+        return -1;
+
+    for (int k = 0; k < min(n, IndicatorStreams::MAX_ADVANCE); k++)
+    {
+        if (startTime[k] == stream.lastTime)
+            return stream.size() + k >= need ? k : -1;
+    }
+    return -1;
+}
+
+// history chỉ cần dài bằng cửa sổ, cắt bớt theo từng đợt để push_back vẫn O(1)
+static void trimHistory(IndicatorStream &stream)
+{
+    if (stream.size() > 2 * MAX_CANDLE)
+        stream.history.erase(stream.history.begin(), stream.history.end() - MAX_CANDLE * stream.width);
+}
+
+static double rsiValue(double avgGain, double avgLoss)
+{
+    return (avgLoss == 0.0) ? 100.0 : (100.0 - (100.0 / (1.0 + avgGain / avgLoss)));
+}
+
+// tiến RSI tới nến i, nến trước là i + 1
+static void advanceRSI(IndicatorStream &stream, int period, const double *close, int i)
+{
+    double &avgGain = stream.state[0];
+    double &avgLoss = stream.state[1];
+
+    double diff = close[i] - close[i + 1];
+    double gain = diff > 0 ? diff : 0.0;
+    double loss = diff < 0 ? -diff : 0.0;
+
+    avgGain = (avgGain * (period - 1) + gain) / period;
+    avgLoss = (avgLoss * (period - 1) + loss) / period;
+
+    stream.history.push_back(rsiValue(avgGain, avgLoss));
+}
+
+const IndicatorStream *IndicatorStreams::rsi(long long key, int period, const double *close, const long long *startTime, int n)
+{
+    if (period <= 0 || n <= period)
+        return nullptr;
+
+    IndicatorStream &stream = streams[key];
+    int k = pendingCandles(stream, startTime, n, n - 1 - period);
+
+    if (k < 0)
+    {
+        // seed giống iRSI
+        double avgGain = 0.0, avgLoss = 0.0;
+        for (int i = n - 2; i >= n - 1 - period; --i)
+        {
+            double diff = close[i] - close[i + 1];
+            avgGain += diff > 0 ? diff : 0;
+            avgLoss += avgLoss < 0 ? diff : 0;
+        }
+
+        stream.history.clear();
+        stream.state[0] = avgGain / period;
+        stream.state[1] = avgLoss / period;
+        k = n - 1 - period;
+    }
+
+    for (int i = k - 1; i >= 0; --i)
+        advanceRSI(stream, period, close, i);
+
+    stream.lastTime = startTime[0];
+    trimHistory(stream);
+    return &stream;
+}
+
+const IndicatorStream *IndicatorStreams::ema(long long key, int period, const double *close, const long long *startTime, int n)
+{
+    if (period <= 0 || n <= 0)
+        return nullptr;
+
+    IndicatorStream &stream = streams[key];
+    int k = pendingCandles(stream, startTime, n, n);
+    double alpha = 2.0 / (period + 1);
+    double &ema = stream.state[0];
+
+    if (k < 0)
+    {
+        stream.history.clear();
+        ema = close[n - 1];
+        stream.history.push_back(ema);
+        k = n - 1;
+    }
+
+    for (int i = k - 1; i >= 0; --i)
+    {
+        ema = close[i] * alpha + ema * (1 - alpha);
+        stream.history.push_back(ema);
+    }
+
+    stream.lastTime = startTime[0];
+    trimHistory(stream);
+    return &stream;
+}
+
+const IndicatorStream *IndicatorStreams::macd(long long key, int fastPeriod, int slowPeriod, int signalPeriod, const double *close, const long long *startTime, int n)
+{
+    if (n <= slowPeriod || fastPeriod <= 0 || slowPeriod <= 0 || signalPeriod <= 0)
+        return nullptr;
+
+    IndicatorStream &stream = streams[key];
+    stream.width = 3;
+    int k = pendingCandles(stream, startTime, n, n - 1);
+
+    double kFast = 2.0 / (fastPeriod + 1);
+    double kSlow = 2.0 / (slowPeriod + 1);
+    double kSignal = 2.0 / (signalPeriod + 1);
+    double &emaFast = stream.state[0];
+    double &emaSlow = stream.state[1];
+    double &signalEMA = stream.state[2];
+
+    if (k < 0)
+    {
+        // seed giống iMACD: signal lấy macd của nến đầu tiên
+        stream.history.clear();
+        emaFast = close[n - 1];
+        emaSlow = close[n - 1];
+        k = n - 1;
+    }
+
+    for (int i = k - 1; i >= 0; --i)
+    {
+        emaFast = (close[i] - emaFast) * kFast + emaFast;
+        emaSlow = (close[i] - emaSlow) * kSlow + emaSlow;
+
+        double macd = emaFast - emaSlow;
+        signalEMA = stream.history.empty() ? macd : (macd - signalEMA) * kSignal + signalEMA;
+
+        stream.history.push_back(macd);
+        stream.history.push_back(signalEMA);
+        stream.history.push_back(macd - signalEMA);
+    }
+
+    stream.lastTime = startTime[0];
+    trimHistory(stream);
+    return &stream;
+}
+
+const SparseTable *IndicatorStreams::minMax(long long key, const double *a, const long long *startTime, int n)
+{
+    if (n <= 0)
+        return nullptr;
+
+    MinMaxStream &stream = minMaxStreams[key];
+    int k = -1;
+    if (stream.table.size() > 0)
+    {
+        for (int i = 0; i < min(n, MAX_ADVANCE); i++)
+        {
+            if (startTime[i] == stream.lastTime)
+            {
+                k = stream.table.size() + i >= n ? i : -1;
+                break;
+            }
+        }
+    }
+
+    if (k < 0)
+        stream.table.init(a, n);
+    else
+    {
+        for (int i = k - 1; i >= 0; --i)
+            stream.table.push(a[i]);
+        while (stream.table.size() > n)
+            stream.table.pop();
+    }
+
+    stream.lastTime = startTime[0];
+    return &stream.table;
+}
@@ -0,0 +1,46 @@
+#include "prefix_sum.h"
+#include <algorithm>
+
+PrefixSum::PrefixSum(const ArenaVector &data)
+{
+    n = (data.size() - 1) / 2 - 1;
+    base = data[0];
+    s = data.data() + 1;
+    sq = s + n + 1;
+}
+
+void PrefixSum::build(ArenaVector &data, const double *a, int length)
+{
+    data.resize(2 * (length + 1) + 1);
+    double base = length > 0 ? a[0] : 0.0;
+    double *s = data.data() + 1;
+    double *sq = s + length + 1;
+
+    data[0] = base;
+    s[0] = 0.0;
+    sq[0] = 0.0;
+    for (int i = 0; i < length; ++i)
+    {
+        double diff = a[i] - base;
+        s[i + 1] = s[i] + diff;
+        sq[i + 1] = sq[i] + diff * diff;
+    }
+}
+
+double PrefixSum::sum(int l, int r) const
+{
+    return s[r + 1] - s[l] + base * (r - l + 1);
+}
+
+double PrefixSum::mean(int l, int r) const
+{
+    return base + (s[r + 1] - s[l]) / (r - l + 1);
+}
+
+double PrefixSum::variance(int l, int r) const
+{
+    int count = r - l + 1;
+    double sumDiff = s[r + 1] - s[l];
+    double variance = (sq[r + 1] - sq[l] - sumDiff * sumDiff / count) / count;
+    return max(variance, 0.0);
+}
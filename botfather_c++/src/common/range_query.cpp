@@ -0,0 +1,107 @@
+#include "range_query.h"
+#include "simd_kernel.h"
+#include "expr_profiler.h"
+#include <algorithm>
+
+static const SimdKernels &kernels = simdKernels();
+
+static int floorLog2(int x)
+{
+    return 31 - __builtin_clz(max(x, 1));
+}
+
+void RangeQuery::init(const double *a, int length)
+{
+    this->a = a;
+    n = length;
+    strategy = RangeStrategy::SCAN;
+    cost = 0;
+    table = nullptr;
+}
+
+void RangeQuery::initStrided(const double *a, int stride, int length)
+{
+    values.resize(length);
+    for (int i = 0; i < length; ++i)
+        values[i] = a[i * stride];
+    init(values.data(), length);
+}
+
+void RangeQuery::initTable(const SparseTable *table)
+{
+    a = nullptr;
+    n = table->size();
+    strategy = RangeStrategy::SPARSE;
+    cost = 0;
+    this->table = table;
+}
+
+void RangeQuery::buildBlocks()
+{
+    int count = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blockMin.resize(count);
+    blockMax.resize(count);
+    for (int b = 0; b < count; ++b)
+    {
+        int from = b * BLOCK_SIZE;
+        int width = min(BLOCK_SIZE, n - from);
+        blockMin[b] = kernels.min(a + from, width);
+        blockMax[b] = kernels.max(a + from, width);
+    }
+    strategy = RangeStrategy::BLOCK;
+    cost = 0;
+    PROFILE_RANGE_BUILD(RangeStrategy::BLOCK);
+}
+
+void RangeQuery::buildTable()
+{
+    ownTable.init(a, n);
+    table = &ownTable;
+    strategy = RangeStrategy::SPARSE;
+    cost = 0;
+    PROFILE_RANGE_BUILD(RangeStrategy::SPARSE);
+}
+
+double RangeQuery::query(int l, int r, bool isMin)
+{
+    int width = r - l + 1;
+
+    // chuyển chiến lược khi công đã bỏ ra ở chiến lược hiện tại vượt chi phí dựng chiến lược sau
+    if (strategy == RangeStrategy::SCAN && cost + width > 2LL * n)
+        buildBlocks();
+    if (strategy == RangeStrategy::BLOCK && cost + 2 * BLOCK_SIZE + width / BLOCK_SIZE > (long long)n * (floorLog2(n) + 1))
+        buildTable();
+
+    PROFILE_RANGE(strategy);
+    switch (strategy)
+    {
+    case RangeStrategy::SCAN:
+        cost += width;
+        return isMin ? kernels.min(a + l, width) : kernels.max(a + l, width);
+    case RangeStrategy::BLOCK:
+    {
+        int first = l / BLOCK_SIZE;
+        int last = r / BLOCK_SIZE;
+        if (first == last)
+        {
+            cost += width;
+            return isMin ? kernels.min(a + l, width) : kernels.max(a + l, width);
+        }
+
+        // phần lẻ 2 đầu quét thẳng, các khối đủ ở giữa đọc từ blockMin/blockMax
+        int headWidth = (first + 1) * BLOCK_SIZE - l;
+        int tailWidth = r - last * BLOCK_SIZE + 1;
+        int blocks = last - first - 1;
+        cost += headWidth + tailWidth + blocks;
+        if (isMin)
+        {
+            double result = min(kernels.min(a + l, headWidth), kernels.min(a + last * BLOCK_SIZE, tailWidth));
+            return blocks > 0 ? min(result, kernels.min(blockMin.data() + first + 1, blocks)) : result;
+        }
+        double result = max(kernels.max(a + l, headWidth), kernels.max(a + last * BLOCK_SIZE, tailWidth));
+        return blocks > 0 ? max(result, kernels.max(blockMax.data() + first + 1, blocks)) : result;
+    }
+    default:
+        return isMin ? table->query_min(l, r) : table->query_max(l, r);
+    }
+}
@@ -0,0 +1,38 @@
+#include "series_index.h"
+#include "common_type.h"
+
+int SeriesIndex::intern(const string &series)
+{
+    auto [it, inserted] = ids.emplace(series, subscribers.size());
+    if (inserted)
+        subscribers.emplace_back();
+    return it->second;
+}
+
+int SeriesIndex::find(const string &series) const
+{
+    auto it = ids.find(series);
+    return it == ids.end() ? -1 : it->second;
+}
+
+void SeriesIndex::add(const Bot &bot, int position)
+{
+    for (const Symbol &symbol : bot.symbolList)
+    {
+        for (const string &timeframe : bot.timeframes)
+        {
+            vector<int> &list = subscribers[intern(symbol.symbolName + "_" + timeframe)];
+            // symbolList/timeframes trùng thì bot chỉ vào 1 lần
+            if (list.empty() || list.back() != position)
+                list.push_back(position);
+        }
+    }
+}
+
+void SeriesIndex::build(const vector<shared_ptr<Bot>> &bots)
+{
+    for (vector<int> &list : subscribers)
+        list.clear();
+    for (size_t i = 0; i < bots.size(); i++)
+        add(*bots[i], i);
+}
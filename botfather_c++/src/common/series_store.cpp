@@ -0,0 +1,44 @@
+#include "series_store.h"
+
+void SeriesMemo::begin(const long long *startTime, int length)
+{
+    // nến trước của lần này phải là nến 0 của lần trước, nếu không dữ liệu cũ không còn khớp shift
+    if (length < 2 || startTime[1] != lastTime)
+    {
+        values.clear();
+        indicators.clear();
+    }
+    else
+    {
+        // nến có shift > MAX_SHIFT không được tra nữa
+        long long oldest = startTime[min(length - 1, MAX_SHIFT)];
+        for (auto it = values.begin(); it != values.end();)
+        {
+            if (it->first.time < oldest)
+                it = values.erase(it);
+            else
+                ++it;
+        }
+    }
+    lastTime = length > 0 ? startTime[0] : 0;
+}
+
+const SeriesValue *SeriesMemo::find(const SeriesKey &key)
+{
+    auto it = values.find(key);
+    return it == values.end() ? nullptr : &it->second;
+}
+
+void SeriesMemo::store(const SeriesKey &key, SeriesValue value)
+{
+    values[key] = move(value);
+}
+
+shared_ptr<SeriesMemo> SeriesStore::get(const string &series)
+{
+    lock_guard<mutex> lock(mMutex);
+    shared_ptr<SeriesMemo> &memo = memos[series];
+    if (!memo)
+        memo = make_shared<SeriesMemo>();
+    return memo;
+}
@@ -0,0 +1,279 @@
+#include "simd_kernel.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+using namespace std;
+
+static double scalarSum(const double *a, int n)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i)
+        sum += a[i];
+    return sum;
+}
+
+static double scalarMin(const double *a, int n)
+{
+    double minVal = a[0];
+    for (int i = 1; i < n; ++i)
+        minVal = min(minVal, a[i]);
+    return minVal;
+}
+
+static double scalarMax(const double *a, int n)
+{
+    double maxVal = a[0];
+    for (int i = 1; i < n; ++i)
+        maxVal = max(maxVal, a[i]);
+    return maxVal;
+}
+
+static double scalarSumSqDiff(const double *a, int n, double mean)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i)
+    {
+        double diff = a[i] - mean;
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+#ifdef SIMD_X86
+
+// SSE2: 2 làn, 2 accumulator để không chờ latency của phép cộng
+
+__attribute__((target("sse2"))) static double sse2Sum(const double *a, int n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+    }
+    s0 = _mm_add_pd(s0, s1);
+    double lanes[2];
+    _mm_storeu_pd(lanes, s0);
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; ++i)
+        sum += a[i];
+    return sum;
+}
+
+__attribute__((target("sse2"))) static double sse2Min(const double *a, int n)
+{
+    if (n < 2)
+        return a[0];
+    __m128d m = _mm_loadu_pd(a);
+    int i = 2;
+    for (; i + 2 <= n; i += 2)
+        m = _mm_min_pd(m, _mm_loadu_pd(a + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double minVal = min(lanes[0], lanes[1]);
+    for (; i < n; ++i)
+        minVal = min(minVal, a[i]);
+    return minVal;
+}
+
+__attribute__((target("sse2"))) static double sse2Max(const double *a, int n)
+{
+    if (n < 2)
+        return a[0];
+    __m128d m = _mm_loadu_pd(a);
+    int i = 2;
+    for (; i + 2 <= n; i += 2)
+        m = _mm_max_pd(m, _mm_loadu_pd(a + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double maxVal = max(lanes[0], lanes[1]);
+    for (; i < n; ++i)
+        maxVal = max(maxVal, a[i]);
+    return maxVal;
+}
+
+__attribute__((target("sse2"))) static double sse2SumSqDiff(const double *a, int n, double mean)
+{
+    __m128d vMean = _mm_set1_pd(mean);
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128d d0 = _mm_sub_pd(_mm_loadu_pd(a + i), vMean);
+        __m128d d1 = _mm_sub_pd(_mm_loadu_pd(a + i + 2), vMean);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(d0, d0));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(d1, d1));
+    }
+    s0 = _mm_add_pd(s0, s1);
+    double lanes[2];
+    _mm_storeu_pd(lanes, s0);
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; ++i)
+        sum += (a[i] - mean) * (a[i] - mean);
+    return sum;
+}
+
+// AVX2: 4 làn, 2 accumulator
+
+__attribute__((target("avx2"))) static double avx2Reduce(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2"))) static double avx2Sum(const double *a, int n)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+    }
+    double sum = avx2Reduce(_mm256_add_pd(s0, s1));
+    for (; i < n; ++i)
+        sum += a[i];
+    return sum;
+}
+
+__attribute__((target("avx2"))) static double avx2Min(const double *a, int n)
+{
+    if (n < 4)
+        return scalarMin(a, n);
+    __m256d m = _mm256_loadu_pd(a);
+    int i = 4;
+    for (; i + 4 <= n; i += 4)
+        m = _mm256_min_pd(m, _mm256_loadu_pd(a + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double minVal = min(min(lanes[0], lanes[1]), min(lanes[2], lanes[3]));
+    for (; i < n; ++i)
+        minVal = min(minVal, a[i]);
+    return minVal;
+}
+
+__attribute__((target("avx2"))) static double avx2Max(const double *a, int n)
+{
+    if (n < 4)
+        return scalarMax(a, n);
+    __m256d m = _mm256_loadu_pd(a);
+    int i = 4;
+    for (; i + 4 <= n; i += 4)
+        m = _mm256_max_pd(m, _mm256_loadu_pd(a + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double maxVal = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+    for (; i < n; ++i)
+        maxVal = max(maxVal, a[i]);
+    return maxVal;
+}
+
+__attribute__((target("avx2,fma"))) static double avx2SumSqDiff(const double *a, int n, double mean)
+{
+    __m256d vMean = _mm256_set1_pd(mean);
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), vMean);
+        __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(a + i + 4), vMean);
+        s0 = _mm256_fmadd_pd(d0, d0, s0);
+        s1 = _mm256_fmadd_pd(d1, d1, s1);
+    }
+    double sum = avx2Reduce(_mm256_add_pd(s0, s1));
+    for (; i < n; ++i)
+        sum += (a[i] - mean) * (a[i] - mean);
+    return sum;
+}
+
+// AVX-512: 8 làn, phần dư xử lý bằng mask nên không cần vòng scalar
+
+__attribute__((target("avx512f"))) static double avx512Sum(const double *a, int n)
+{
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        s0 = _mm512_add_pd(s0, _mm512_loadu_pd(a + i));
+        s1 = _mm512_add_pd(s1, _mm512_loadu_pd(a + i + 8));
+    }
+    for (; i < n; i += 8)
+    {
+        __mmask8 mask = n - i >= 8 ? 0xFF : static_cast<__mmask8>((1u << (n - i)) - 1);
+        s0 = _mm512_add_pd(s0, _mm512_maskz_loadu_pd(mask, a + i));
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+__attribute__((target("avx512f"))) static double avx512Min(const double *a, int n)
+{
+    // lane thiếu lấy a[0] để không ảnh hưởng kết quả
+    __m512d m = _mm512_set1_pd(a[0]);
+    for (int i = 0; i < n; i += 8)
+    {
+        __mmask8 mask = n - i >= 8 ? 0xFF : static_cast<__mmask8>((1u << (n - i)) - 1);
+        m = _mm512_min_pd(m, _mm512_mask_loadu_pd(m, mask, a + i));
+    }
+    return _mm512_reduce_min_pd(m);
+}
+
+__attribute__((target("avx512f"))) static double avx512Max(const double *a, int n)
+{
+    __m512d m = _mm512_set1_pd(a[0]);
+    for (int i = 0; i < n; i += 8)
+    {
+        __mmask8 mask = n - i >= 8 ? 0xFF : static_cast<__mmask8>((1u << (n - i)) - 1);
+        m = _mm512_max_pd(m, _mm512_mask_loadu_pd(m, mask, a + i));
+    }
+    return _mm512_reduce_max_pd(m);
+}
+
+__attribute__((target("avx512f"))) static double avx512SumSqDiff(const double *a, int n, double mean)
+{
+    __m512d vMean = _mm512_set1_pd(mean);
+    __m512d s = _mm512_setzero_pd();
+    for (int i = 0; i < n; i += 8)
+    {
+        __mmask8 mask = n - i >= 8 ? 0xFF : static_cast<__mmask8>((1u << (n - i)) - 1);
+        // lane thiếu: diff = 0
+        __m512d d = _mm512_maskz_sub_pd(mask, _mm512_maskz_loadu_pd(mask, a + i), vMean);
+        s = _mm512_fmadd_pd(d, d, s);
+    }
+    return _mm512_reduce_add_pd(s);
+}
+
+#endif
+
+static const SimdKernels SCALAR = {"scalar", scalarSum, scalarMin, scalarMax, scalarSumSqDiff};
+
+static SimdKernels detectKernels()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return {"avx512", avx512Sum, avx512Min, avx512Max, avx512SumSqDiff};
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return {"avx2", avx2Sum, avx2Min, avx2Max, avx2SumSqDiff};
+    if (__builtin_cpu_supports("sse2"))
+        return {"sse2", sse2Sum, sse2Min, sse2Max, sse2SumSqDiff};
+#endif
+    return SCALAR;
+}
+
+const SimdKernels &simdKernels()
+{
+    static const SimdKernels kernels = detectKernels();
+    return kernels;
+}
+
+const SimdKernels &scalarKernels()
+{
+    return SCALAR;
+}
@@ -1,54 +1,150 @@
 #include "sparse_table.h"
-#include <cmath>
 #include <algorithm>
+#include <cstring>
 
-void SparseTable::init(const double *a, int length)
-{
-    n = length;
-    int max_log = log2(n) + 1;
+// bảng log2 dùng chung cho mọi SparseTable, độ dài lớn hơn thì tính bằng clz
+static const int LOG_TABLE_SIZE = 4096;
 
-    log2s.resize(n + 1);
-    log2s[1] = 0;
-    for (int i = 2; i <= n; ++i)
-        log2s[i] = log2s[i / 2] + 1;
+static const vector<unsigned char> &logTable()
+{
+    static const vector<unsigned char> table = []
+    {
+        vector<unsigned char> t(LOG_TABLE_SIZE, 0);
+        for (int i = 2; i < LOG_TABLE_SIZE; ++i)
+            t[i] = t[i / 2] + 1;
+        return t;
+    }();
+    return table;
+}
 
-    st_min.resize(n);
-    for (auto &row : st_min)
-        row.resize(max_log);
+static inline int floorLog2(int x)
+{
+    static const unsigned char *table = logTable().data();
+    return x < LOG_TABLE_SIZE ? table[x] : 31 - __builtin_clz(x);
+}
 
-    st_max.resize(n);
-    for (auto &row : st_max)
-        row.resize(max_log);
+void SparseTable::init(const double *a, int length)
+{
+    n = length;
+    head = 0;
+    // giữ buffer cũ nếu đủ chỗ, init lại (stream tính lại từ cửa sổ) không phải cấp phát lại
+    if (capacity < length)
+    {
+        capacity = length;
+        levels = floorLog2(max(capacity, 1)) + 1;
+        st_min.resize((size_t)levels * capacity);
+        st_max.resize((size_t)levels * capacity);
+    }
 
     for (int i = 0; i < n; ++i)
     {
-        st_min[i][0] = a[i];
-        st_max[i][0] = a[i];
+        st_min[i] = a[n - 1 - i];
+        st_max[i] = a[n - 1 - i];
     }
 
     for (int j = 1; (1 << j) <= n; ++j)
     {
+        const double *prevMin = st_min.data() + (size_t)(j - 1) * capacity;
+        const double *prevMax = st_max.data() + (size_t)(j - 1) * capacity;
+        double *curMin = st_min.data() + (size_t)j * capacity;
+        double *curMax = st_max.data() + (size_t)j * capacity;
+        int half = 1 << (j - 1);
         for (int i = 0; i + (1 << j) <= n; ++i)
         {
-            st_min[i][j] = min(st_min[i][j - 1], st_min[i + (1 << (j - 1))][j - 1]);
-            st_max[i][j] = max(st_max[i][j - 1], st_max[i + (1 << (j - 1))][j - 1]);
+            curMin[i] = min(prevMin[i], prevMin[i + half]);
+            curMax[i] = max(prevMax[i], prevMax[i + half]);
         }
     }
 }
 
+// dồn dữ liệu về đầu mỗi tầng (head = 0), cấp phát lại nếu đổi capacity
+void SparseTable::relayout(int newCapacity)
+{
+    int newLevels = floorLog2(newCapacity) + 1;
+    if (newCapacity == capacity && newLevels == levels)
+    {
+        for (int j = 0; (1 << j) <= n; ++j)
+        {
+            size_t row = (size_t)j * capacity;
+            int count = n - (1 << j) + 1;
+            memmove(st_min.data() + row, st_min.data() + row + head, count * sizeof(double));
+            memmove(st_max.data() + row, st_max.data() + row + head, count * sizeof(double));
+        }
+    }
+    else
+    {
+        ArenaVector newMin((size_t)newLevels * newCapacity, st_min.get_allocator());
+        ArenaVector newMax((size_t)newLevels * newCapacity, st_max.get_allocator());
+        for (int j = 0; (1 << j) <= n; ++j)
+        {
+            int count = n - (1 << j) + 1;
+            copy_n(st_min.data() + (size_t)j * capacity + head, count, newMin.data() + (size_t)j * newCapacity);
+            copy_n(st_max.data() + (size_t)j * capacity + head, count, newMax.data() + (size_t)j * newCapacity);
+        }
+        st_min.swap(newMin);
+        st_max.swap(newMax);
+        capacity = newCapacity;
+        levels = newLevels;
+    }
+    head = 0;
+}
+
+void SparseTable::push(double value)
+{
+    if (head + n + 1 > capacity)
+    {
+        // chừa thêm 1/4 để cửa sổ trượt chỉ phải dồn lại sau mỗi ~n/4 nến
+        relayout(max(n + 1 + max(n / 4, 16), capacity));
+    }
+
+    int p = head + n;
+    st_min[p] = value;
+    st_max[p] = value;
+    n++;
+
+    // mỗi tầng chỉ có 1 đoạn mới là đoạn kết thúc ở p
+    for (int j = 1; (1 << j) <= n; ++j)
+    {
+        size_t row = (size_t)j * capacity;
+        size_t prev = (size_t)(j - 1) * capacity;
+        int s = p - (1 << j) + 1;
+        int half = 1 << (j - 1);
+        st_min[row + s] = min(st_min[prev + s], st_min[prev + s + half]);
+        st_max[row + s] = max(st_max[prev + s], st_max[prev + s + half]);
+    }
+}
+
+void SparseTable::pop()
+{
+    // các đoạn bắt đầu sau head không chứa phần tử bị bỏ nên vẫn đúng
+    if (n > 0)
+    {
+        head++;
+        n--;
+    }
+}
+
+void SparseTable::slide(double value)
+{
+    push(value);
+    pop();
+}
+
 double SparseTable::query_min(int l, int r) const
 {
-    int k = log2s[r - l + 1];
-    return min(st_min[l][k], st_min[r - (1 << k) + 1][k]);
+    int k = floorLog2(r - l + 1);
+    const double *row = st_min.data() + (size_t)k * capacity + head + n - 1;
+    return min(row[-r], row[-l - (1 << k) + 1]);
 }
 
 double SparseTable::query_max(int l, int r) const
 {
-    int k = log2s[r - l + 1];
-    return max(st_max[l][k], st_max[r - (1 << k) + 1][k]);
+    int k = floorLog2(r - l + 1);
+    const double *row = st_max.data() + (size_t)k * capacity + head + n - 1;
+    return max(row[-r], row[-l - (1 << k) + 1]);
 }
 
-int SparseTable::size()
+int SparseTable::size() const
 {
     return n;
-}
\ No newline at end of file
+}
@@ -71,6 +71,20 @@ void MySQLConnector::releaseConnection(shared_ptr<sql::Connection> conn)
     poolCond.notify_one();
 }
 
+// connection trong pool bị đứt thì mở lại
+void MySQLConnector::ensureValid(shared_ptr<sql::Connection> &conn)
+{
+    if (!conn->isValid())
+    {
+        conn.reset(driver->connect(host, username, password));
+        conn->setClientOption("OPT_CONNECT_TIMEOUT", "10");
+        conn->setClientOption("OPT_READ_TIMEOUT", "20");
+        conn->setClientOption("OPT_WRITE_TIMEOUT", "20");
+        conn->setClientOption("OPT_RECONNECT", "true");
+        conn->setSchema(database);
+    }
+}
+
 void MySQLConnector::bindParams(sql::PreparedStatement *stmt, const vector<any> &params)
 {
     for (size_t i = 0; i < params.size(); ++i)
@@ -104,15 +118,7 @@ void MySQLConnector::bindParams(sql::PreparedStatement *stmt, const vector<any>
 unique_ptr<sql::ResultSet> MySQLConnector::executeQuery(const string &query, const vector<any> &params)
 {
     auto conn = acquireConnection();
-    if (!conn->isValid())
-    {
-        conn.reset(driver->connect(host, username, password));
-        conn->setClientOption("OPT_CONNECT_TIMEOUT", "10");
-        conn->setClientOption("OPT_READ_TIMEOUT", "20");
-        conn->setClientOption("OPT_WRITE_TIMEOUT", "20");
-        conn->setClientOption("OPT_RECONNECT", "true");
-        conn->setSchema(database);
-    }
+    ensureValid(conn);
 
     sql::PreparedStatement *pstmt = conn->prepareStatement(query);
     bindParams(pstmt, params);
@@ -127,15 +133,7 @@ int MySQLConnector::executeUpdate(const string &query, const vector<any> &params
     try
     {
         auto conn = acquireConnection();
-        if (!conn->isValid())
-        {
-            conn.reset(driver->connect(host, username, password));
-            conn->setClientOption("OPT_CONNECT_TIMEOUT", "10");
-            conn->setClientOption("OPT_READ_TIMEOUT", "20");
-            conn->setClientOption("OPT_WRITE_TIMEOUT", "20");
-            conn->setClientOption("OPT_RECONNECT", "true");
-            conn->setSchema(database);
-        }
+        ensureValid(conn);
 
         sql::PreparedStatement *pstmt = conn->prepareStatement(query);
         bindParams(pstmt, params);
@@ -150,4 +148,70 @@ int MySQLConnector::executeUpdate(const string &query, const vector<any> &params
              e.what(), e.getSQLStateCStr(), e.getErrorCode());
         return -1;
     }
-}
\ No newline at end of file
+}
+
+int MySQLConnector::executeBatchInsert(const string &table, const vector<string> &columns, const vector<vector<any>> &rows)
+{
+    if (rows.empty())
+        return 0;
+
+    string header = "INSERT INTO " + table + "(";
+    string placeholder = "(";
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        header += (i ? "," : "") + columns[i];
+        placeholder += i ? ",?" : "?";
+    }
+    header += ") VALUES ";
+    placeholder += ")";
+
+    size_t rowsPerStatement = max<size_t>(1, 65535 / max<size_t>(1, columns.size()));
+    shared_ptr<sql::Connection> conn;
+    try
+    {
+        conn = acquireConnection();
+        ensureValid(conn);
+        conn->setAutoCommit(false);
+
+        int affected = 0;
+        for (size_t begin = 0; begin < rows.size(); begin += rowsPerStatement)
+        {
+            size_t end = min(rows.size(), begin + rowsPerStatement);
+            string query = header;
+            vector<any> params;
+            params.reserve((end - begin) * columns.size());
+            for (size_t r = begin; r < end; ++r)
+            {
+                query += r == begin ? placeholder : "," + placeholder;
+                params.insert(params.end(), rows[r].begin(), rows[r].end());
+            }
+
+            unique_ptr<sql::PreparedStatement> pstmt(conn->prepareStatement(query));
+            bindParams(pstmt.get(), params);
+            affected += pstmt->executeUpdate();
+        }
+
+        conn->commit();
+        conn->setAutoCommit(true);
+        releaseConnection(conn);
+        return affected;
+    }
+    catch (exception &e)
+    {
+        LOGE("MySQL batch insert into {} failed ({} rows): {}", table, rows.size(), e.what());
+        if (conn)
+        {
+            try
+            {
+                conn->rollback();
+                conn->setAutoCommit(true);
+            }
+            catch (exception &rollbackError)
+            {
+                LOGE("MySQL rollback failed: {}", rollbackError.what());
+            }
+            releaseConnection(conn);
+        }
+        return -1;
+    }
+}
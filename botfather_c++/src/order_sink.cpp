@@ -0,0 +1,349 @@
+#include "order_sink.h"
+#include "mysql_connector.h"
+#include "binance_future.h"
+#include "util.h"
+
+static const vector<string> ORDER_COLUMNS = {"symbol", "broker", "timeframe", "orderType", "volume", "stop", "entry", "tp", "sl", "status", "createdTime", "expiredTime", "botID"};
+
+static double roundDigit(double value, int digit)
+{
+    double p = pow(10, digit);
+    return round(value * p) / p;
+}
+
+// làm tròn params theo digit và điền dạng string vào node để gửi sàn
+static void roundOrderParams(OrderParams &params, NodeData &node, const Digit &digit)
+{
+    params.entry = roundDigit(params.entry, digit.prices);
+    params.sl = roundDigit(params.sl, digit.prices);
+    params.tp = roundDigit(params.tp, digit.prices);
+    params.volume = roundDigit(params.volume, digit.volume);
+
+    node.entry = doubleToString(params.entry, digit.prices);
+    node.sl = doubleToString(params.sl, digit.prices);
+    node.tp = doubleToString(params.tp, digit.prices);
+    node.volume = doubleToString(params.volume, digit.volume);
+    if (params.hasStop)
+    {
+        params.stop = roundDigit(params.stop, digit.prices);
+        node.stop = doubleToString(params.stop, digit.prices);
+    }
+    if (params.hasExpiredTime)
+    {
+        node.expiredTime = to_string(params.expiredTime);
+    }
+}
+
+static bool isRealOrder(const PendingOrder &order)
+{
+    const Bot &bot = *order.bot;
+    return order.broker == "binance_future" && bot.enableRealOrder && !bot.apiKey.empty() && !bot.secretKey.empty() && !bot.iv.empty();
+}
+
+static vector<any> orderRow(const PendingOrder &pendingOrder)
+{
+    const OrderParams &order = pendingOrder.params;
+    vector<any> args;
+    args.reserve(ORDER_COLUMNS.size());
+    args.push_back(pendingOrder.symbol);
+    args.push_back(pendingOrder.broker);
+    args.push_back(pendingOrder.timeframe);
+    args.push_back(pendingOrder.node.type);
+    args.push_back(order.volume);
+    // như code cũ push NULL (0L): lưu 0, không phải SQL NULL
+    if (!order.hasStop)
+    {
+        args.push_back((int64_t)0);
+    }
+    else
+    {
+        args.push_back(order.stop);
+    }
+    args.push_back(order.entry);
+    args.push_back(order.tp);
+    args.push_back(order.sl);
+    args.push_back(ORDER_STATUS::OPENED);
+    args.push_back(nextTime(pendingOrder.createdTime, pendingOrder.timeframe));
+    if (!order.hasExpiredTime || order.expiredTime == 0)
+    {
+        args.push_back((int64_t)0);
+    }
+    else
+    {
+        args.push_back((double)order.expiredTime);
+    }
+    args.push_back(pendingOrder.bot->id);
+    return args;
+}
+
+static void updateMax(atomic<uint64_t> &value, uint64_t candidate)
+{
+    uint64_t current = value.load(memory_order_relaxed);
+    while (candidate > current && !value.compare_exchange_weak(current, candidate, memory_order_relaxed))
+    {
+    }
+}
+
+OrderSink::OrderSink()
+{
+    lastReport = chrono::steady_clock::now();
+    flushThread = thread(&OrderSink::flushLoop, this);
+    for (int i = 0; i < REAL_ORDER_THREADS; i++)
+    {
+        realThreads.emplace_back(&OrderSink::realOrderLoop, this);
+    }
+    LOGI("Order sink started: batch {} orders / {} ms, {} real order threads", MAX_BATCH, FLUSH_INTERVAL_MS, REAL_ORDER_THREADS);
+}
+
+OrderSink::~OrderSink()
+{
+    // ghi nốt các lệnh còn trong hàng đợi rồi mới dừng
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    flushCond.notify_all();
+    realCond.notify_all();
+    flushThread.join();
+    for (thread &t : realThreads)
+        t.join();
+}
+
+OrderSink &OrderSink::getInstance()
+{
+    static OrderSink instance;
+    return instance;
+}
+
+void OrderSink::submit(PendingOrder order)
+{
+    // chỉ làm tròn theo digit lúc gửi lệnh
+    roundOrderParams(order.params, order.node, order.digit);
+    order.submittedAt = chrono::steady_clock::now();
+    submitted.fetch_add(1, memory_order_relaxed);
+
+    bool real = isRealOrder(order);
+    {
+        lock_guard<mutex> lock(mtx);
+        if (real)
+        {
+            realOrders.push_back(order);
+            maxRealQueueDepth = max(maxRealQueueDepth, realOrders.size());
+        }
+        pending.push_back(move(order));
+        maxQueueDepth = max(maxQueueDepth, pending.size());
+    }
+    if (real)
+        realCond.notify_one();
+    flushCond.notify_one();
+}
+
+void OrderSink::flushLoop()
+{
+    vector<PendingOrder> batch;
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(mtx);
+            flushCond.wait(lock, [this]
+                           { return stopping || !pending.empty(); });
+            if (pending.empty())
+                return;
+
+            // lệnh đầu tiên của lô đã tới, đợi thêm tối đa FLUSH_INTERVAL_MS hoặc tới khi đủ MAX_BATCH
+            flushCond.wait_for(lock, chrono::milliseconds(FLUSH_INTERVAL_MS), [this]
+                               { return stopping || pending.size() >= MAX_BATCH; });
+
+            size_t count = min(pending.size(), (size_t)MAX_BATCH);
+            batch.assign(make_move_iterator(pending.begin()), make_move_iterator(pending.begin() + count));
+            pending.erase(pending.begin(), pending.begin() + count);
+        }
+
+        try
+        {
+            writeBatch(batch);
+        }
+        catch (const exception &e)
+        {
+            // lỗi trước khi ghi được dòng nào (ghi từng dòng đã tự bắt lỗi), cả lô bị bỏ
+            LOGE("Failed to write {} orders: {}", batch.size(), e.what());
+            failed.fetch_add(batch.size(), memory_order_relaxed);
+        }
+        catch (...)
+        {
+            LOGE("Failed to write {} orders: unknown error", batch.size());
+            failed.fetch_add(batch.size(), memory_order_relaxed);
+        }
+        batch.clear();
+        report();
+    }
+}
+
+void OrderSink::writeBatch(const vector<PendingOrder> &batch)
+{
+    vector<vector<any>> rows;
+    rows.reserve(batch.size());
+    for (const PendingOrder &order : batch)
+    {
+        const NodeData &node = order.node;
+        LOGI("New order - BotName: {}. BotID: {}, Type: {}, Broker: {}, Symbol: {}, Timeframe: {}, Entry: {}, Stop: {}, TP: {}, SL: {}, Volume: {}, ExpiredTime: {}",
+             order.bot->botName, order.bot->id, node.type, order.broker, order.symbol, order.timeframe,
+             node.entry, node.stop, node.tp, node.sl,
+             node.volume, node.expiredTime);
+        LOGI("open: {}, high: {}, low: {}, close: {}, startTime: {}, timestring: {}", order.open, order.high, order.low, order.close, order.createdTime, toTimeString(order.createdTime));
+        LOGI("digit: {}, {}", order.digit.prices, order.digit.volume);
+        rows.push_back(orderRow(order));
+    }
+
+    auto &db = MySQLConnector::getInstance();
+    auto start = chrono::steady_clock::now();
+    int affected = db.executeBatchInsert("Orders", ORDER_COLUMNS, rows);
+    if (affected < 0)
+    {
+        // cả lô bị rollback: ghi lại từng dòng để 1 dòng lỗi không làm mất cả lô
+        string query = "INSERT INTO Orders(symbol,broker,timeframe,orderType,volume,stop,entry,tp,sl,status,createdTime,expiredTime,botID) VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?)";
+        affected = 0;
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            int result = -1;
+            try
+            {
+                result = db.executeUpdate(query, rows[i]);
+            }
+            catch (const exception &e)
+            {
+                LOGE("Insert order error: {}", e.what());
+            }
+            if (result <= 0)
+            {
+                LOGE("Failed to insert order into database. BotName: {}, Symbol: {}", batch[i].bot->botName, batch[i].symbol);
+                failed.fetch_add(1, memory_order_relaxed);
+                continue;
+            }
+            affected++;
+        }
+    }
+    auto end = chrono::steady_clock::now();
+
+    uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    batches.fetch_add(1, memory_order_relaxed);
+    written.fetch_add(affected, memory_order_relaxed);
+    flushNs.fetch_add(elapsed, memory_order_relaxed);
+    updateMax(maxFlushNs, elapsed);
+    // lệnh đầu lô chờ lâu nhất
+    updateMax(maxLatencyNs, chrono::duration_cast<chrono::nanoseconds>(end - batch.front().submittedAt).count());
+}
+
+void OrderSink::realOrderLoop()
+{
+    while (true)
+    {
+        PendingOrder order;
+        {
+            unique_lock<mutex> lock(mtx);
+            realCond.wait(lock, [this]
+                          { return stopping || !realOrders.empty(); });
+            if (realOrders.empty())
+                return;
+            order = move(realOrders.front());
+            realOrders.pop_front();
+        }
+
+        try
+        {
+            sendRealOrder(order);
+        }
+        catch (const exception &e)
+        {
+            LOGE("Real order {} failed: {}", order.bot->botName, e.what());
+        }
+    }
+}
+
+void OrderSink::sendRealOrder(const PendingOrder &order)
+{
+    const Bot &bot = *order.bot;
+    const NodeData &node = order.node;
+    const string &symbol = order.symbol;
+
+    LOGI("Real order {}", bot.botName);
+    shared_ptr<BinanceFuture> exchange = make_shared<BinanceFuture>(bot.apiKey, bot.secretKey, bot.iv, bot.id);
+
+    if (node.kind == NodeKind::BUY_MARKET)
+    {
+        if (compareStringNumber(node.tp, node.entry) > 0 && compareStringNumber(node.sl, node.entry) < 0)
+        {
+            exchange->buyMarket(symbol, node.volume, node.tp, node.sl);
+        }
+        else
+        {
+            LOGE("Invalid TP or SL for BUY_MARKET order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
+        }
+    }
+    else if (node.kind == NodeKind::BUY_LIMIT)
+    {
+        if (compareStringNumber(node.tp, node.entry) > 0 && compareStringNumber(node.sl, node.entry) < 0)
+        {
+            exchange->buyLimit(symbol, node.volume, node.entry, node.tp, node.sl, node.expiredTime);
+        }
+        else
+        {
+            LOGE("Invalid TP or SL for BUY_LIMIT order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
+        }
+    }
+    else if (node.kind == NodeKind::SELL_MARKET)
+    {
+        if (compareStringNumber(node.tp, node.entry) < 0 && compareStringNumber(node.sl, node.entry) > 0)
+        {
+            exchange->sellMarket(symbol, node.volume, node.tp, node.sl);
+        }
+        else
+        {
+            LOGE("Invalid TP or SL for SELL_MARKET order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
+        }
+    }
+    else if (node.kind == NodeKind::SELL_LIMIT)
+    {
+        if (compareStringNumber(node.tp, node.entry) < 0 && compareStringNumber(node.sl, node.entry) > 0)
+        {
+            exchange->sellLimit(symbol, node.volume, node.entry, node.tp, node.sl, node.expiredTime);
+        }
+        else
+        {
+            LOGE("Invalid TP or SL for SELL_LIMIT order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
+        }
+    }
+}
+
+void OrderSink::report()
+{
+    auto now = chrono::steady_clock::now();
+    if (now - lastReport < chrono::seconds(REPORT_INTERVAL_S))
+        return;
+    lastReport = now;
+
+    OrderSinkStats stats = getStats();
+    LOGI("Order sink: {} submitted, {} written, {} failed, {} batches, queue {} (max {}), real queue {} (max {}), flush avg {:.1f} ms max {:.1f} ms, latency max {:.1f} ms",
+         stats.submitted, stats.written, stats.failed, stats.batches, stats.queueDepth, stats.maxQueueDepth,
+         stats.realQueueDepth, stats.maxRealQueueDepth, stats.avgFlushMs, stats.maxFlushMs, stats.maxLatencyMs);
+}
+
+OrderSinkStats OrderSink::getStats()
+{
+    OrderSinkStats stats;
+    {
+        lock_guard<mutex> lock(mtx);
+        stats.queueDepth = pending.size();
+        stats.maxQueueDepth = maxQueueDepth;
+        stats.realQueueDepth = realOrders.size();
+        stats.maxRealQueueDepth = maxRealQueueDepth;
+    }
+    stats.submitted = submitted.load(memory_order_relaxed);
+    stats.written = written.load(memory_order_relaxed);
+    stats.failed = failed.load(memory_order_relaxed);
+    stats.batches = batches.load(memory_order_relaxed);
+    stats.avgFlushMs = stats.batches == 0 ? 0.0 : flushNs.load(memory_order_relaxed) / 1e6 / stats.batches;
+    stats.maxFlushMs = maxFlushNs.load(memory_order_relaxed) / 1e6;
+    stats.maxLatencyMs = maxLatencyNs.load(memory_order_relaxed) / 1e6;
+    return stats;
+}
@@ -1,15 +1,13 @@
 #include "socket_data.h"
 #include "util.h"
 #include "thread_pool.h"
-#include "vector_pool.h"
 #include "worker.h"
 #include "redis.h"
 #include <tbb/task_group.h>
 
 static tbb::task_group task;
+thread_local Arena exprArena; // khai báo trước worker để hủy sau worker
 thread_local Worker worker;
-thread_local VectorDoublePool vectorDoublePool;
-thread_local SparseTablePool sparseTablePool;
 
 SocketData::SocketData(const int _BATCH_SIZE) : BATCH_SIZE(_BATCH_SIZE), firstConnection(true)
 {
@@ -52,15 +50,20 @@ void SocketData::onCloseCandle(const string &symbol, string &timeframe, RateData
     if (rateData.startTime.size() < 15)
         return;
 
+    shared_ptr<const BotList> botList = atomic_load(&this->botList);
     if (!botList)
         return;
 
-    vector<double> open(rateData.open.begin(), rateData.open.end());
-    vector<double> high(rateData.high.begin(), rateData.high.end());
-    vector<double> low(rateData.low.begin(), rateData.low.end());
-    vector<double> close(rateData.close.begin(), rateData.close.end());
-    vector<double> volume(rateData.volume.begin(), rateData.volume.end());
-    vector<long long> startTime(rateData.startTime.begin(), rateData.startTime.end());
+    // chỉ copy số nến mà các bot trên series này cần, không có bot nào thì không cần chạy worker
+    auto it = botList->lookbacks.find(broker + ":" + symbol + "_" + timeframe);
+    int n = it == botList->lookbacks.end() ? 0 : min<int>(it->second, rateData.startTime.size());
+
+    vector<double> open(rateData.open.begin(), rateData.open.begin() + n);
+    vector<double> high(rateData.high.begin(), rateData.high.begin() + n);
+    vector<double> low(rateData.low.begin(), rateData.low.begin() + n);
+    vector<double> close(rateData.close.begin(), rateData.close.begin() + n);
+    vector<double> volume(rateData.volume.begin(), rateData.volume.begin() + n);
+    vector<long long> startTime(rateData.startTime.begin(), rateData.startTime.begin() + n);
 
     if (digits.find(symbol) == digits.end())
     {
@@ -68,21 +71,24 @@ void SocketData::onCloseCandle(const string &symbol, string &timeframe, RateData
         throw runtime_error("No digit found for symbol " + symbol);
     }
 
-    task.run([botList = botList,
-              broker = broker,
-              symbol = symbol,
-              timeframe = timeframe,
-              open = move(open),
-              high = move(high),
-              low = move(low),
-              close = move(close),
-              volume = move(volume),
-              startTime = move(startTime),
-              digit = digits[symbol],
-              funding = fundingRates[symbol]]()
-             { 
-                worker.init(botList, broker, symbol, timeframe, move(open), move(high), move(low), move(close), move(volume), move(startTime), digit, funding);
-                worker.run(); });
+    if (n > 0)
+    {
+        task.run([botList = botList,
+                  broker = broker,
+                  symbol = symbol,
+                  timeframe = timeframe,
+                  open = move(open),
+                  high = move(high),
+                  low = move(low),
+                  close = move(close),
+                  volume = move(volume),
+                  startTime = move(startTime),
+                  digit = digits[symbol],
+                  funding = fundingRates[symbol]]()
+                 { 
+                    worker.init(botList, broker, symbol, timeframe, move(open), move(high), move(low), move(close), move(volume), move(startTime), digit, funding);
+                    worker.run(); });
+    }
 
     if (rand() % 10 == 0)
     {
@@ -429,8 +435,8 @@ void SocketData::onSocketClosed(connection_hdl hdl)
     reconnectSocket();
 }
 
-void SocketData::setBotList(shared_ptr<vector<shared_ptr<Bot>>> botList)
+void SocketData::setBotList(shared_ptr<const BotList> botList)
 {
-    LOGD("{}: Set bot list with size: {}", broker, botList->size());
-    this->botList = botList;
+    LOGD("{}: Set bot list with size: {}", broker, botList->bots.size());
+    atomic_store(&this->botList, botList);
 }
\ No newline at end of file
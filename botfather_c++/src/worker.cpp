@@ -3,43 +3,14 @@
 #include "util.h"
 #include "timer.h"
 #include "expr.h"
-#include "mysql_connector.h"
 #include "telegram.h"
-#include "exchange.h"
-#include "binance_future.h"
-#include "thread_pool.h"
-#include "vector_pool.h"
+#include "expr_profiler.h"
+#include "series_store.h"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
 
-static vector<string> orderTypes = {NODE_TYPE::BUY_MARKET, NODE_TYPE::BUY_LIMIT, NODE_TYPE::BUY_STOP_MARKET, NODE_TYPE::BUY_STOP_LIMIT, NODE_TYPE::SELL_MARKET, NODE_TYPE::SELL_LIMIT, NODE_TYPE::SELL_STOP_MARKET, NODE_TYPE::SELL_STOP_LIMIT};
-static ThreadPool tasks(thread::hardware_concurrency() * 2 + 1);
-extern thread_local VectorDoublePool vectorDoublePool;
-extern thread_local SparseTablePool sparseTablePool;
-
-static int binarySearch(const vector<Symbol> &symbolList, const string &symbol)
-{
-    int left = 0;
-    int right = symbolList.size() - 1;
-
-    while (left <= right)
-    {
-        int mid = left + (right - left) / 2;
-        if (symbolList[mid].symbolName == symbol)
-        {
-            return mid;
-        }
-        else if (symbolList[mid].symbolName < symbol)
-        {
-            left = mid + 1;
-        }
-        else
-        {
-            right = mid - 1;
-        }
-    }
-    return -1;
-}
-
-void Worker::init(shared_ptr<vector<shared_ptr<Bot>>> botList, string broker, string symbol, string timeframe, vector<double> open, vector<double> high, vector<double> low, vector<double> close, vector<double> volume, vector<long long> startTime, Digit digit, double fundingRate)
+void Worker::init(shared_ptr<const BotList> botList, string broker, string symbol, string timeframe, vector<double> open, vector<double> high, vector<double> low, vector<double> close, vector<double> volume, vector<long long> startTime, Digit digit, double fundingRate)
 {
     this->botList = botList;
     this->broker = broker;
@@ -54,64 +25,195 @@ void Worker::init(shared_ptr<vector<shared_ptr<Bot>>> botList, string broker, st
     this->digit = digit;
     this->fundingRate = fundingRate;
 
-    this->visited.clear();
+    string series = SeriesIndex::key(broker, symbol, timeframe);
+    this->seriesId = botList->seriesIndex.find(series);
+    this->seriesMemo = SeriesStore::getInstance().get(series);
+    this->seriesLane.visited.clear();
     this->cachedExpr.clear();
+    this->seriesLane.dagMemo.reset(botList->dag ? botList->dag->size() : 0);
+}
+Expr Worker::createExpr()
+{
+    Expr expr(broker, symbol, timeframe, open.size(), open.data(), high.data(), low.data(), close.data(), volume.data(),
+              startTime.data(), fundingRate, &cachedIndicator, &cachedMinMax);
+    expr.setSeriesMemo(seriesMemo.get());
+    return expr;
+}
 
-    for (auto &pair : cachedIndicator)
-    {
-        vectorDoublePool.release(pair.second);
-    }
+void Worker::run()
+{
+    Timer timer(StringFormat("onCloseCandle {} {} {}", broker, symbol, timeframe));
+    lock_guard<mutex> lock(seriesMemo->mMutex);
+    seriesMemo->begin(startTime.data(), startTime.size());
+
+    // chỉ các bot theo dõi series này, theo thứ tự trong botList
+    static const vector<int> none;
+    const vector<int> &subscribed = seriesId < 0 ? none : botList->seriesIndex.bots(seriesId);
+    if (botList->dag && subscribed.size() >= PARALLEL_MIN_BOTS && tbb::this_task_arena::max_concurrency() > 1)
+        runParallel(subscribed);
+    else
+        runBots(subscribed, 0, subscribed.size(), seriesLane);
+    LOGD("Series memo {}:{} {}: {} entries, {} streams, {} hits, {} misses", broker, symbol, timeframe, seriesMemo->size(), seriesMemo->indicators.size(), seriesMemo->hits, seriesMemo->misses);
+    PROFILE_FLUSH();
+
+    // series, cột dẫn xuất, RangeQuery của lần đóng nến này đều nằm trong exprArena
+    cachedIndicator.clear();
+    cachedMinMax.clear();
+    if (exprArena.reset())
+        LOGI("Arena {}: high-water {} KB, reserved {} KB, all threads {} KB", exprArena.getId(), exprArena.highWaterMark() / 1024, exprArena.bytesReserved() / 1024, Arena::totalBytesReserved() / 1024);
+}
 
-    for (auto &pair : cachedMinMax)
+void Worker::runBots(const vector<int> &subscribed, size_t begin, size_t end, WorkerLane &lane)
+{
+    for (size_t i = begin; i < end; i++)
     {
-        sparseTablePool.release(move(pair.second));
+        const shared_ptr<Bot> &bot = botList->bots[subscribed[i]];
+        try
+        {
+            PROFILE_BOT(*bot);
+            runRoute(bot->program, bot, lane);
+        }
+        catch (const exception &e)
+        {
+            LOGE("Error in bot {}: {}", bot->botName, e.what());
+        }
     }
-
-    LOGI("cachedIndicator size: {}, vectorDoublePool size: {}", cachedIndicator.size(), vectorDoublePool.cached_count());
-    LOGI("cachedMinMax size: {}, sparseTablePool size: {}", cachedMinMax.size(), sparseTablePool.cached_count());
-
-    this->cachedIndicator.clear();
-    this->cachedMinMax.clear();
 }
-void Worker::run()
+
+// tính trước mọi leaf DAG của các bot vào dagMemo chung để lane song song chỉ còn đọc.
+// Tính cả leaf của các node mà chạy tuần tự bot đã bị loại trước khi tới, nên chỉ dùng cho series nhiều bot
+void Worker::warmUp(const vector<int> &subscribed)
 {
-    Timer timer(StringFormat("onCloseCandle {} {} {}", broker, symbol, timeframe));
-    for (const shared_ptr<Bot> &bot : *botList)
+    const ExprDag &dag = *botList->dag;
+    Expr expr = createExpr();
+    double value;
+    for (int position : subscribed)
     {
+        const shared_ptr<Bot> &bot = botList->bots[position];
         try
         {
-            if (binarySearch(bot->symbolList, broker + ":" + symbol) == -1)
+            for (int leaf : bot->program.leaves)
             {
-                continue;
+                expr.run(dag, leaf, seriesLane.dagMemo, value);
             }
-            if (find(bot->timeframes.begin(), bot->timeframes.end(), timeframe) == bot->timeframes.end())
-            {
-                continue;
-            }
-            visited.clear();
-            dfs_handleLogic(bot->route, bot);
         }
         catch (const exception &e)
         {
             LOGE("Error in bot {}: {}", bot->botName, e.what());
-            continue;
         }
     }
 }
 
-void Worker::dfs_handleLogic(Route &route, const shared_ptr<Bot> &bot)
+// chia bot thành các chunk cho TBB (work-stealing), mỗi thread 1 lane riêng
+void Worker::runParallel(const vector<int> &subscribed)
+{
+    static thread_local WorkerLane parallelLane;
+
+    warmUp(subscribed);
+    seriesArena = &exprArena;
+    int dagSize = botList->dag->size();
+
+    // isolate: thread đang đợi parallel_for chỉ nhận chunk của lần đóng nến này,
+    // không nhận Worker::run của series khác khi thread_local worker đang chạy dở
+    tbb::this_task_arena::isolate([&]
+                                  { tbb::parallel_for(tbb::blocked_range<size_t>(0, subscribed.size(), PARALLEL_GRAIN),
+                                                      [&](const tbb::blocked_range<size_t> &range)
+                                                      {
+                                                          parallelLane.dagMemo.reset(dagSize);
+                                                          parallelLane.shared = &seriesLane.dagMemo;
+                                                          runBots(subscribed, range.begin(), range.end(), parallelLane);
+                                                          // số liệu profile nằm trong thread_local của thread chạy chunk
+                                                          PROFILE_FLUSH();
+                                                      }); });
+}
+
+// sắp node theo cost / (1 - p) tăng dần: node rẻ và hay fail đứng trước.
+// node chưa đo được cost thì coi như 0 để lần sau được đánh giá sớm và đo
+static void reorderChain(ExprChain &chain)
+{
+    int n = chain.nodes.size();
+    vector<double> rank(n);
+    for (int i = 0; i < n; i++)
+    {
+        const ExprNodeStats &stats = chain.stats[i];
+        uint64_t evals = stats.evals.load(memory_order_relaxed);
+        uint64_t passes = stats.passes.load(memory_order_relaxed);
+        uint64_t samples = stats.samples.load(memory_order_relaxed);
+        double cost = samples == 0 ? 0.0 : static_cast<double>(stats.sampledNs.load(memory_order_relaxed)) / samples;
+        double p = (passes + 1.0) / (evals + 2.0);
+        rank[i] = cost / (1.0 - p);
+    }
+
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&rank](int a, int b)
+                { return rank[a] < rank[b]; });
+    atomic_store(&chain.order, make_shared<const vector<int>>(move(order)));
+}
+
+bool Worker::handleChain(ExprChain &chain, const shared_ptr<Bot> &bot, WorkerLane &lane)
 {
-    long long keyID = (route.id.empty() || route.id == "start") ? 0 : stoll(route.id);
-    if (visited[keyID])
+    uint64_t run = chain.runs.fetch_add(1, memory_order_relaxed);
+    bool sampled = run % CHAIN_SAMPLE_RATE == 0;
+    if (run % CHAIN_REORDER_INTERVAL == CHAIN_REORDER_INTERVAL - 1)
     {
-        return;
+        reorderChain(chain);
     }
-    visited[keyID] = true;
-    if (handleLogic(route.data, bot))
+
+    shared_ptr<const vector<int>> order = atomic_load(&chain.order);
+    for (int i : *order)
     {
-        for (Route &next : route.next)
+        if (!lane.visit(chain.ids[i]))
+            return false;
+
+        ExprNodeStats &stats = chain.stats[i];
+        auto start = sampled ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+        bool pass = handleLogic(*chain.nodes[i], bot, lane);
+        if (sampled)
         {
-            dfs_handleLogic(next, bot);
+            stats.samples.fetch_add(1, memory_order_relaxed);
+            stats.sampledNs.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(), memory_order_relaxed);
+        }
+        stats.evals.fetch_add(1, memory_order_relaxed);
+        if (!pass)
+            return false;
+        stats.passes.fetch_add(1, memory_order_relaxed);
+    }
+    return true;
+}
+
+bool WorkerLane::visit(int id)
+{
+    uint64_t bit = 1ULL << (id & 63);
+    uint64_t &word = visited[id >> 6];
+    if (word & bit)
+        return false;
+    word |= bit;
+    return true;
+}
+
+void Worker::runRoute(const RouteProgram &program, const shared_ptr<Bot> &bot, WorkerLane &lane)
+{
+    if (program.steps.empty())
+        return;
+
+    vector<int> &pending = lane.pending;
+    lane.visited.assign((program.visitCount + 63) / 64, 0);
+    pending.clear();
+    pending.push_back(0);
+    while (!pending.empty())
+    {
+        const RouteStep &step = program.steps[pending.back()];
+        pending.pop_back();
+
+        bool pass = step.chain ? handleChain(*step.chain, bot, lane) : lane.visit(step.visitId) && handleLogic(*step.data, bot, lane);
+        if (!pass)
+            continue;
+
+        // đẩy ngược để con đầu tiên chạy trước, cùng thứ tự DFS với route
+        for (int i = step.childCount - 1; i >= 0; i--)
+        {
+            pending.push_back(program.children[step.firstChild + i]);
         }
     }
 }
@@ -141,323 +243,236 @@ any Worker::calculate(string &expr)
     return result;
 }
 
-bool Worker::adjustParam(NodeData &node)
+bool Worker::calculateParam(const string &text, const shared_ptr<const Program> &program, double &result)
 {
-    // stop
-    if (node.type == NODE_TYPE::BUY_STOP_MARKET || node.type == NODE_TYPE::BUY_STOP_LIMIT)
+    if (program)
     {
-        if (node.stop.empty())
-            return false;
+        Expr expr = createExpr();
+        return expr.run(*program, result);
+    }
 
-        string expr = node.stop;
-        expr = calculateSub(expr);
-        if (node.unitStop == UNIT::PERCENT)
-        {
-            expr = StringFormat("close() * (100 + abs({})) / 100", expr);
-        }
+    // template có {} lồng nhau, tính như cũ
+    string expr = text;
+    expr = calculateSub(expr);
+    any value = calculate(expr);
+    if (!value.has_value() || value.type() != typeid(double))
+        return false;
 
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate stop error. expr={}", node.stop);
-            return false;
-        }
+    result = any_cast<double>(value);
+    return true;
+}
 
-        node.stop = doubleToString(any_cast<double>(result), digit.prices);
-    }
-    else if (node.type == NODE_TYPE::SELL_STOP_MARKET || node.type == NODE_TYPE::SELL_STOP_LIMIT)
+bool Worker::adjustParam(const NodeData &node, OrderParams &params)
+{
+    NodeKind kind = node.kind;
+    if (!isOrderKind(kind))
+        return false;
+
+    static const OrderTemplate emptyTemplate;
+    const OrderTemplate &order = node.order ? *node.order : emptyTemplate;
+
+    bool isBuy = isBuyKind(kind);
+    double closePrice = close[0];
+    double value;
+
+    // stop
+    params.hasStop = false;
+    if (kind == NodeKind::BUY_STOP_MARKET || kind == NodeKind::BUY_STOP_LIMIT || kind == NodeKind::SELL_STOP_MARKET || kind == NodeKind::SELL_STOP_LIMIT)
     {
         if (node.stop.empty())
             return false;
 
-        string expr = node.stop;
-        expr = calculateSub(expr);
-        if (node.unitStop == UNIT::PERCENT)
-        {
-            expr = StringFormat("close() * (100 - abs({})) / 100", expr);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
+        if (!calculateParam(node.stop, order.stop, value))
         {
             LOGE("Calculate stop error. expr={}", node.stop);
             return false;
         }
+        if (node.unitStop == UNIT::PERCENT)
+        {
+            value = isBuy ? closePrice * (100 + abs(value)) / 100 : closePrice * (100 - abs(value)) / 100;
+        }
 
-        node.stop = doubleToString(any_cast<double>(result), digit.prices);
-    }
-    else
-    {
-        node.stop = "";
+        params.stop = value;
+        params.hasStop = true;
     }
 
     // entry
-    if (node.type == NODE_TYPE::BUY_LIMIT || node.type == NODE_TYPE::BUY_STOP_LIMIT)
+    if (kind == NodeKind::BUY_LIMIT || kind == NodeKind::BUY_STOP_LIMIT || kind == NodeKind::SELL_LIMIT || kind == NodeKind::SELL_STOP_LIMIT)
     {
         if (node.entry.empty())
             return false;
 
-        string expr = node.entry;
-        expr = calculateSub(expr);
-        if (node.unitEntry == UNIT::PERCENT)
-        {
-            expr = StringFormat("close() * (100 - abs({})) / 100", expr);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
+        if (!calculateParam(node.entry, order.entry, value))
         {
             LOGE("Calculate entry error. expr={}", node.entry);
             return false;
         }
-
-        node.entry = doubleToString(any_cast<double>(result), digit.prices);
-    }
-    else if (node.type == NODE_TYPE::SELL_LIMIT || node.type == NODE_TYPE::SELL_STOP_LIMIT)
-    {
-        if (node.entry.empty())
-            return false;
-
-        string expr = node.entry;
-        expr = calculateSub(expr);
         if (node.unitEntry == UNIT::PERCENT)
         {
-            expr = StringFormat("close() * (100 + abs({})) / 100", expr);
+            value = isBuy ? closePrice * (100 - abs(value)) / 100 : closePrice * (100 + abs(value)) / 100;
         }
 
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate entry error. expr={}", node.entry);
-            return false;
-        }
-
-        node.entry = doubleToString(any_cast<double>(result), digit.prices);
+        params.entry = value;
     }
-    else if (node.type == NODE_TYPE::BUY_STOP_MARKET || node.type == NODE_TYPE::SELL_STOP_MARKET)
+    else if (kind == NodeKind::BUY_STOP_MARKET || kind == NodeKind::SELL_STOP_MARKET)
     {
-        node.entry = node.stop;
+        params.entry = params.stop;
     }
-    else if (node.type == NODE_TYPE::BUY_MARKET || node.type == NODE_TYPE::SELL_MARKET)
+    else
     {
-        node.entry = doubleToString(close[0], digit.prices);
+        params.entry = closePrice;
     }
 
-    double closePrice = close[0];
-    double entry = stod(node.entry);
-    double stop = node.stop.empty() ? 0 : stod(node.stop);
     // match entry immediately
-    if (node.type == NODE_TYPE::BUY_LIMIT && closePrice <= entry)
+    if (kind == NodeKind::BUY_LIMIT && closePrice <= params.entry)
     {
-        node.entry = doubleToString(closePrice, digit.prices);
+        params.entry = closePrice;
     }
-    else if (node.type == NODE_TYPE::BUY_STOP_LIMIT && closePrice <= entry && closePrice >= stop)
+    else if (kind == NodeKind::BUY_STOP_LIMIT && closePrice <= params.entry && closePrice >= params.stop)
     {
-        node.entry = doubleToString(closePrice, digit.prices);
+        params.entry = closePrice;
     }
-    else if (node.type == NODE_TYPE::SELL_LIMIT && closePrice >= entry)
+    else if (kind == NodeKind::SELL_LIMIT && closePrice >= params.entry)
     {
-        node.entry = doubleToString(closePrice, digit.prices);
+        params.entry = closePrice;
     }
-    else if (node.type == NODE_TYPE::SELL_STOP_LIMIT && closePrice >= entry && closePrice <= stop)
+    else if (kind == NodeKind::SELL_STOP_LIMIT && closePrice >= params.entry && closePrice <= params.stop)
     {
-        node.entry = doubleToString(closePrice, digit.prices);
+        params.entry = closePrice;
     }
 
     // sl
-    if (node.type == NODE_TYPE::BUY_MARKET || node.type == NODE_TYPE::BUY_LIMIT || node.type == NODE_TYPE::BUY_STOP_MARKET || node.type == NODE_TYPE::BUY_STOP_LIMIT)
-    {
-        if (node.sl.empty())
-            return false;
-
-        string expr = node.sl;
-        expr = calculateSub(expr);
-        if (node.unitSL == UNIT::PERCENT)
-        {
-            expr = StringFormat("({}) * (100 - abs({})) / 100", node.entry, expr);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate SL error. expr={}", node.sl);
-            return false;
-        }
+    if (node.sl.empty())
+        return false;
 
-        node.sl = doubleToString(any_cast<double>(result), digit.prices);
-    }
-    else if (node.type == NODE_TYPE::SELL_MARKET || node.type == NODE_TYPE::SELL_LIMIT || node.type == NODE_TYPE::SELL_STOP_MARKET || node.type == NODE_TYPE::SELL_STOP_LIMIT)
+    if (!calculateParam(node.sl, order.sl, value))
     {
-        if (node.sl.empty())
-            return false;
-
-        string expr = node.sl;
-        expr = calculateSub(expr);
-        if (node.unitSL == UNIT::PERCENT)
-        {
-            expr = StringFormat("({}) * (100 + abs({})) / 100", node.entry, expr);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate SL error. expr={}", node.sl);
-            return false;
-        }
-
-        node.sl = doubleToString(any_cast<double>(result), digit.prices);
+        LOGE("Calculate SL error. expr={}", node.sl);
+        return false;
     }
-    else
+    if (node.unitSL == UNIT::PERCENT)
     {
-        node.sl = "";
+        value = isBuy ? params.entry * (100 - abs(value)) / 100 : params.entry * (100 + abs(value)) / 100;
     }
+    params.sl = value;
 
     // tp
-    if (node.type == NODE_TYPE::BUY_MARKET || node.type == NODE_TYPE::BUY_LIMIT || node.type == NODE_TYPE::BUY_STOP_MARKET || node.type == NODE_TYPE::BUY_STOP_LIMIT)
-    {
-        if (node.tp.empty())
-            return false;
-
-        string expr = node.tp;
-        expr = calculateSub(expr);
-        if (node.unitTP == UNIT::PERCENT)
-        {
-            expr = StringFormat("({}) * (100 + abs({})) / 100", node.entry, expr);
-        }
-        else if (node.unitTP == UNIT::RR)
-        {
-            expr = StringFormat("({} + abs({} - {}) * abs({}))", node.entry, node.entry, node.sl, expr);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate TP error. expr={}", node.tp);
-            return false;
-        }
+    if (node.tp.empty())
+        return false;
 
-        node.tp = doubleToString(any_cast<double>(result), digit.prices);
+    if (!calculateParam(node.tp, order.tp, value))
+    {
+        LOGE("Calculate TP error. expr={}", node.tp);
+        return false;
     }
-    else if (node.type == NODE_TYPE::SELL_MARKET || node.type == NODE_TYPE::SELL_LIMIT || node.type == NODE_TYPE::SELL_STOP_MARKET || node.type == NODE_TYPE::SELL_STOP_LIMIT)
+    if (node.unitTP == UNIT::PERCENT)
     {
-        if (node.tp.empty())
-            return false;
-
-        string expr = node.tp;
-        expr = calculateSub(expr);
-        if (node.unitTP == UNIT::PERCENT)
-        {
-            expr = StringFormat("({}) * (100 - abs({})) / 100", node.entry, expr);
-        }
-        else if (node.unitTP == UNIT::RR)
-        {
-            expr = StringFormat("({} - abs({} - {}) * abs({}))", node.entry, node.entry, node.sl, expr);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate TP error. expr={}", node.tp);
-            return false;
-        }
-
-        node.tp = doubleToString(any_cast<double>(result), digit.prices);
+        value = isBuy ? params.entry * (100 + abs(value)) / 100 : params.entry * (100 - abs(value)) / 100;
     }
-    else
+    else if (node.unitTP == UNIT::RR)
     {
-        node.tp = "";
+        double risk = abs(params.entry - params.sl) * abs(value);
+        value = isBuy ? params.entry + risk : params.entry - risk;
     }
+    params.tp = value;
 
     // volume
-    if (find(orderTypes.begin(), orderTypes.end(), node.type) != orderTypes.end())
-    {
-        if (node.volume.empty())
-            return false;
-
-        string expr = node.volume;
-        expr = calculateSub(expr);
-        if (node.unitVolume == UNIT::USD)
-        {
-            expr = StringFormat("({}) / {}", expr, node.entry);
-        }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
-        {
-            LOGE("Calculate volume error. expr={}", node.volume);
-            return false;
-        }
+    if (node.volume.empty())
+        return false;
 
-        node.volume = doubleToString(any_cast<double>(result), digit.volume);
+    if (!calculateParam(node.volume, order.volume, value))
+    {
+        LOGE("Calculate volume error. expr={}", node.volume);
+        return false;
     }
-    else
+    if (node.unitVolume == UNIT::USD)
     {
-        node.volume = "";
+        value = value / params.entry;
     }
+    params.volume = value;
 
     // expired time
-    if (node.type == NODE_TYPE::BUY_LIMIT || node.type == NODE_TYPE::BUY_STOP_MARKET || node.type == NODE_TYPE::BUY_STOP_LIMIT || node.type == NODE_TYPE::SELL_LIMIT || node.type == NODE_TYPE::SELL_STOP_MARKET || node.type == NODE_TYPE::SELL_STOP_LIMIT)
+    params.hasExpiredTime = false;
+    if (kind != NodeKind::BUY_MARKET && kind != NodeKind::SELL_MARKET)
     {
         if (node.expiredTime.empty() || node.expiredTime == "0")
             return false;
 
-        string expr = node.expiredTime;
-        expr = calculateSub(expr);
-        if (node.unitExpiredTime == UNIT::MINUTE)
+        if (!calculateParam(node.expiredTime, order.expiredTime, value))
         {
-            expr = StringFormat("(({}) * 60000) + {}", expr, nextTime(startTime[0], timeframe));
+            LOGE("Calculate expiredTime error. expr={}", node.expiredTime);
+            return false;
         }
-        else if (node.unitExpiredTime == UNIT::CANDLE)
+        if (node.unitExpiredTime == UNIT::MINUTE)
         {
-            expr = StringFormat("(({}) * 60000 * {}) + {}", expr, timeframeToNumberMinutes(timeframe), nextTime(startTime[0], timeframe));
+            value = value * 60000 + nextTime(startTime[0], timeframe);
         }
-
-        any result = calculate(expr);
-        if (!result.has_value() || result.type() != typeid(double))
+        else if (node.unitExpiredTime == UNIT::CANDLE)
         {
-            LOGE("Calculate expiredTime error. expr={}", node.expiredTime);
-            return false;
+            value = value * 60000 * timeframeToNumberMinutes(timeframe) + nextTime(startTime[0], timeframe);
         }
 
-        node.expiredTime = to_string((long long)any_cast<double>(result));
-    }
-    else
-    {
-        node.expiredTime = "";
+        params.expiredTime = (long long)value;
+        params.hasExpiredTime = true;
     }
 
     // match TP, SL immediately
-    entry = stod(node.entry);
-    double sl = stod(node.sl);
-    double tp = stod(node.tp);
-    if (node.type == NODE_TYPE::BUY_MARKET || node.type == NODE_TYPE::BUY_LIMIT || node.type == NODE_TYPE::BUY_STOP_MARKET || node.type == NODE_TYPE::BUY_STOP_LIMIT)
+    if (isBuy)
     {
-        if (entry <= sl)
-            node.sl = node.entry;
-        if (entry >= tp)
-            node.tp = node.entry;
+        if (params.entry <= params.sl)
+            params.sl = params.entry;
+        if (params.entry >= params.tp)
+            params.tp = params.entry;
     }
-    else if (node.type == NODE_TYPE::SELL_MARKET || node.type == NODE_TYPE::SELL_LIMIT || node.type == NODE_TYPE::SELL_STOP_MARKET || node.type == NODE_TYPE::SELL_STOP_LIMIT)
+    else
     {
-        if (entry >= sl)
-            node.sl = node.entry;
-        if (entry <= tp)
-            node.tp = node.entry;
+        if (params.entry >= params.sl)
+            params.sl = params.entry;
+        if (params.entry <= params.tp)
+            params.tp = params.entry;
     }
 
     return true;
 }
 
-bool Worker::handleLogic(NodeData &nodeData, const shared_ptr<Bot> &bot)
+bool Worker::handleLogic(NodeData &nodeData, const shared_ptr<Bot> &bot, WorkerLane &lane)
 {
-    if (nodeData.type == NODE_TYPE::START)
+    if (nodeData.kind == NodeKind::START)
         return true;
 
-    if (nodeData.type == NODE_TYPE::EXPR)
+    if (nodeData.kind == NodeKind::EXPR && nodeData.dagNode >= 0)
+    {
+        Expr expr = createExpr();
+        double value;
+        if (!expr.run(*botList->dag, nodeData.dagNode, lane.dagMemo, value, lane.shared))
+        {
+            LOGD("No result. symbol: {}:{}, timeframe: {}, expr={}", broker, symbol, timeframe, nodeData.value);
+            return false;
+        }
+        return value != 0.0;
+    }
+
+    if (!lane.shared)
+        return handleAction(nodeData, bot);
+
+    // lane song song: phần còn lại đọc/ghi cache chung của series (cachedIndicator, seriesMemo, messageBuffer)
+    // nên chạy lần lượt, cấp phát trên arena của thread series để sống tới cuối lần đóng nến
+    lock_guard<mutex> lock(actionMutex);
+    ArenaScope scope(*seriesArena);
+    return handleAction(nodeData, bot);
+}
+
+// expr không có trong DAG, telegram, đặt lệnh
+bool Worker::handleAction(NodeData &nodeData, const shared_ptr<Bot> &bot)
+{
+    if (nodeData.kind == NodeKind::EXPR)
     {
-        any result = calculateExpr(nodeData.value, broker, symbol, timeframe, open.size(),
-                                   open.data(), high.data(), low.data(), close.data(), volume.data(),
-                                   startTime.data(), fundingRate, &cachedIndicator, &cachedMinMax);
+        any result = nodeData.program ? calculateExpr(*nodeData.program, broker, symbol, timeframe, open.size(),
+                                                      open.data(), high.data(), low.data(), close.data(), volume.data(),
+                                                      startTime.data(), fundingRate, &cachedIndicator, &cachedMinMax)
+                                      : calculateExpr(nodeData.value, broker, symbol, timeframe, open.size(),
+                                                      open.data(), high.data(), low.data(), close.data(), volume.data(),
+                                                      startTime.data(), fundingRate, &cachedIndicator, &cachedMinMax);
 
         if (result.has_value())
         {
@@ -485,9 +500,25 @@ bool Worker::handleLogic(NodeData &nodeData, const shared_ptr<Bot> &bot)
             return false;
         }
     }
-    if (nodeData.type == NODE_TYPE::TELEGRAM)
+    if (nodeData.kind == NodeKind::TELEGRAM)
     {
-        string content = calculateSub(nodeData.value);
+        string content;
+        if (nodeData.message)
+        {
+            Expr expr = createExpr();
+            if (renderMessageTemplate(*nodeData.message, expr, messageBuffer))
+            {
+                content.assign(messageBuffer.data(), messageBuffer.size());
+            }
+            else
+            {
+                LOGE("Invalid result for expr {}", nodeData.value);
+            }
+        }
+        else
+        {
+            content = calculateSub(nodeData.value);
+        }
 
         unordered_map<string, string> emoji = {
             {"binance", "🥇🥇🥇"},
@@ -520,122 +551,29 @@ bool Worker::handleLogic(NodeData &nodeData, const shared_ptr<Bot> &bot)
     }
 
     // new order
-    NodeData node = nodeData;
-    if (!adjustParam(node))
+    OrderParams params;
+    if (!adjustParam(nodeData, params))
     {
         return false;
     }
 
-    if (find(orderTypes.begin(), orderTypes.end(), node.type) != orderTypes.end())
-    {
-        long long createdTime = startTime[0];
-        double o = open[0];
-        double h = high[0];
-        double l = low[0];
-        double c = close[0];
-        tasks.enqueue([createdTime, node, bot, broker = this->broker, symbol = this->symbol, timeframe = this->timeframe, o, h, l, c, digit = this->digit]()
-                      {
-        int botID = bot->id;
-
-        LOGI("New order - BotName: {}. BotID: {}, Type: {}, Broker: {}, Symbol: {}, Timeframe: {}, Entry: {}, Stop: {}, TP: {}, SL: {}, Volume: {}, ExpiredTime: {}",
-            bot->botName, botID, node.type, broker, symbol, timeframe,
-            node.entry, node.stop, node.tp, node.sl,
-            node.volume, node.expiredTime);
-        LOGI("open: {}, high: {}, low: {}, close: {}, startTime: {}, timestring: {}", o, h, l, c, createdTime, toTimeString(createdTime));
-        LOGI("digit: {}, {}", digit.prices, digit.volume);
-
-        if (broker == "binance_future" && bot->enableRealOrder && !bot->apiKey.empty() && !bot->secretKey.empty() && !bot->iv.empty())
-        {
-            LOGI("Real order {}", bot->botName);
-            shared_ptr<BinanceFuture> exchange = make_shared<BinanceFuture>(bot->apiKey, bot->secretKey, bot->iv, bot->id);
-
-            if (node.type == NODE_TYPE::BUY_MARKET)
-            {
-                if (compareStringNumber(node.tp, node.entry) > 0 && compareStringNumber(node.sl, node.entry) < 0)
-                {
-                    exchange->buyMarket(symbol, node.volume, node.tp, node.sl);
-                }
-                else
-                {
-                    LOGE("Invalid TP or SL for BUY_MARKET order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
-                }
-            }
-            else if (node.type == NODE_TYPE::BUY_LIMIT)
-            {
-                if (compareStringNumber(node.tp, node.entry) > 0 && compareStringNumber(node.sl, node.entry) < 0)
-                {
-                    exchange->buyLimit(symbol, node.volume, node.entry, node.tp, node.sl, node.expiredTime);
-                }
-                else
-                {
-                    LOGE("Invalid TP or SL for BUY_LIMIT order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
-                }
-            }
-            else if (node.type == NODE_TYPE::SELL_MARKET)
-            {
-                if (compareStringNumber(node.tp, node.entry) < 0 && compareStringNumber(node.sl, node.entry) > 0)
-                {
-                    exchange->sellMarket(symbol, node.volume, node.tp, node.sl);
-                }
-                else
-                {
-                    LOGE("Invalid TP or SL for SELL_MARKET order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
-                }
-            }
-            else if (node.type == NODE_TYPE::SELL_LIMIT)
-            {
-                if (compareStringNumber(node.tp, node.entry) < 0 && compareStringNumber(node.sl, node.entry) > 0)
-                {
-                    exchange->sellLimit(symbol, node.volume, node.entry, node.tp, node.sl, node.expiredTime);
-                }
-                else
-                {
-                    LOGE("Invalid TP or SL for SELL_LIMIT order. TP: {}, SL: {}, Entry: {}", node.tp, node.sl, node.entry);
-                }
-            }
-        }
-
-        auto &db = MySQLConnector::getInstance();
-        string mysql_query = "INSERT INTO Orders(symbol,broker,timeframe,orderType,volume,stop,entry,tp,sl,status,createdTime,expiredTime,botID) VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?)";
-        vector<any> args;
-        //  {
-        //     symbol, broker, timeframe, node.type, stod(node.volume), stod(node.stop),
-        //     node.entry, node.tp, node.sl, ORDER_STATUS::OPENED,
-        //     toTimeString(nextTime(createdTime, timeframe)), node.expiredTime, to_string(botID)};
-
-        args.push_back(symbol);
-        args.push_back(broker);
-        args.push_back(timeframe);
-        args.push_back(node.type);
-        args.push_back(stod(node.volume));
-        if (node.stop.empty())
-        {
-            args.push_back(NULL);
-        }
-        else
-        {
-            args.push_back(stod(node.stop));
-        }
-        args.push_back(stod(node.entry));
-        args.push_back(stod(node.tp));
-        args.push_back(stod(node.sl));
-        args.push_back(ORDER_STATUS::OPENED);
-        args.push_back(nextTime(createdTime, timeframe));
-        if (node.expiredTime.empty() || node.expiredTime == "0")
-        {
-            args.push_back(NULL);
-        }
-        else
-        {
-            args.push_back(stod(node.expiredTime));
-        }
-        args.push_back(botID);
-
-        if (db.executeUpdate(mysql_query, args) <= 0)
-        {
-            LOGE("Failed to insert order into database");
-            return ;
-        } });
+    if (isOrderKind(nodeData.kind))
+    {
+        PendingOrder order;
+        order.bot = bot;
+        order.broker = broker;
+        order.symbol = symbol;
+        order.timeframe = timeframe;
+        order.node.type = nodeData.type;
+        order.node.kind = nodeData.kind;
+        order.params = params;
+        order.digit = digit;
+        order.createdTime = startTime[0];
+        order.open = open[0];
+        order.high = high[0];
+        order.low = low[0];
+        order.close = close[0];
+        OrderSink::getInstance().submit(move(order));
 
         return true;
     }